@@ -0,0 +1,774 @@
+/* ============================================================================
+ * @File: 	 bench.c
+ * @Author: 	 Ozgur Eralp [ozgur.eralp@outlook.com]
+ * @Description: RTSPMODULE Throughput Benchmark
+ *
+ * ============================================================================
+ *
+ * Copyright 2014 Ozgur Eralp.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * ============================================================================
+ *
+ * THROUGHPUT BENCHMARK OF RTSPMODULE, NO CAMERA NEEDED
+ *	- Synthetic frames are fed through rtspmodule_init/rtspmodule_setdata
+ *	  at the given size, rate and pattern.
+ *	- A local RTSP client (forked, rtspsrc ! fakesink) plays the stream.
+ *	- One JSON object is printed on stdout, the module's logs go to stderr.
+ *	- Builds and runs on the host: make bench [BENCH_ARGS="-s 1280x720"]
+ *
+ * ============================================================================
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <gst/gst.h>
+#include "rtspmodule.h"
+#include "frametrace.h"
+#include "pixfmt.h"
+
+#define NOISE_FRAMES	4	/* precomputed, cycled through */
+#define BAR_COUNT	8
+#define MOVE_STEP	8	/* pixels per frame of the moving pattern */
+#define CLIENT_DELAY_MS	500	/* server startup, before the client connects */
+
+#define PATTERN_BLACK	0
+#define PATTERN_BARS	1
+#define PATTERN_MOVING	2	/* bars scrolling sideways */
+#define PATTERN_NOISE	3	/* worst case for the encoder */
+
+struct bench_arguments
+{
+	int 	width;
+	int 	height;
+	int 	fps;
+	int 	duration;	/* seconds measured */
+	int 	warmup;		/* seconds before, left out */
+	int 	bitrate;
+	int 	pattern;
+	const char 	*format;
+	const char 	*encoder;
+	const char 	*payloader;
+	const char 	*profile;
+	int 	mtu;
+	int 	send_batch;	/* 0 = stock udpsink, one sendto per packet */
+};
+
+/* What the client process counted during the measured window */
+struct client_result
+{
+	unsigned long long frames;
+	unsigned long long bytes;
+	unsigned long long cpu_ns;
+	long 	max_rss_kb;
+};
+
+/* Client side state, in the forked process */
+struct client_state
+{
+	GMainLoop 	*loop;
+	GstElement 	*pipeline;
+	unsigned long long start;
+	unsigned long long end;
+	GstClockTime 	last_ts;
+	struct client_result result;
+	unsigned long long cpu_start;
+};
+
+/* Synthetic frames, the layout rtspmodule is told about */
+struct generator
+{
+	const struct pixfmt_desc *desc;
+	struct pixfmt 	layout;
+	int 	pattern;
+	char 	*frames[NOISE_FRAMES];
+	int 	count;
+	char 	*scratch;	/* moving pattern, rotated per frame */
+	unsigned int 	n;
+};
+
+static const char *pattern_names[] = { "black", "bars", "moving", "noise" };
+
+/* BT.601 75% bars: white, yellow, cyan, green, magenta, red, blue, black */
+static const unsigned char bar_yuv[BAR_COUNT][3] = {
+	{ 180, 128, 128 }, { 162,  44, 142 }, { 131, 156,  44 }, { 112,  72,  58 },
+	{  84, 184, 198 }, {  65, 100, 212 }, {  35, 212, 114 }, {  16, 128, 128 },
+};
+
+static void usage (const char *prog);
+static int parse_arguments (int argc, char *argv[], struct bench_arguments *arg);
+static int generator_init (struct generator *gen, struct bench_arguments *arg);
+static void generator_free (struct generator *gen);
+static char *generator_next (struct generator *gen);
+static void paint_frame (struct generator *gen, char *frame, unsigned int seed);
+static void pixel_color (struct generator *gen, int x, int y, unsigned int *seed,
+			 unsigned char yuv[3]);
+static void *t_rtspmodule (void *arg);
+static int run_client (struct bench_arguments *arg, unsigned long long start,
+		       unsigned long long end, int fd);
+static void cb_handoff (GstElement *sink, GstBuffer *buffer, GstPad *pad, gpointer user_data);
+static gboolean cb_client_bus (GstBus *bus, GstMessage *msg, gpointer user_data);
+static gboolean cb_client_tick (gpointer user_data);
+static void print_to_stderr (const gchar *string);
+static unsigned long long monotonic_ns (void);
+static unsigned long long thread_cpu_ns (void);
+static unsigned long long process_cpu_ns (long *max_rss_kb);
+static double percent (unsigned long long part, unsigned long long whole);
+
+int main (int argc, char *argv[])
+{
+	struct bench_arguments arg;
+	struct rtspmodule_arguments rtsparg;
+	struct rtspmodule_stats stats0, stats1;
+	struct frametrace_stats trace[FRAMETRACE_STAGES];
+	struct client_result client;
+	struct generator gen;
+	unsigned long long start, end, now, next, period;
+	unsigned long long gen_ns = 0, handoff_ns = 0, t0, t1, t2;
+	unsigned long long cpu0 = 0, cpu1, offered = 0, accepted = 0, late = 0;
+	long max_rss_kb;
+	pthread_t tid;
+	pid_t child;
+	int fds[2], status, measuring = 0;
+	char *frame;
+
+	if (parse_arguments(argc, argv, &arg) != 0) {
+		usage(argv[0]);
+		return 2;
+	}
+	if (generator_init(&gen, &arg) != 0)
+		return 1;
+	memset(&stats0, 0, sizeof(stats0));
+
+	/* measured window on CLOCK_MONOTONIC, the same in both processes */
+	start = monotonic_ns() + (unsigned long long) arg.warmup * 1000000000ULL;
+	end = start + (unsigned long long) arg.duration * 1000000000ULL;
+
+	/* the client is forked before any GStreamer thread exists */
+	if (pipe(fds) != 0) {
+		perror("$$ pipe");
+		return 1;
+	}
+	child = fork();
+	if (child < 0) {
+		perror("$$ fork");
+		return 1;
+	}
+	if (child == 0) {
+		close(fds[0]);
+		_exit(run_client(&arg, start, end, fds[1]));
+	}
+	close(fds[1]);
+
+	/* keep stdout for the result */
+	g_set_print_handler(print_to_stderr);
+
+	/* encode time comes from the frame trace, sized for the whole run */
+	frametrace_init(4 * arg.fps * (arg.warmup + arg.duration + 1));
+
+	rtsparg.width = arg.width;
+	rtsparg.height = arg.height;
+	rtsparg.gfps = arg.fps;
+	rtsparg.gbitrate = arg.bitrate;
+	rtsparg.min_bitrate = 0;
+	rtsparg.max_bitrate = 0;
+	rtsparg.gmtu = arg.mtu;
+	rtsparg.queue_depth = 2;
+	rtsparg.queue_policy = RTSPMODULE_QUEUE_LATEST_WINS;
+	rtsparg.pool_count = 0;
+	rtsparg.vsrc = (char *)"appsrc";
+	rtsparg.vencoder = (char *)arg.encoder;
+	rtsparg.rtpencoder = (char *)arg.payloader;
+	rtsparg.profile = (char *)arg.profile;
+	rtsparg.informat = (char *)arg.format;
+	rtsparg.stride = 0;
+	/* encoders take planar 4:2:0, as in bbwatch */
+	rtsparg.vformat = gen.desc->planes == 1 ? (char *)"I420" : NULL;
+	rtsparg.metrics_service = NULL;
+	/* the synthetic pattern moves, measure the full rate */
+	rtsparg.motion_fps = 0;
+	rtsparg.motion_threshold = 0;
+	rtsparg.multicast = NULL;
+	rtsparg.send_queue = 0;
+	rtsparg.send_policy = RTSPMODULE_SEND_DROP_NONREF;
+	rtsparg.send_batch = arg.send_batch;
+	if (rtspmodule_init(&rtsparg) != 0) {
+		fprintf(stderr, "$$ rtspmodule init failed\n");
+		kill(child, SIGTERM);
+		return 1;
+	}
+	pthread_create(&tid, NULL, t_rtspmodule, NULL);
+
+	/* Feed frames at the given rate until the window is over */
+	period = 1000000000ULL / arg.fps;
+	next = monotonic_ns();
+	for (;;) {
+		struct timespec ts;
+
+		ts.tv_sec = next / 1000000000ULL;
+		ts.tv_nsec = next % 1000000000ULL;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+		now = monotonic_ns();
+		if (now >= end)
+			break;
+		if (!measuring && now >= start) {
+			measuring = 1;
+			cpu0 = process_cpu_ns(NULL);
+			rtspmodule_getstats(&stats0);
+			frametrace_reset();
+		}
+
+		t0 = thread_cpu_ns();
+		frame = generator_next(&gen);
+		t1 = thread_cpu_ns();
+		status = rtspmodule_setdata(frame);
+		t2 = thread_cpu_ns();
+
+		if (measuring) {
+			gen_ns += t1 - t0;
+			handoff_ns += t2 - t1;
+			offered++;
+			if (status == 0)
+				accepted++;
+		}
+
+		/* fell behind by a frame or more, do not burst to catch up */
+		next += period;
+		if (monotonic_ns() > next + period) {
+			next = monotonic_ns();
+			if (measuring)
+				late++;
+		}
+	}
+	cpu1 = process_cpu_ns(&max_rss_kb);
+	rtspmodule_getstats(&stats1);
+	frametrace_getstats(trace);
+
+	rtspmodule_close();
+	pthread_join(tid, NULL);
+
+	memset(&client, 0, sizeof(client));
+	if (read(fds[0], &client, sizeof(client)) != sizeof(client))
+		fprintf(stderr, "$$ no result from the RTSP client\n");
+	waitpid(child, &status, 0);
+	close(fds[0]);
+
+	/* One JSON object, times in us, cpu in % of one core */
+	printf("{\"bench\":\"rtspmodule\",\"width\":%d,\"height\":%d,\"format\":\"%s\","
+		"\"pattern\":\"%s\",\"encoder\":\"%s\",\"profile\":\"%s\",\"bitrate_kbps\":%d,"
+		"\"fps_target\":%d,\"duration_s\":%d,",
+		arg.width, arg.height, arg.format, pattern_names[arg.pattern], arg.encoder,
+		arg.profile ? arg.profile : "", arg.bitrate, arg.fps, arg.duration);
+	printf("\"frames_offered\":%llu,\"frames_accepted\":%llu,\"generator_late\":%llu,"
+		"\"generator_fps\":%.2f,\"client_frames\":%llu,\"client_fps\":%.2f,"
+		"\"client_kbps\":%.1f,",
+		offered, accepted, late, (double) accepted / arg.duration,
+		client.frames, (double) client.frames / arg.duration,
+		client.bytes * 8.0 / 1000.0 / arg.duration);
+	printf("\"drops\":{\"producer\":%u,\"consumer\":%u,\"underruns\":%u,\"pool_starvations\":%u},",
+		stats1.producer_drops - stats0.producer_drops,
+		stats1.consumer_drops - stats0.consumer_drops,
+		stats1.underruns - stats0.underruns,
+		stats1.pool_starvations - stats0.pool_starvations);
+	printf("\"encode_us\":{\"frames\":%u,\"p50\":%llu,\"p99\":%llu,\"max\":%llu},",
+		trace[FRAMETRACE_ENCODED].count, trace[FRAMETRACE_ENCODED].step_p50 / 1000,
+		trace[FRAMETRACE_ENCODED].step_p99 / 1000, trace[FRAMETRACE_ENCODED].step_max / 1000);
+	printf("\"latency_us\":{\"frames\":%u,\"p50\":%llu,\"p99\":%llu,\"max\":%llu},",
+		trace[FRAMETRACE_PAYLOADED].count, trace[FRAMETRACE_PAYLOADED].total_p50 / 1000,
+		trace[FRAMETRACE_PAYLOADED].total_p99 / 1000, trace[FRAMETRACE_PAYLOADED].total_max / 1000);
+	printf("\"cpu_pct\":{\"generate\":%.1f,\"handoff\":%.1f,\"pipeline\":%.1f,\"client\":%.1f},",
+		percent(gen_ns, end - start), percent(handoff_ns, end - start),
+		percent(cpu1 - cpu0 > gen_ns + handoff_ns ? cpu1 - cpu0 - gen_ns - handoff_ns : 0,
+			end - start),
+		percent(client.cpu_ns, end - start));
+	printf("\"send\":{\"path\":\"%s\",\"mtu\":%d,\"udp_packets\":%llu,\"udp_calls\":%llu,"
+		"\"packets_per_call\":%.1f},",
+		arg.send_batch ? "batch" : "udpsink", arg.mtu,
+		stats1.udp_packets - stats0.udp_packets, stats1.udp_calls - stats0.udp_calls,
+		stats1.udp_calls > stats0.udp_calls ?
+			(double) (stats1.udp_packets - stats0.udp_packets) /
+			(stats1.udp_calls - stats0.udp_calls) : 0.0);
+	printf("\"memory_kb\":{\"server_max_rss\":%ld,\"client_max_rss\":%ld,"
+		"\"pool_buffers\":%u,\"pool_high_water\":%u,\"frame_bytes\":%u}}\n",
+		max_rss_kb, client.max_rss_kb, stats1.pool_buffers, stats1.pool_high_water,
+		gen.layout.size);
+
+	frametrace_close();
+	generator_free(&gen);
+	return client.frames > 0 ? 0 : 1;
+}
+
+static void usage (const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-s WxH] [-f fps] [-d seconds] [-w warmup] [-p black|bars|moving|noise]\n"
+		"          [-F UYVY|YUYV|NV12|I420] [-e encoder] [-r payloader] [-b kbit/s]\n"
+		"          [-P profile] [-m mtu] [-u]\n"
+		"  -u  send RTP with the stock udpsink rather than a frame per call\n", prog);
+}
+
+/* ============================================================================
+ * @Function: 	 parse_arguments
+ * @Description: Command line, defaults are bbwatch's own settings at VGA.
+ * ============================================================================
+ */
+static int parse_arguments (int argc, char *argv[], struct bench_arguments *arg)
+{
+	int opt;
+	unsigned int i;
+
+	arg->width = 640;
+	arg->height = 480;
+	arg->fps = 30;
+	arg->duration = 10;
+	arg->warmup = 2;
+	arg->bitrate = 1000;
+	arg->pattern = PATTERN_MOVING;
+	arg->format = "UYVY";
+	arg->encoder = "x264enc";
+	arg->payloader = "rtph264pay";
+	arg->profile = RTSPMODULE_PROFILE_ULTRA_LOW_LATENCY;
+	arg->mtu = 1400;
+	arg->send_batch = 1;
+
+	while ((opt = getopt(argc, argv, "s:f:d:w:p:F:e:r:b:P:m:u")) != -1) {
+		switch (opt) {
+		case 's':
+			if (sscanf(optarg, "%dx%d", &arg->width, &arg->height) != 2)
+				return -1;
+			break;
+		case 'f':
+			arg->fps = atoi(optarg);
+			break;
+		case 'd':
+			arg->duration = atoi(optarg);
+			break;
+		case 'w':
+			arg->warmup = atoi(optarg);
+			break;
+		case 'p':
+			for (i = 0; i < sizeof(pattern_names) / sizeof(pattern_names[0]); i++)
+				if (strcmp(optarg, pattern_names[i]) == 0)
+					break;
+			if (i == sizeof(pattern_names) / sizeof(pattern_names[0]))
+				return -1;
+			arg->pattern = i;
+			break;
+		case 'F':
+			arg->format = optarg;
+			break;
+		case 'e':
+			arg->encoder = optarg;
+			break;
+		case 'r':
+			arg->payloader = optarg;
+			break;
+		case 'b':
+			arg->bitrate = atoi(optarg);
+			break;
+		case 'P':
+			arg->profile = optarg;
+			break;
+		case 'm':
+			arg->mtu = atoi(optarg);
+			break;
+		case 'u':
+			arg->send_batch = 0;
+			break;
+		default:
+			return -1;
+		}
+	}
+
+	if (arg->width <= 0 || arg->height <= 0 || (arg->width | arg->height) & 1 ||
+	    arg->fps <= 0 || arg->duration <= 0 || arg->warmup < 1 || arg->bitrate <= 0 ||
+	    arg->mtu < 128)
+		return -1;
+
+	return 0;
+}
+
+/* ============================================================================
+ * @Function: 	 generator_init
+ * @Description: Paint the pattern's frames up front, so that generating a
+ * frame costs at most a copy.
+ * ============================================================================
+ */
+static int generator_init (struct generator *gen, struct bench_arguments *arg)
+{
+	int i;
+
+	memset(gen, 0, sizeof(*gen));
+	gen->desc = pixfmt_parse(arg->format);
+	if (!gen->desc || gen->desc->planes == 0 || gen->desc->mem_planes > 1 ||
+	    pixfmt_fill(&gen->layout, gen->desc->fourcc, arg->width, arg->height, 0) != 0) {
+		fprintf(stderr, "$$ Unsupported format %s\n", arg->format);
+		return -1;
+	}
+	gen->pattern = arg->pattern;
+	gen->count = gen->pattern == PATTERN_NOISE ? NOISE_FRAMES : 1;
+
+	for (i = 0; i < gen->count; i++) {
+		gen->frames[i] = malloc(gen->layout.size);
+		if (!gen->frames[i])
+			return -1;
+		paint_frame(gen, gen->frames[i], i + 1);
+	}
+	if (gen->pattern == PATTERN_MOVING) {
+		gen->scratch = malloc(gen->layout.size);
+		if (!gen->scratch)
+			return -1;
+	}
+
+	return 0;
+}
+
+static void generator_free (struct generator *gen)
+{
+	int i;
+
+	for (i = 0; i < gen->count; i++)
+		free(gen->frames[i]);
+	free(gen->scratch);
+}
+
+/* ============================================================================
+ * @Function: 	 generator_next
+ * @Description: Next frame of the pattern. The moving pattern rotates every
+ * line of every plane by MOVE_STEP pixels more than the last frame.
+ * ============================================================================
+ */
+static char *generator_next (struct generator *gen)
+{
+	const struct pixfmt_desc *desc = gen->desc;
+	struct pixfmt *layout = &gen->layout;
+	unsigned int p, y, lines, offset, shift, row;
+	char *src, *dst;
+
+	gen->n++;
+	if (gen->pattern != PATTERN_MOVING)
+		return gen->frames[gen->n % gen->count];
+
+	offset = (gen->n * MOVE_STEP) % layout->width;
+	src = gen->frames[0];
+	dst = gen->scratch;
+	for (p = 0; p < layout->num_planes; p++) {
+		if (p == 0) {
+			row = layout->width * desc->cpp[0];
+			shift = offset * desc->cpp[0];
+		} else {
+			row = (layout->width >> desc->hsub) * desc->cpp[p];
+			shift = (offset >> desc->hsub) * desc->cpp[p];
+		}
+		lines = layout->plane_size[p] / layout->stride[p];
+		for (y = 0; y < lines; y++) {
+			memcpy(dst + y * layout->stride[p], src + y * layout->stride[p] + shift,
+				row - shift);
+			memcpy(dst + y * layout->stride[p] + row - shift, src + y * layout->stride[p],
+				shift);
+		}
+		src += layout->plane_size[p];
+		dst += layout->plane_size[p];
+	}
+
+	return gen->scratch;
+}
+
+/* ============================================================================
+ * @Function: 	 paint_frame
+ * @Description: Paint one frame of the pattern in the generator's format.
+ * Chroma is sampled at the top left pixel it covers.
+ * ============================================================================
+ */
+static void paint_frame (struct generator *gen, char *frame, unsigned int seed)
+{
+	struct pixfmt *layout = &gen->layout;
+	unsigned char *line, *u, *v, yuv[3];
+	unsigned int fourcc = layout->fourcc;
+	int x, y, w = layout->width, h = layout->height;
+
+	/* packed 4:2:2, one chroma pair per two pixels */
+	if (fourcc == PIXFMT_FOURCC('U', 'Y', 'V', 'Y') || fourcc == PIXFMT_FOURCC('Y', 'U', 'Y', 'V')) {
+		int uyvy = fourcc == PIXFMT_FOURCC('U', 'Y', 'V', 'Y');
+
+		for (y = 0; y < h; y++) {
+			line = (unsigned char *) frame + y * layout->stride[0];
+			for (x = 0; x < w; x++) {
+				pixel_color(gen, x, y, &seed, yuv);
+				line[2 * x + (uyvy ? 1 : 0)] = yuv[0];
+				if (!(x & 1)) {
+					line[2 * x + (uyvy ? 0 : 1)] = yuv[1];
+					line[2 * x + (uyvy ? 2 : 3)] = yuv[2];
+				}
+			}
+		}
+		return;
+	}
+
+	/* 4:2:0, luma plane first */
+	for (y = 0; y < h; y++) {
+		line = (unsigned char *) frame + y * layout->stride[0];
+		for (x = 0; x < w; x++) {
+			pixel_color(gen, x, y, &seed, yuv);
+			line[x] = yuv[0];
+		}
+	}
+
+	for (y = 0; y < h / 2; y++) {
+		for (x = 0; x < w / 2; x++) {
+			pixel_color(gen, 2 * x, 2 * y, &seed, yuv);
+			if (layout->num_planes == 2) {
+				/* NV12: UV interleaved, NV21: VU */
+				u = (unsigned char *) frame + layout->plane_size[0] +
+					y * layout->stride[1] + 2 * x;
+				v = u + 1;
+				if (fourcc == PIXFMT_FOURCC('N', 'V', '2', '1')) {
+					v = u;
+					u = u + 1;
+				}
+			} else {
+				/* I420: U then V, YV12: V then U */
+				u = (unsigned char *) frame + layout->plane_size[0] +
+					y * layout->stride[1] + x;
+				v = u + layout->plane_size[1];
+				if (fourcc == PIXFMT_FOURCC('Y', 'V', '1', '2')) {
+					unsigned char *t = u;
+					u = v;
+					v = t;
+				}
+			}
+			*u = yuv[1];
+			*v = yuv[2];
+		}
+	}
+}
+
+static void pixel_color (struct generator *gen, int x, int y, unsigned int *seed,
+			 unsigned char yuv[3])
+{
+	int bar;
+
+	switch (gen->pattern) {
+	case PATTERN_BLACK:
+		yuv[0] = 16;
+		yuv[1] = yuv[2] = 128;
+		break;
+	case PATTERN_NOISE:
+		yuv[0] = 16 + rand_r(seed) % 220;
+		yuv[1] = 16 + rand_r(seed) % 225;
+		yuv[2] = 16 + rand_r(seed) % 225;
+		break;
+	default:
+		bar = x * BAR_COUNT / gen->layout.width;
+		memcpy(yuv, bar_yuv[bar], 3);
+		break;
+	}
+}
+
+/* ============================================================================
+ * @Function: 	 t_rtspmodule
+ * @Description: Runs the RTSP main loop until rtspmodule_close().
+ * ============================================================================
+ */
+static void *t_rtspmodule (void *arg)
+{
+	rtspmodule_start();
+	return NULL;
+}
+
+/* ============================================================================
+ * @Function: 	 run_client
+ * @Description: Forked RTSP client: play the stream, count the frames (RTP
+ * timestamps) and bytes arriving during the window and write the result to
+ * fd. Retries until the server answers.
+ * ============================================================================
+ */
+static int run_client (struct bench_arguments *arg, unsigned long long start,
+		       unsigned long long end, int fd)
+{
+	struct client_state client;
+	struct rusage usage;
+	GstElement *sink;
+	GstBus *bus;
+	GError *error = NULL;
+	gchar *launch;
+
+	memset(&client, 0, sizeof(client));
+	client.start = start;
+	client.end = end;
+	client.last_ts = GST_CLOCK_TIME_NONE;
+
+	g_usleep(CLIENT_DELAY_MS * 1000);
+	gst_init(NULL, NULL);
+	g_set_print_handler(print_to_stderr);
+
+	launch = g_strdup_printf("rtspsrc location=rtsp://127.0.0.1:%s/bbwatch latency=0 ! "
+			"fakesink name=sink sync=false signal-handoffs=true",
+			RTSPMODULE_DEFAULT_SERVICE);
+	client.pipeline = gst_parse_launch(launch, &error);
+	g_free(launch);
+	if (!client.pipeline) {
+		fprintf(stderr, "$$ client pipeline: %s\n", error ? error->message : "?");
+		return 1;
+	}
+
+	sink = gst_bin_get_by_name(GST_BIN (client.pipeline), "sink");
+	g_signal_connect(sink, "handoff", G_CALLBACK (cb_handoff), &client);
+	gst_object_unref(sink);
+
+	client.loop = g_main_loop_new(NULL, FALSE);
+	bus = gst_pipeline_get_bus(GST_PIPELINE (client.pipeline));
+	gst_bus_add_watch(bus, cb_client_bus, &client);
+	gst_object_unref(bus);
+	g_timeout_add(100, cb_client_tick, &client);
+
+	gst_element_set_state(client.pipeline, GST_STATE_PLAYING);
+	g_main_loop_run(client.loop);
+	gst_element_set_state(client.pipeline, GST_STATE_NULL);
+
+	client.result.cpu_ns = process_cpu_ns(NULL) - client.cpu_start;
+	getrusage(RUSAGE_SELF, &usage);
+	client.result.max_rss_kb = usage.ru_maxrss;
+	if (write(fd, &client.result, sizeof(client.result)) != sizeof(client.result))
+		return 1;
+
+	return 0;
+}
+
+/* ============================================================================
+ * @Function: 	 cb_handoff
+ * @Description: One RTP packet received, a new RTP timestamp is a new frame.
+ * ============================================================================
+ */
+static void cb_handoff (GstElement *sink, GstBuffer *buffer, GstPad *pad, gpointer user_data)
+{
+	struct client_state *client = (struct client_state *) user_data;
+	unsigned long long now = monotonic_ns();
+
+	if (now < client->start || now >= client->end)
+		return;
+
+	if (GST_BUFFER_TIMESTAMP (buffer) != client->last_ts) {
+		client->last_ts = GST_BUFFER_TIMESTAMP (buffer);
+		client->result.frames++;
+	}
+	client->result.bytes += GST_BUFFER_SIZE (buffer);
+}
+
+/* ============================================================================
+ * @Function: 	 cb_client_bus
+ * @Description: The server may not be up yet, start over on errors.
+ * ============================================================================
+ */
+static gboolean cb_client_bus (GstBus *bus, GstMessage *msg, gpointer user_data)
+{
+	struct client_state *client = (struct client_state *) user_data;
+	GError *error;
+	gchar *debug;
+
+	if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR) {
+		gst_message_parse_error(msg, &error, &debug);
+		fprintf(stderr, "..client: %s, retrying\n", error->message);
+		g_error_free(error);
+		g_free(debug);
+
+		gst_element_set_state(client->pipeline, GST_STATE_NULL);
+		g_usleep(200 * 1000);
+		gst_element_set_state(client->pipeline, GST_STATE_PLAYING);
+	}
+
+	return TRUE;
+}
+
+/* ============================================================================
+ * @Function: 	 cb_client_tick
+ * @Description: Sample the client's CPU at the window start, stop at its end.
+ * ============================================================================
+ */
+static gboolean cb_client_tick (gpointer user_data)
+{
+	struct client_state *client = (struct client_state *) user_data;
+	unsigned long long now = monotonic_ns();
+
+	if (now >= client->start && !client->cpu_start)
+		client->cpu_start = process_cpu_ns(NULL);
+	if (now >= client->end) {
+		g_main_loop_quit(client->loop);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void print_to_stderr (const gchar *string)
+{
+	fputs(string, stderr);
+}
+
+static unsigned long long monotonic_ns (void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned long long thread_cpu_ns (void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* ============================================================================
+ * @Function: 	 process_cpu_ns
+ * @Description: User plus system time of all the threads of the process,
+ * and its memory high-water mark.
+ * ============================================================================
+ */
+static unsigned long long process_cpu_ns (long *max_rss_kb)
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+	if (max_rss_kb)
+		*max_rss_kb = usage.ru_maxrss;
+
+	return (unsigned long long) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000ULL +
+		(unsigned long long) (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000ULL;
+}
+
+static double percent (unsigned long long part, unsigned long long whole)
+{
+	return whole ? 100.0 * part / whole : 0.0;
+}
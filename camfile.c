@@ -0,0 +1,420 @@
+/* ============================================================================
+ * @File: 	 camfile.c
+ * @Author: 	 Ozgur Eralp [ozgur.eralp@outlook.com]
+ * @Description: Raw Frame Recording and Replay
+ *
+ * ============================================================================
+ *
+ * Copyright 2014 Ozgur Eralp.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * ============================================================================
+ */
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+#include "camfile.h"
+
+#define ALIGN_UP(n)	(((n) + CAMFILE_ALIGN - 1) & ~(unsigned long) (CAMFILE_ALIGN - 1))
+
+static const char padding[CAMFILE_ALIGN];
+
+static int build_index (struct camfile *file);
+static struct camfile_record *record_at (struct camfile *file, unsigned int n);
+static unsigned long long due_time (struct camfile *file);
+static unsigned long long monotonic_time (void);
+
+/* ============================================================================
+ * @Function: 	 camfile_create
+ * @Description: Start a recording in the given format, the file is replaced.
+ * ============================================================================
+ */
+int camfile_create (struct camfile *file, const char *path, const struct camfile_header *format)
+{
+	struct camfile_header header;
+
+	memset(file, 0, sizeof(*file));
+	file->event_fd = -1;
+
+	if (format->num_planes == 0 || format->num_planes > CAMFILE_MAX_PLANES) {
+		printf("$$ cannot record %u planes\n", format->num_planes);
+		return 1;
+	}
+
+	file->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (file->fd < 0) {
+		printf("$$ cannot create %s (%s)\n", path, strerror(errno));
+		return 1;
+	}
+
+	header = *format;
+	header.magic = CAMFILE_MAGIC;
+	header.version = CAMFILE_VERSION;
+	if (write(file->fd, &header, sizeof(header)) != sizeof(header)) {
+		printf("$$ cannot write %s (%s)\n", path, strerror(errno));
+		close(file->fd);
+		file->fd = -1;
+		return 1;
+	}
+	file->header = header;
+	file->written = sizeof(header);
+
+	return 0;
+}
+
+/* ============================================================================
+ * @Function: 	 camfile_write
+ * @Description: Append one frame, the bytes used in each of its planes, with
+ * a single system call.
+ * ============================================================================
+ */
+int camfile_write (struct camfile *file, char *const planes[], const unsigned int size[],
+		   unsigned long long timestamp, unsigned int sequence, int keyframe)
+{
+	struct camfile_record rec;
+	struct iovec iov[1 + 2 * CAMFILE_MAX_PLANES];
+	unsigned int p, n = 0;
+	ssize_t ret;
+
+	if (file->fd < 0)
+		return 1;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.timestamp = timestamp;
+	rec.sequence = sequence;
+	rec.flags = keyframe ? CAMFILE_KEYFRAME : 0;
+	rec.length = sizeof(rec);
+
+	iov[n].iov_base = &rec;
+	iov[n++].iov_len = sizeof(rec);
+	for (p = 0; p < file->header.num_planes; p++) {
+		rec.size[p] = size[p];
+		rec.length += ALIGN_UP(size[p]);
+
+		iov[n].iov_base = planes[p];
+		iov[n++].iov_len = size[p];
+		if (ALIGN_UP(size[p]) != size[p]) {
+			iov[n].iov_base = (void *) padding;
+			iov[n++].iov_len = ALIGN_UP(size[p]) - size[p];
+		}
+	}
+
+	ret = writev(file->fd, iov, n);
+	if (ret != (ssize_t) rec.length) {
+		/* a torn record would end the replay there, stop recording */
+		printf("$$ recording failed after %llu bytes (%s)\n", file->written,
+				ret < 0 ? strerror(errno) : "short write");
+		close(file->fd);
+		file->fd = -1;
+		return 1;
+	}
+	file->written += rec.length;
+
+	return 0;
+}
+
+/* ============================================================================
+ * @Function: 	 camfile_open
+ * @Description: Map a recording for replay, realtime at the recorded pacing
+ * or else as fast as frames are asked for.
+ * ============================================================================
+ */
+int camfile_open (struct camfile *file, const char *path, int realtime, int loop)
+{
+	struct stat st;
+
+	memset(file, 0, sizeof(*file));
+	file->event_fd = -1;
+	file->realtime = realtime;
+	file->loop = loop;
+
+	file->fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (file->fd < 0) {
+		printf("$$ cannot open %s (%s)\n", path, strerror(errno));
+		return 1;
+	}
+	if (fstat(file->fd, &st) != 0 || st.st_size < (off_t) sizeof(struct camfile_header)) {
+		printf("$$ %s is no recording\n", path);
+		camfile_close(file);
+		return 1;
+	}
+
+	/* the whole file, on 32-bit targets recordings must fit the address space */
+	file->map_size = st.st_size;
+	file->map = mmap(NULL, file->map_size, PROT_READ, MAP_PRIVATE, file->fd, 0);
+	if (file->map == MAP_FAILED) {
+		file->map = NULL;
+		printf("$$ cannot map %s (%s)\n", path, strerror(errno));
+		camfile_close(file);
+		return 1;
+	}
+	madvise(file->map, file->map_size, MADV_SEQUENTIAL);
+
+	memcpy(&file->header, file->map, sizeof(file->header));
+	if (file->header.magic != CAMFILE_MAGIC || file->header.version != CAMFILE_VERSION ||
+	    file->header.num_planes == 0 || file->header.num_planes > CAMFILE_MAX_PLANES) {
+		printf("$$ %s is no recording of version %d\n", path, CAMFILE_VERSION);
+		camfile_close(file);
+		return 1;
+	}
+
+	if (build_index(file) != 0) {
+		printf("$$ %s holds no frames\n", path);
+		camfile_close(file);
+		return 1;
+	}
+
+	file->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (file->event_fd < 0) {
+		printf("$$ cannot create replay wakeup event (%s)\n", strerror(errno));
+		camfile_close(file);
+		return 1;
+	}
+
+	return 0;
+}
+
+/* ============================================================================
+ * @Function: 	 camfile_start
+ * @Description: Replay from the first frame, which is due now.
+ * ============================================================================
+ */
+int camfile_start (struct camfile *file)
+{
+	file->next = 0;
+	file->loops = 0;
+	file->start = monotonic_time();
+
+	return 0;
+}
+
+/* ============================================================================
+ * @Function: 	 camfile_wait
+ * @Description: Wait until the next frame is due. Returns 1 when it is, 0 on
+ * timeout, -EINTR when woken up by camfile_wakeup and -ENODATA at the end of
+ * a recording not looped.
+ * ============================================================================
+ */
+int camfile_wait (struct camfile *file, int timeout_ms)
+{
+	struct pollfd fds;
+	unsigned long long due, now;
+	unsigned long long event;
+	int wait_ms = 0, ret;
+
+	if (file->next >= file->count) {
+		if (!file->loop)
+			return -ENODATA;
+		file->next = 0;
+		file->loops++;
+		file->start += file->span;
+	}
+
+	if (file->realtime) {
+		due = due_time(file);
+		now = monotonic_time();
+		if (due > now) {
+			wait_ms = (due - now + 999999) / 1000000;
+			if (timeout_ms >= 0 && timeout_ms < wait_ms)
+				wait_ms = timeout_ms;
+		}
+	}
+
+	/* also as fast as possible, a wakeup must get through */
+	fds.fd = file->event_fd;
+	fds.events = POLLIN;
+	do {
+		ret = poll(&fds, 1, wait_ms);
+	} while (ret == -1 && errno == EINTR);
+
+	if (ret == -1) {
+		printf("$$ replay wait failed (%s)\n", strerror(errno));
+		return -errno;
+	}
+	if (ret > 0 && (fds.revents & POLLIN)) {
+		if (read(file->event_fd, &event, sizeof(event)) < 0)
+			printf("$$ failed to clear replay wakeup event\n");
+		return -EINTR;
+	}
+
+	if (file->realtime && due_time(file) > monotonic_time())
+		return 0;
+	return 1;
+}
+
+/* ============================================================================
+ * @Function: 	 camfile_next
+ * @Description: Take the next frame, pointing into the mapped file. The
+ * timestamp is when it is due, so frames keep their recorded spacing; the
+ * sequence numbers keep the recorded gaps and go on across loops.
+ * ============================================================================
+ */
+int camfile_next (struct camfile *file, struct camfile_frame *frame)
+{
+	struct camfile_record *rec;
+	char *data;
+	unsigned int p;
+
+	if (file->next >= file->count)
+		return 1;
+
+	rec = record_at(file, file->next);
+	data = (char *) rec + sizeof(*rec);
+
+	memset(frame, 0, sizeof(*frame));
+	for (p = 0; p < file->header.num_planes; p++) {
+		frame->planes[p] = data;
+		frame->size[p] = rec->size[p];
+		data += ALIGN_UP(rec->size[p]);
+	}
+	frame->timestamp = file->realtime ? due_time(file) : monotonic_time();
+	frame->sequence = rec->sequence + file->loops * file->sequence_span;
+	frame->keyframe = rec->flags & CAMFILE_KEYFRAME;
+	file->next++;
+
+	return 0;
+}
+
+/* ============================================================================
+ * @Function: 	 camfile_wakeup
+ * @Description: Make camfile_wait return -EINTR, can be called from any
+ * thread.
+ * ============================================================================
+ */
+int camfile_wakeup (struct camfile *file)
+{
+	unsigned long long event = 1;
+
+	if (write(file->event_fd, &event, sizeof(event)) != sizeof(event))
+		return 1;
+
+	return 0;
+}
+
+/* ============================================================================
+ * @Function: 	 camfile_close
+ * @Description: End a recording or a replay. Replayed frames must not be
+ * used anymore.
+ * ============================================================================
+ */
+void camfile_close (struct camfile *file)
+{
+	if (file->map)
+		munmap(file->map, file->map_size);
+	if (file->fd >= 0)
+		close(file->fd);
+	if (file->event_fd >= 0)
+		close(file->event_fd);
+	free(file->index);
+
+	memset(file, 0, sizeof(*file));
+	file->fd = -1;
+	file->event_fd = -1;
+}
+
+/* ============================================================================
+ * @Function: 	 build_index
+ * @Description: Find every complete record. A recording cut short, e.g. by a
+ * power loss, replays up to its last complete frame.
+ * ============================================================================
+ */
+static int build_index (struct camfile *file)
+{
+	struct camfile_record *rec, *first, *last;
+	unsigned long offset, *index, used;
+	unsigned int p, size = 0;
+
+	offset = sizeof(struct camfile_header);
+	while (offset + sizeof(*rec) <= file->map_size) {
+		rec = (struct camfile_record *) (file->map + offset);
+		if (rec->length < sizeof(*rec) || rec->length > file->map_size - offset)
+			break;
+		for (used = sizeof(*rec), p = 0; p < file->header.num_planes; p++) {
+			if (rec->size[p] > file->header.plane_size[p])
+				break;
+			used += ALIGN_UP(rec->size[p]);
+		}
+		if (p < file->header.num_planes || used > rec->length)
+			break;
+
+		if (file->count == size) {
+			size = size ? size * 2 : 1024;
+			index = realloc(file->index, size * sizeof(*index));
+			if (!index)
+				return 1;
+			file->index = index;
+		}
+		file->index[file->count++] = offset;
+		offset += rec->length;
+	}
+	if (file->count == 0)
+		return 1;
+
+	/* a loop lasts the recording plus one frame interval */
+	first = record_at(file, 0);
+	last = record_at(file, file->count - 1);
+	file->span = last->timestamp - first->timestamp;
+	file->span += file->count > 1 ? file->span / (file->count - 1) : 33333333ULL;
+	file->sequence_span = last->sequence - first->sequence + 1;
+
+	return 0;
+}
+
+static struct camfile_record *record_at (struct camfile *file, unsigned int n)
+{
+	return (struct camfile_record *) (file->map + file->index[n]);
+}
+
+/* ============================================================================
+ * @Function: 	 due_time
+ * @Description: When the next frame is due, the replay start plus its offset
+ * from the first frame of the recording.
+ * ============================================================================
+ */
+static unsigned long long due_time (struct camfile *file)
+{
+	struct camfile_record *first = record_at(file, 0);
+	struct camfile_record *rec = record_at(file, file->next);
+
+	return file->start + (rec->timestamp - first->timestamp);
+}
+
+static unsigned long long monotonic_time (void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
@@ -0,0 +1,92 @@
+#ifndef CAMFILE_H_
+#define CAMFILE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CAMFILE_MAGIC		0x52574242	/* "BBWR" */
+#define CAMFILE_VERSION		1
+#define CAMFILE_ALIGN		64	/* records and planes start on a cache line */
+#define CAMFILE_MAX_PLANES	3
+
+/* Record flags */
+#define CAMFILE_KEYFRAME	0x1
+
+/* File layout: the header, then one record per frame, each followed by the
+ * bytes used in every plane. Everything is CAMFILE_ALIGN aligned and little
+ * endian, so mapped plane data can go to SIMD code and the encoder as is. */
+struct camfile_header
+{
+	unsigned int 	magic;
+	unsigned int 	version;
+	unsigned int 	fourcc;		/* V4L2 pixel format */
+	unsigned int 	width;
+	unsigned int 	height;
+	unsigned int 	num_planes;
+	unsigned int 	stride[CAMFILE_MAX_PLANES];	/* bytesperline */
+	unsigned int 	plane_size[CAMFILE_MAX_PLANES];	/* sizeimage */
+	unsigned int 	reserved[4];
+};
+
+struct camfile_record
+{
+	unsigned long long timestamp;	/* capture time, CLOCK_MONOTONIC in ns */
+	unsigned int 	sequence;	/* driver frame counter */
+	unsigned int 	flags;		/* CAMFILE_KEYFRAME */
+	unsigned int 	size[CAMFILE_MAX_PLANES];	/* bytes used per plane */
+	unsigned int 	length;		/* record and its planes, to the next record */
+	unsigned int 	reserved[8];
+};
+
+/* A replayed frame, pointing into the mapped file */
+struct camfile_frame
+{
+	char 	*planes[CAMFILE_MAX_PLANES];
+	unsigned int 	size[CAMFILE_MAX_PLANES];
+	unsigned long long timestamp;	/* rebased onto the replay's own clock */
+	unsigned int 	sequence;
+	int 	keyframe;
+};
+
+struct camfile
+{
+	int 	fd;
+	struct camfile_header header;
+
+	/* replay */
+	int 	event_fd;	/* wakes up camfile_wait() */
+	int 	realtime;	/* at the recorded pacing, else as fast as possible */
+	int 	loop;		/* start over at the end */
+	char 	*map;
+	unsigned long 	map_size;
+	unsigned long 	*index;		/* offset of every record */
+	unsigned int 	count;
+	unsigned int 	next;
+	unsigned long long start;	/* replay time of the first record */
+	unsigned long long span;	/* recording length plus one frame interval */
+	unsigned int 	sequence_span;
+	unsigned int 	loops;
+
+	/* recording */
+	unsigned long long written;
+};
+
+/* These functions return ERROR value as an integer */
+int camfile_create	(struct camfile *file, const char *path, const struct camfile_header *format);
+int camfile_write	(struct camfile *file, char *const planes[], const unsigned int size[],
+			 unsigned long long timestamp, unsigned int sequence, int keyframe);
+
+int camfile_open	(struct camfile *file, const char *path, int realtime, int loop);
+int camfile_start	(struct camfile *file);
+int camfile_wait	(struct camfile *file, int timeout_ms);
+int camfile_next	(struct camfile *file, struct camfile_frame *frame);
+int camfile_wakeup	(struct camfile *file);
+
+void camfile_close	(struct camfile *file);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CAMFILE_H_ */
@@ -36,11 +36,44 @@
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <time.h>
 #include <asm/errno.h>
 #include "v4l2cam.h"
+#include "frametrace.h"
+#include "metrics.h"
+#include "camfile.h"
 #include "cammodule.h"
 
-struct capture_info capinfo;
+/* One capture device */
+struct cammodule
+{
+	struct capture_info capinfo;
+	struct cammodule_frame frames[V4L2_MAX_BUFFER_COUNT];
+	unsigned int 	seen_starvations;
+	unsigned int 	counted_lost;		/* already added to the metrics */
+	unsigned int 	counted_starvations;
+	struct camfile *replay;		/* recording served instead of the device */
+	struct camfile *record;		/* recording of every captured frame */
+	unsigned int 	replay_busy;	/* frames[] handed out, one bit each */
+};
+
+/* Frames handed out are polled for this often before a reformat */
+#define REFORMAT_POLL_MS	5
+
+/* Instance behind the single camera cammodule_init/start/... interface */
+static struct cammodule defaultcam;
+
+static int open_camera (struct cammodule *cam, struct cammodule_arguments *arg);
+static void adapt_queue_depth (struct cammodule *cam);
+static void count_frame (struct cammodule *cam, unsigned long long bytes);
+static int open_replay (struct cammodule *cam, struct cammodule_arguments *arg);
+static int replay_wait (struct cammodule *cam);
+static int replay_frame (struct cammodule *cam, struct cammodule_frame **frame);
+static int open_record (struct cammodule *cam, const char *path);
+static void record_frame (struct cammodule *cam, int buf_no);
+static unsigned long long frame_timestamp (struct v4l2_buffer *v4l2buf);
+static int frame_keyframe (struct capture_info *capinfo, int buf_no,
+			   const unsigned char *data, int size);
 
 /* ============================================================================
  * @Function: 	 cammodule_init
@@ -49,46 +82,221 @@ struct capture_info capinfo;
  */
 int cammodule_init (struct cammodule_arguments *arg)
 {
-    	capinfo.width = arg->width;
-	capinfo.height = arg->height;
-    	capinfo.device_name = arg->device_name;
-	capinfo.fd = -1;
+	return open_camera(&defaultcam, arg);
+}
+
+/* ============================================================================
+ * @Function: 	 cammodule_start
+ * @Description: Start V4L2 capture interface.
+ * ============================================================================
+ */
+int cammodule_start (void)
+{
+	return cammodule_capture_start(&defaultcam);
+}
+
+/* ============================================================================
+ * @Function: 	 cammodule_stop
+ * @Description: Stop V4L2 capture interface.
+ * ============================================================================
+ */
+int cammodule_stop (void)
+{
+	return cammodule_capture_stop(&defaultcam);
+}
+
+/* ============================================================================
+ * @Function: 	 cammodule_getframe
+ * @Description: Get and copy the video frame into a pointer.
+ * ============================================================================
+ */
+int cammodule_getframe (char *data)
+{
+	return cammodule_capture_getframe(&defaultcam, data);
+}
+
+/* ============================================================================
+ * @Function: 	 cammodule_getframe_ref
+ * @Description: Get the video frame captured by the driver without copying.
+ * ============================================================================
+ */
+int cammodule_getframe_ref (struct cammodule_frame **frame)
+{
+	return cammodule_capture_getframe_ref(&defaultcam, frame);
+}
+
+/* ============================================================================
+ * @Function: 	 cammodule_run
+ * @Description: Deliver each captured frame to the callback.
+ * ============================================================================
+ */
+int cammodule_run (cammodule_frame_func callback, void *user_data)
+{
+	return cammodule_capture_run(&defaultcam, callback, user_data);
+}
+
+/* ============================================================================
+ * @Function: 	 cammodule_wakeup
+ * @Description: Make cammodule_run return, can be called from any thread.
+ * ============================================================================
+ */
+int cammodule_wakeup (void)
+{
+	return cammodule_capture_wakeup(&defaultcam);
+}
+
+/* ============================================================================
+ * @Function: 	 cammodule_getstats
+ * @Description: Report capture queue depth and the frames lost by the driver.
+ * ============================================================================
+ */
+int cammodule_getstats (struct cammodule_stats *stats)
+{
+	return cammodule_capture_getstats(&defaultcam, stats);
+}
+
+/* ============================================================================
+ * @Function: 	 cammodule_getformat
+ * @Description: Report the pixel format and frame sizes the camera uses.
+ * ============================================================================
+ */
+int cammodule_getformat (struct cammodule_format *format)
+{
+	return cammodule_capture_getformat(&defaultcam, format);
+}
+
+/* ============================================================================
+ * @Function: 	 cammodule_reformat
+ * @Description: Switch the running capture to another format.
+ * ============================================================================
+ */
+int cammodule_reformat (int width, int height, unsigned int pixelformat, int fps)
+{
+	return cammodule_capture_reformat(&defaultcam, width, height, pixelformat, fps);
+}
+
+/* ============================================================================
+ * @Function: 	 cammodule_create
+ * @Description: Open and initialize one capture device.
+ * ============================================================================
+ */
+struct cammodule *cammodule_create (struct cammodule_arguments *arg)
+{
+	struct cammodule *cam;
+
+	cam = calloc(1, sizeof(*cam));
+	if (!cam)
+		return NULL;
+
+	if (open_camera(cam, arg) != 0) {
+		free(cam);
+		return NULL;
+	}
 
-	if (init_camera(&capinfo) == 0)
+	return cam;
+}
+
+/* ============================================================================
+ * @Function: 	 cammodule_destroy
+ * @Description: Close the capture device if still open and free it. Frames
+ * must not be held anymore.
+ * ============================================================================
+ */
+void cammodule_destroy (struct cammodule *cam)
+{
+	if (!cam)
+		return;
+
+	if (cam->capinfo.fd != -1 || cam->replay)
+		cammodule_capture_stop(cam);
+	free(cam);
+}
+
+/* ============================================================================
+ * @Function: 	 open_camera
+ * @Description: Initialize V4L2 capture interface of the instance.
+ * ============================================================================
+ */
+static int open_camera (struct cammodule *cam, struct cammodule_arguments *arg)
+{
+	struct capture_info *capinfo = &cam->capinfo;
+
+    	capinfo->width = arg->width;
+	capinfo->height = arg->height;
+	capinfo->pixelformat = arg->pixelformat;
+	capinfo->prefer_compressed = arg->prefer_compressed;
+    	capinfo->device_name = arg->device_name;
+	capinfo->fd = -1;
+	capinfo->memory = (arg->io_method == CAMMODULE_IO_USERPTR) ?
+				V4L2_MEMORY_USERPTR : V4L2_MEMORY_MMAP;
+	capinfo->export_dmabuf = arg->export_dmabuf;
+	capinfo->active_count = arg->buffer_count;
+	capinfo->buf_count = arg->max_buffer_count;
+	capinfo->timeout_ms = arg->timeout_ms;
+
+	if (arg->replay_file)
+		return open_replay(cam, arg);
+
+	if (init_camera(capinfo) == 0)
 	{
     		printf("...camera init'ed successfully\n");
+		if (arg->record_file)
+			open_record(cam, arg->record_file);
 		return 0;
 	}else{
 		printf("$$ camera initialization error!\n");
+		capinfo->fd = -1;
 		return 1;
 	}
 }
 
 /* ============================================================================
- * @Function: 	 cammodule_start
+ * @Function: 	 cammodule_capture_start
  * @Description: Start V4L2 capture interface.
  * ============================================================================
  */
-int cammodule_start (void)
+int cammodule_capture_start (struct cammodule *cam)
 {
-	if (start_camera(&capinfo) == 0)
+	if (cam->replay) {
+		camfile_start(cam->replay);
+		printf("...camera replay started.\n");
+		return 0;
+	}
+
+	if (start_camera(&cam->capinfo) == 0)
 	{
     		printf("...camera capturing started.\n");
 		return 0;
 	}else{
 		printf("$$ camera start error!\n");
+		cam->capinfo.fd = -1;
 		return 1;
 	}
 }
 
 /* ============================================================================
- * @Function: 	 cammodule_stop
+ * @Function: 	 cammodule_capture_stop
  * @Description: Stop V4L2 capture interface.
  * ============================================================================
  */
-int cammodule_stop (void)
+int cammodule_capture_stop (struct cammodule *cam)
 {
-	if (close_camera(&capinfo) == 0)
+	if (cam->record) {
+		printf("...camera recording closed, %llu bytes.\n", cam->record->written);
+		camfile_close(cam->record);
+		free(cam->record);
+		cam->record = NULL;
+	}
+
+	if (cam->replay) {
+		camfile_close(cam->replay);
+		free(cam->replay);
+		cam->replay = NULL;
+		printf("...camera replay closed.\n");
+		return 0;
+	}
+
+	if (close_camera(&cam->capinfo) == 0)
 	{
     		printf("...camera closed.\n");
 		return 0;
@@ -99,26 +307,554 @@ int cammodule_stop (void)
 }
 
 /* ============================================================================
- * @Function: 	 cammodule_getframe
- * @Description: Get and copy the video frame into a pointer.
+ * @Function: 	 cammodule_capture_getframe
+ * @Description: Get and copy the video frame into a pointer, which must hold
+ * the size given by cammodule_capture_getformat().
  * ============================================================================
  */
-int cammodule_getframe (char *data)
+int cammodule_capture_getframe (struct cammodule *cam, char *data)
 {
+	struct capture_info *capinfo = &cam->capinfo;
+	struct cammodule_frame *frame;
 	int 	buf_no;
-	int	height = capinfo.height;
-	int 	width = capinfo.width;
-	char 	*srcPlane;
+	unsigned int 	p, size;
+	unsigned long long dequeued, key = 0, bytes = 0;
+
+	if (cam->replay) {
+		if (cammodule_capture_getframe_ref(cam, &frame) != 0)
+			return 1;
+		for (p = 0; p < capinfo->num_planes; p++) {
+			memcpy(data, frame->planes[p], frame->plane_size[p]);
+			data += capinfo->sizeimage[p];
+		}
+		return cammodule_putframe(frame);
+	}
 
 	/*pointer of the frame captured by driver */
-    	buf_no = get_camera_frame(&capinfo);
-    	srcPlane = capinfo.userptr[buf_no];
+    	buf_no = get_camera_frame(capinfo);
+	if (buf_no < 0)
+		return 1;
+	dequeued = frametrace_enabled() ? frametrace_now() : 0;
+	adapt_queue_depth(cam);
+	record_frame(cam, buf_no);
 
-    	memcpy(data, srcPlane, height*width*4);
+	if (frametrace_enabled()) {
+		key = frame_timestamp(&capinfo->v4l2buf[buf_no]);
+		frametrace_stamp(FRAMETRACE_DQBUF, key, FRAMETRACE_TRACK_CAPTURE, dequeued);
+	}
+
+	/* planes back to back, sizeimage apart */
+	for (p = 0; p < capinfo->num_planes; p++) {
+		size = camera_plane_used(capinfo, buf_no, p);
+    		memcpy(data, camera_plane_data(capinfo, buf_no, p), size);
+    		data += capinfo->sizeimage[p];
+		bytes += size;
+	}
+	count_frame(cam, bytes);
 		
 	/*release the driver buffer */
-    	put_camera_frame(&capinfo, buf_no);
+    	put_camera_frame(capinfo, buf_no);
+
+	if (key)
+		frametrace_stamp(FRAMETRACE_GETFRAME, key, FRAMETRACE_TRACK_CAPTURE, 0);
+	return 0;
+}
+
+
+/* ============================================================================
+ * @Function: 	 cammodule_capture_getframe_ref
+ * @Description: Get the video frame captured by the driver without copying.
+ * The driver buffer stays dequeued until cammodule_putframe() is called.
+ * ============================================================================
+ */
+int cammodule_capture_getframe_ref (struct cammodule *cam, struct cammodule_frame **frame)
+{
+	struct capture_info *capinfo = &cam->capinfo;
+	int 	buf_no;
+	struct cammodule_frame *camframe;
+	unsigned int 	p;
+	unsigned long long dequeued, bytes = 0;
+
+	if (cam->replay)
+		return replay_wait(cam) != 0 ? 1 : replay_frame(cam, frame);
+
+	buf_no = get_camera_frame(capinfo);
+	if (buf_no < 0)
+		return 1;
+	dequeued = frametrace_enabled() ? frametrace_now() : 0;
+	adapt_queue_depth(cam);
+	record_frame(cam, buf_no);
+
+	camframe = &cam->frames[buf_no];
+	camframe->num_planes = capinfo->num_planes;
+	for (p = 0; p < capinfo->num_planes; p++) {
+		camframe->planes[p] = camera_plane_data(capinfo, buf_no, p);
+		camframe->plane_size[p] = camera_plane_used(capinfo, buf_no, p);
+		camframe->dmabuf_fd[p] = capinfo->dmabuf_fd[buf_no][p];
+		bytes += camframe->plane_size[p];
+	}
+	count_frame(cam, bytes);
+	camframe->data = camframe->planes[0];
+	camframe->size = camframe->plane_size[0];
+	camframe->stride = capinfo->bytesperline[0];
+	camframe->index = buf_no;
+	camframe->timestamp = frame_timestamp(&capinfo->v4l2buf[buf_no]);
+	camframe->sequence = capinfo->v4l2buf[buf_no].sequence;
+	camframe->keyframe = frame_keyframe(capinfo, buf_no,
+				(const unsigned char *) camframe->data, camframe->size);
+	camframe->cam = cam;
+
+	frametrace_stamp(FRAMETRACE_DQBUF, camframe->timestamp, FRAMETRACE_TRACK_CAPTURE, dequeued);
+	frametrace_stamp(FRAMETRACE_GETFRAME, camframe->timestamp, FRAMETRACE_TRACK_CAPTURE, 0);
+	*frame = camframe;
+	return 0;
+}
+
+/* ============================================================================
+ * @Function: 	 cammodule_putframe
+ * @Description: Give a frame taken by cammodule_getframe_ref back to driver.
+ * ============================================================================
+ */
+int cammodule_putframe (struct cammodule_frame *frame)
+{
+	if (frame->cam->replay) {
+		__atomic_fetch_and(&frame->cam->replay_busy, ~(1u << frame->index),
+				__ATOMIC_RELEASE);
+		return 0;
+	}
+
+	if (put_camera_frame(&frame->cam->capinfo, frame->index) != 0)
+		return 1;
+
+	return 0;
+}
+
+/* ============================================================================
+ * @Function: 	 cammodule_capture_run
+ * @Description: Wait on the capture device and deliver each frame to the
+ * callback as soon as the driver completes it. Returns after
+ * cammodule_capture_wakeup() is called.
+ * ============================================================================
+ */
+int cammodule_capture_run (struct cammodule *cam, cammodule_frame_func callback, void *user_data)
+{
+	struct cammodule_frame *frame;
+	int 	ret;
+
+	for (;;) {
+		if (cam->replay)
+			ret = camfile_wait(cam->replay, cam->capinfo.timeout_ms);
+		else
+			ret = wait_camera_frame(&cam->capinfo, cam->capinfo.timeout_ms);
+		if (ret == -EINTR)
+			break;
+		if (ret == -ENODATA) {
+			printf("...camera replay finished.\n");
+			break;
+		}
+		if (ret < 0) {
+			printf("$$ camera wait error!\n");
+			return 1;
+		}
+		if (ret == 0) {
+			printf("$$ no frame from camera %s for %d ms\n",
+					cam->capinfo.device_name, cam->capinfo.timeout_ms);
+			continue;
+		}
+
+		if (cam->replay)
+			ret = replay_frame(cam, &frame);
+		else
+			ret = cammodule_capture_getframe_ref(cam, &frame);
+		if (ret != 0)
+			continue;
+		callback(frame, user_data);
+	}
 
 	return 0;
 }
 
+/* ============================================================================
+ * @Function: 	 cammodule_capture_wakeup
+ * @Description: Make cammodule_capture_run return, can be called from any
+ * thread.
+ * ============================================================================
+ */
+int cammodule_capture_wakeup (struct cammodule *cam)
+{
+	if (cam->replay)
+		return camfile_wakeup(cam->replay);
+
+	if (wakeup_camera(&cam->capinfo) != 0)
+		return 1;
+
+	return 0;
+}
+
+/* ============================================================================
+ * @Function: 	 cammodule_capture_getstats
+ * @Description: Report capture queue depth and the frames lost by the driver.
+ * ============================================================================
+ */
+int cammodule_capture_getstats (struct cammodule *cam, struct cammodule_stats *stats)
+{
+	stats->lost_frames = cam->capinfo.lost_frames;
+	stats->starvations = cam->capinfo.starvations;
+	stats->buffer_count = cam->capinfo.active_count;
+
+	return 0;
+}
+
+/* ============================================================================
+ * @Function: 	 cammodule_capture_getformat
+ * @Description: Report the pixel format and frame sizes the camera uses.
+ * ============================================================================
+ */
+int cammodule_capture_getformat (struct cammodule *cam, struct cammodule_format *format)
+{
+	struct capture_info *capinfo = &cam->capinfo;
+	unsigned int p;
+
+	memset(format, 0, sizeof(*format));
+	format->fourcc = capinfo->pixelformat;
+	format->width = capinfo->width;
+	format->height = capinfo->height;
+	format->num_planes = capinfo->num_planes;
+	for (p = 0; p < capinfo->num_planes; p++) {
+		format->stride[p] = capinfo->bytesperline[p];
+		format->plane_size[p] = capinfo->sizeimage[p];
+		format->size += capinfo->sizeimage[p];
+	}
+
+	return 0;
+}
+
+/* ============================================================================
+ * @Function: 	 cammodule_capture_reformat
+ * @Description: Switch the running capture to another size, pixel format or
+ * rate without closing the device. The driver buffers are freed on the way,
+ * so this waits (up to timeout_ms) for every frame handed out to be put back.
+ * A recording is closed, it has one format.
+ * ============================================================================
+ */
+int cammodule_capture_reformat (struct cammodule *cam, int width, int height,
+				unsigned int pixelformat, int fps)
+{
+	struct capture_info *capinfo = &cam->capinfo;
+	unsigned int 	queued;
+	int 	waited = 0;
+
+	if (cam->replay) {
+		printf("$$ camera replay keeps its recorded format\n");
+		return 1;
+	}
+
+	for (;;) {
+		queued = __atomic_load_n(&capinfo->queued, __ATOMIC_SEQ_CST);
+		if (queued >= capinfo->active_count)
+			break;
+		if (waited >= capinfo->timeout_ms) {
+			printf("$$ %u camera frames still held, format kept\n",
+					capinfo->active_count - queued);
+			return 1;
+		}
+		usleep(REFORMAT_POLL_MS * 1000);
+		waited += REFORMAT_POLL_MS;
+	}
+
+	if (cam->record) {
+		printf("...camera recording closed, format changed.\n");
+		camfile_close(cam->record);
+		free(cam->record);
+		cam->record = NULL;
+	}
+
+	if (reformat_camera(capinfo, width, height, pixelformat, fps) != 0) {
+		printf("$$ camera reformat error!\n");
+		return 1;
+	}
+
+	printf("...camera reformatted to %dx%d.\n", capinfo->width, capinfo->height);
+	return 0;
+}
+
+/* ============================================================================
+ * @Function: 	 adapt_queue_depth
+ * @Description: Give the driver one more buffer each time its queue is seen
+ * running dry, as long as spares were allocated (max_buffer_count).
+ * ============================================================================
+ */
+static void adapt_queue_depth (struct cammodule *cam)
+{
+	if (cam->capinfo.starvations == cam->seen_starvations)
+		return;
+
+	cam->seen_starvations = cam->capinfo.starvations;
+	grow_camera_queue(&cam->capinfo);
+}
+
+/* ============================================================================
+ * @Function: 	 count_frame
+ * @Description: Add the dequeued frame, and what the driver lost since the
+ * last one, to the capture metrics.
+ * ============================================================================
+ */
+static void count_frame (struct cammodule *cam, unsigned long long bytes)
+{
+	struct capture_info *capinfo = &cam->capinfo;
+
+	metrics_add(METRICS_CAPTURE_FRAMES, 1);
+	metrics_add(METRICS_CAPTURE_BYTES, bytes);
+
+	if (capinfo->lost_frames != cam->counted_lost) {
+		metrics_add(METRICS_CAPTURE_LOST, capinfo->lost_frames - cam->counted_lost);
+		cam->counted_lost = capinfo->lost_frames;
+	}
+	if (capinfo->starvations != cam->counted_starvations) {
+		metrics_add(METRICS_CAPTURE_STARVATIONS,
+				capinfo->starvations - cam->counted_starvations);
+		cam->counted_starvations = capinfo->starvations;
+	}
+}
+
+/* ============================================================================
+ * @Function: 	 open_replay
+ * @Description: Map a recording to serve in place of the capture device. Its
+ * format stands in for the negotiated one.
+ * ============================================================================
+ */
+static int open_replay (struct cammodule *cam, struct cammodule_arguments *arg)
+{
+	struct capture_info *capinfo = &cam->capinfo;
+	struct camfile_header *header;
+	unsigned int p;
+
+	cam->replay = calloc(1, sizeof(*cam->replay));
+	if (!cam->replay)
+		return 1;
+
+	if (camfile_open(cam->replay, arg->replay_file,
+			 arg->replay_mode == CAMMODULE_REPLAY_REALTIME, arg->replay_loop) != 0) {
+		printf("$$ camera replay error!\n");
+		free(cam->replay);
+		cam->replay = NULL;
+		return 1;
+	}
+
+	header = &cam->replay->header;
+	capinfo->pixelformat = header->fourcc;
+	capinfo->width = header->width;
+	capinfo->height = header->height;
+	capinfo->num_planes = header->num_planes;
+	for (p = 0; p < header->num_planes; p++) {
+		capinfo->bytesperline[p] = header->stride[p];
+		capinfo->sizeimage[p] = header->plane_size[p];
+	}
+	capinfo->device_name = arg->replay_file;
+	capinfo->active_count = V4L2_MAX_BUFFER_COUNT;
+	if (capinfo->timeout_ms <= 0)
+		capinfo->timeout_ms = V4L2_DEFAULT_TIMEOUT_MS;
+
+	printf("...camera replaying %s, %u frames\n", arg->replay_file, cam->replay->count);
+	return 0;
+}
+
+/* ============================================================================
+ * @Function: 	 replay_wait
+ * @Description: Block until the next replayed frame is due, as a DQBUF would.
+ * ============================================================================
+ */
+static int replay_wait (struct cammodule *cam)
+{
+	int 	ret;
+
+	do {
+		ret = camfile_wait(cam->replay, -1);
+	} while (ret == 0);
+
+	return ret == 1 ? 0 : 1;
+}
+
+/* ============================================================================
+ * @Function: 	 replay_frame
+ * @Description: Hand out the next replayed frame, pointing into the mapped
+ * recording. When every frame slot is still held the frame is dropped and
+ * counted as a starved driver queue would be.
+ * ============================================================================
+ */
+static int replay_frame (struct cammodule *cam, struct cammodule_frame **frame)
+{
+	struct capture_info *capinfo = &cam->capinfo;
+	struct camfile_frame replayed;
+	struct cammodule_frame *camframe;
+	unsigned int 	busy, slot, p;
+	unsigned long long bytes = 0;
+
+	if (camfile_next(cam->replay, &replayed) != 0)
+		return 1;
+
+	busy = __atomic_load_n(&cam->replay_busy, __ATOMIC_ACQUIRE);
+	for (slot = 0; slot < V4L2_MAX_BUFFER_COUNT; slot++)
+		if (!(busy & (1u << slot)))
+			break;
+	if (slot == V4L2_MAX_BUFFER_COUNT) {
+		capinfo->starvations++;
+		capinfo->lost_frames++;
+		return 1;
+	}
+	__atomic_fetch_or(&cam->replay_busy, 1u << slot, __ATOMIC_ACQUIRE);
+
+	camframe = &cam->frames[slot];
+	camframe->num_planes = capinfo->num_planes;
+	for (p = 0; p < capinfo->num_planes; p++) {
+		camframe->planes[p] = replayed.planes[p];
+		camframe->plane_size[p] = replayed.size[p];
+		camframe->dmabuf_fd[p] = -1;
+		bytes += replayed.size[p];
+	}
+	camframe->data = camframe->planes[0];
+	camframe->size = camframe->plane_size[0];
+	camframe->stride = capinfo->bytesperline[0];
+	camframe->index = slot;
+	camframe->timestamp = replayed.timestamp;
+	camframe->sequence = replayed.sequence;
+	camframe->keyframe = replayed.keyframe;
+	camframe->cam = cam;
+	count_frame(cam, bytes);
+
+	frametrace_stamp(FRAMETRACE_DQBUF, camframe->timestamp, FRAMETRACE_TRACK_CAPTURE, 0);
+	frametrace_stamp(FRAMETRACE_GETFRAME, camframe->timestamp, FRAMETRACE_TRACK_CAPTURE, 0);
+	*frame = camframe;
+	return 0;
+}
+
+/* ============================================================================
+ * @Function: 	 open_record
+ * @Description: Start recording every captured frame in the negotiated
+ * format. The camera keeps working when the file cannot be written.
+ * ============================================================================
+ */
+static int open_record (struct cammodule *cam, const char *path)
+{
+	struct capture_info *capinfo = &cam->capinfo;
+	struct camfile_header format;
+	unsigned int p;
+
+	memset(&format, 0, sizeof(format));
+	format.fourcc = capinfo->pixelformat;
+	format.width = capinfo->width;
+	format.height = capinfo->height;
+	format.num_planes = capinfo->num_planes;
+	for (p = 0; p < capinfo->num_planes; p++) {
+		format.stride[p] = capinfo->bytesperline[p];
+		format.plane_size[p] = capinfo->sizeimage[p];
+	}
+
+	cam->record = calloc(1, sizeof(*cam->record));
+	if (!cam->record)
+		return 1;
+
+	if (camfile_create(cam->record, path, &format) != 0) {
+		printf("$$ camera recording error!\n");
+		free(cam->record);
+		cam->record = NULL;
+		return 1;
+	}
+
+	printf("...camera recording to %s\n", path);
+	return 0;
+}
+
+/* ============================================================================
+ * @Function: 	 record_frame
+ * @Description: Append the dequeued frame to the recording, if one is made.
+ * Recording stops on the first write error.
+ * ============================================================================
+ */
+static void record_frame (struct cammodule *cam, int buf_no)
+{
+	struct capture_info *capinfo = &cam->capinfo;
+	char 	*planes[CAMFILE_MAX_PLANES];
+	unsigned int 	size[CAMFILE_MAX_PLANES];
+	unsigned int 	p;
+
+	if (!cam->record)
+		return;
+
+	for (p = 0; p < capinfo->num_planes; p++) {
+		planes[p] = camera_plane_data(capinfo, buf_no, p);
+		size[p] = camera_plane_used(capinfo, buf_no, p);
+	}
+
+	if (camfile_write(cam->record, planes, size,
+			  frame_timestamp(&capinfo->v4l2buf[buf_no]),
+			  capinfo->v4l2buf[buf_no].sequence,
+			  frame_keyframe(capinfo, buf_no, (const unsigned char *) planes[0],
+					 size[0])) != 0) {
+		camfile_close(cam->record);
+		free(cam->record);
+		cam->record = NULL;
+	}
+}
+
+/* ============================================================================
+ * @Function: 	 frame_timestamp
+ * @Description: Capture time of the buffer on CLOCK_MONOTONIC in ns. Older
+ * drivers stamp with the wall clock, those are moved onto the monotonic one.
+ * ============================================================================
+ */
+static unsigned long long frame_timestamp (struct v4l2_buffer *v4l2buf)
+{
+	struct timespec mono, real;
+	long long ts;
+
+	ts = (long long) v4l2buf->timestamp.tv_sec * 1000000000LL +
+			(long long) v4l2buf->timestamp.tv_usec * 1000LL;
+
+#ifdef V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC
+	if ((v4l2buf->flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+		return ts;
+#endif
+
+	clock_gettime(CLOCK_MONOTONIC, &mono);
+	clock_gettime(CLOCK_REALTIME, &real);
+	ts += ((long long) mono.tv_sec - real.tv_sec) * 1000000000LL +
+			((long long) mono.tv_nsec - real.tv_nsec);
+
+	return ts > 0 ? ts : 0;
+}
+
+/* ============================================================================
+ * @Function: 	 frame_keyframe
+ * @Description: Whether the frame decodes on its own. Only H.264 has frames
+ * that do not; drivers flag them, or else (uvcvideo) the access unit is
+ * scanned for an IDR slice ahead of any other slice.
+ * ============================================================================
+ */
+static int frame_keyframe (struct capture_info *capinfo, int buf_no,
+			   const unsigned char *data, int size)
+{
+	unsigned int flags = capinfo->v4l2buf[buf_no].flags;
+	int i, nal;
+
+	if (capinfo->pixelformat != V4L2_PIX_FMT_H264)
+		return 1;
+
+	if (flags & V4L2_BUF_FLAG_KEYFRAME)
+		return 1;
+	if (flags & (V4L2_BUF_FLAG_PFRAME | V4L2_BUF_FLAG_BFRAME))
+		return 0;
+
+	for (i = 0; i + 3 < size; i++) {
+		if (data[i] != 0 || data[i + 1] != 0 || data[i + 2] != 1)
+			continue;
+		nal = data[i + 3] & 0x1f;
+		if (nal == 5)
+			return 1;
+		if (nal >= 1 && nal <= 4)
+			return 0;
+		i += 3;
+	}
+
+	return 0;
+}
@@ -8,18 +8,116 @@ extern "C" {
 #define MAX_WIDTH	1280
 #define MAX_HEIGHT 	960 
 
+/* Capture I/O methods */
+#define CAMMODULE_IO_MMAP	0	/* driver owned buffers, mmap'ed */
+#define CAMMODULE_IO_USERPTR	1	/* module owned buffers, driver writes into them */
+
+/* Replay pacing */
+#define CAMMODULE_REPLAY_REALTIME	0	/* at the recorded frame times */
+#define CAMMODULE_REPLAY_FAST		1	/* as fast as frames are taken */
+
+/* Pixel formats are V4L2 fourccs, e.g. CAMMODULE_FOURCC('Y','U','Y','V') */
+#define CAMMODULE_FOURCC(a, b, c, d) \
+	((unsigned int)(a) | ((unsigned int)(b) << 8) | \
+	 ((unsigned int)(c) << 16) | ((unsigned int)(d) << 24))
+
+#define CAMMODULE_MAX_PLANES	3
+
 struct cammodule_arguments 
 {
 	int 	width;
 	int 	height;
+	unsigned int 	pixelformat;	/* 0 = best one the camera offers */
+	int 	prefer_compressed;	/* take the camera's H.264 or MJPEG when offered */
+	int 	io_method;
+	int 	export_dmabuf;	/* export frames as dmabuf fds, mmap only */
+	int 	buffer_count;	/* capture queue depth, 0 = default */
+	int 	max_buffer_count; /* above buffer_count: grow when the queue runs dry */
+	int 	timeout_ms;	/* warn when no frame arrives for this long, 0 = default */
 	char 	*device_name;
+	char 	*replay_file;	/* serve a recording instead of the device, NULL = none */
+	int 	replay_mode;	/* CAMMODULE_REPLAY_REALTIME or _FAST */
+	int 	replay_loop;	/* start over at the end of the recording */
+	char 	*record_file;	/* also write every captured frame here, NULL = none */
 };
 
+struct cammodule;
+
+/* What the camera settled on, sizes as reported by the driver */
+struct cammodule_format
+{
+	unsigned int 	fourcc;
+	int 	width;
+	int 	height;
+	int 	num_planes;	/* buffers per frame, above 1 for multi-planar formats */
+	int 	stride[CAMMODULE_MAX_PLANES];	/* bytesperline */
+	int 	plane_size[CAMMODULE_MAX_PLANES];	/* sizeimage */
+	int 	size;		/* all planes, what cammodule_getframe copies */
+};
+
+/* A captured frame, still owned by the driver queue until it is put back */
+struct cammodule_frame
+{
+	char 	*data;		/* first plane */
+	int 	size;		/* bytes used in the first plane */
+	int 	stride;
+	int 	num_planes;
+	char 	*planes[CAMMODULE_MAX_PLANES];
+	int 	plane_size[CAMMODULE_MAX_PLANES];
+	int 	index;
+	int 	dmabuf_fd[CAMMODULE_MAX_PLANES];	/* per plane, -1 unless export_dmabuf was asked for */
+	unsigned long long timestamp;	/* capture time, CLOCK_MONOTONIC in ns */
+	unsigned int 	sequence;	/* driver frame counter */
+	int 	keyframe;	/* decodable on its own, always for raw and MJPEG */
+	struct cammodule *cam;		/* capture device the frame belongs to */
+};
+
+struct cammodule_stats
+{
+	unsigned int 	lost_frames;	/* missing from the driver sequence numbers */
+	unsigned int 	starvations;	/* times the driver had no buffer queued */
+	unsigned int 	buffer_count;	/* current capture queue depth */
+};
+
+/* Called from cammodule_run for every frame as soon as the driver completes
+ * it. The frame must be given back with cammodule_putframe() */
+typedef void (*cammodule_frame_func) (struct cammodule_frame *frame, void *user_data);
+
 /* These functions return ERROR value as an integer */
 int cammodule_init 	(struct cammodule_arguments *arg);
 int cammodule_start	(void);
 int cammodule_stop 	(void);
 int cammodule_getframe	(char *data);
+int cammodule_getstats	(struct cammodule_stats *stats);
+int cammodule_getformat	(struct cammodule_format *format);
+
+/* Switch the running capture to another size, pixel format (0 = keep) or
+ * rate (0 = keep). Called from the capturing thread, e.g. the run callback;
+ * every frame handed out must come back within timeout_ms */
+int cammodule_reformat		(int width, int height, unsigned int pixelformat, int fps);
+
+/* Zero-copy access: the frame must be given back with cammodule_putframe() */
+int cammodule_getframe_ref	(struct cammodule_frame **frame);
+int cammodule_putframe		(struct cammodule_frame *frame);
+
+/* Event driven capture: run delivers frames until wakeup is called */
+int cammodule_run		(cammodule_frame_func callback, void *user_data);
+int cammodule_wakeup		(void);
+
+/* Instance interface, one handle per capture device. The calls above work on
+ * a default instance for single camera applications. */
+struct cammodule *cammodule_create	(struct cammodule_arguments *arg);
+void cammodule_destroy			(struct cammodule *cam);
+int cammodule_capture_start		(struct cammodule *cam);
+int cammodule_capture_stop		(struct cammodule *cam);
+int cammodule_capture_getframe		(struct cammodule *cam, char *data);
+int cammodule_capture_getframe_ref	(struct cammodule *cam, struct cammodule_frame **frame);
+int cammodule_capture_run		(struct cammodule *cam, cammodule_frame_func callback, void *user_data);
+int cammodule_capture_wakeup		(struct cammodule *cam);
+int cammodule_capture_getstats		(struct cammodule *cam, struct cammodule_stats *stats);
+int cammodule_capture_getformat		(struct cammodule *cam, struct cammodule_format *format);
+int cammodule_capture_reformat		(struct cammodule *cam, int width, int height,
+					 unsigned int pixelformat, int fps);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,185 @@
+/* ============================================================================
+ * @File: 	 encprofile.c
+ * @Author: 	 Ozgur Eralp [ozgur.eralp@outlook.com]
+ * @Description: Encoder and Payloader Latency Profiles
+ *
+ * ============================================================================
+ *
+ * Copyright 2014 Ozgur Eralp.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * ============================================================================
+ */
+
+
+#include <string.h>
+#include <gst/gst.h>
+#include "rtspmodule.h"
+#include "encprofile.h"
+
+/* Settings of one element family under one profile. element ending in '*'
+ * matches a prefix (ffenc_*). The keyframe interval is given in seconds and
+ * set in frames on key_property. */
+struct element_profile
+{
+	const char 	*profile;
+	const char 	*element;
+	const char 	*settings;	/* "property=value ..." */
+	const char 	*key_property;
+	int 		key_seconds;
+};
+
+static const struct element_profile profiles[] = {
+	/* x264: no lookahead, no B-frames and sliced threads keep the
+	 * encoder from holding frames back */
+	{ RTSPMODULE_PROFILE_ULTRA_LOW_LATENCY, "x264enc",
+	  "tune=zerolatency speed-preset=ultrafast sliced-threads=true threads=0 "
+	  "bframes=0 rc-lookahead=0 sync-lookahead=0 b-adapt=false",
+	  "key-int-max", 1 },
+	{ RTSPMODULE_PROFILE_BALANCED, "x264enc",
+	  "tune=zerolatency speed-preset=veryfast sliced-threads=false threads=2 "
+	  "bframes=0 rc-lookahead=0",
+	  "key-int-max", 2 },
+	{ RTSPMODULE_PROFILE_QUALITY, "x264enc",
+	  "speed-preset=medium threads=0 bframes=2 rc-lookahead=20",
+	  "key-int-max", 4 },
+
+	/* TI Ducati (OMAP4/5, DRA7) */
+	{ RTSPMODULE_PROFILE_ULTRA_LOW_LATENCY, "ducatih264enc",
+	  "rate-preset=low-delay", "intra-interval", 1 },
+	{ RTSPMODULE_PROFILE_BALANCED, "ducatih264enc",
+	  "rate-preset=low-delay", "intra-interval", 2 },
+	{ RTSPMODULE_PROFILE_QUALITY, "ducatih264enc",
+	  "rate-preset=storage", "intra-interval", 4 },
+
+	/* libav/ffmpeg encoders */
+	{ RTSPMODULE_PROFILE_ULTRA_LOW_LATENCY, "ffenc_*", "max-bframes=0", "gop-size", 1 },
+	{ RTSPMODULE_PROFILE_BALANCED, "ffenc_*", "max-bframes=0", "gop-size", 2 },
+	{ RTSPMODULE_PROFILE_QUALITY, "ffenc_*", "max-bframes=2", "gop-size", 4 },
+
+	/* libvpx */
+	{ RTSPMODULE_PROFILE_ULTRA_LOW_LATENCY, "vp8enc",
+	  "speed=7 max-latency=0 threads=2", "max-keyframe-distance", 1 },
+	{ RTSPMODULE_PROFILE_BALANCED, "vp8enc",
+	  "speed=4 max-latency=0 threads=2", "max-keyframe-distance", 2 },
+	{ RTSPMODULE_PROFILE_QUALITY, "vp8enc",
+	  "speed=1 max-latency=25", "max-keyframe-distance", 4 },
+
+	/* Payloaders: repeat SPS/PPS often enough for joins to be quick */
+	{ RTSPMODULE_PROFILE_ULTRA_LOW_LATENCY, "rtph264pay", "config-interval=1", NULL, 0 },
+	{ RTSPMODULE_PROFILE_BALANCED, "rtph264pay", "config-interval=1", NULL, 0 },
+	{ RTSPMODULE_PROFILE_QUALITY, "rtph264pay", "config-interval=2", NULL, 0 },
+	{ RTSPMODULE_PROFILE_ULTRA_LOW_LATENCY, "rtph265pay", "config-interval=1", NULL, 0 },
+	{ RTSPMODULE_PROFILE_BALANCED, "rtph265pay", "config-interval=1", NULL, 0 },
+	{ RTSPMODULE_PROFILE_QUALITY, "rtph265pay", "config-interval=2", NULL, 0 },
+};
+
+#define PROFILE_COUNT	(sizeof(profiles) / sizeof(profiles[0]))
+
+static gboolean element_matches (const char *pattern, const char *name);
+static void set_property (GstElement *element, const char *name, const char *value);
+
+/* ============================================================================
+ * @Function: 	 encprofile_check
+ * @Description: 0 if the profile name is known (or NULL, no profile).
+ * ============================================================================
+ */
+int encprofile_check (const char *profile)
+{
+	unsigned int i;
+
+	if (!profile)
+		return 0;
+
+	for (i = 0; i < PROFILE_COUNT; i++)
+		if (strcmp(profiles[i].profile, profile) == 0)
+			return 0;
+
+	return -1;
+}
+
+/* ============================================================================
+ * @Function: 	 encprofile_apply
+ * @Description: Configure an encoder or payloader for the profile. Elements
+ * without settings under it, and properties an element version lacks, are
+ * left at their defaults.
+ * ============================================================================
+ */
+void encprofile_apply (const char *profile, GstElement *element, int fps)
+{
+	const char *name;
+	gchar **settings, *value;
+	gchar keyframes[16];
+	unsigned int i, j;
+
+	if (!profile)
+		return;
+
+	name = gst_plugin_feature_get_name(GST_PLUGIN_FEATURE (gst_element_get_factory(element)));
+	for (i = 0; i < PROFILE_COUNT; i++) {
+		if (strcmp(profiles[i].profile, profile) == 0 &&
+		    element_matches(profiles[i].element, name))
+			break;
+	}
+	if (i == PROFILE_COUNT) {
+		g_printerr("$$ No %s settings for %s, keeping its defaults\n", profile, name);
+		return;
+	}
+
+	settings = g_strsplit(profiles[i].settings, " ", -1);
+	for (j = 0; settings[j]; j++) {
+		value = strchr(settings[j], '=');
+		if (!value)
+			continue;
+		*value++ = '\0';
+		set_property(element, settings[j], value);
+	}
+	g_strfreev(settings);
+
+	if (profiles[i].key_property && fps > 0) {
+		g_snprintf(keyframes, sizeof(keyframes), "%d", profiles[i].key_seconds * fps);
+		set_property(element, profiles[i].key_property, keyframes);
+	}
+
+	g_print("..%s set up for %s\n", name, profile);
+}
+
+static gboolean element_matches (const char *pattern, const char *name)
+{
+	size_t len = strlen(pattern);
+
+	if (len && pattern[len - 1] == '*')
+		return strncmp(pattern, name, len - 1) == 0;
+
+	return strcmp(pattern, name) == 0;
+}
+
+static void set_property (GstElement *element, const char *name, const char *value)
+{
+	if (!g_object_class_find_property(G_OBJECT_GET_CLASS (element), name)) {
+		g_printerr("$$ %s has no property %s, skipped\n", GST_ELEMENT_NAME (element), name);
+		return;
+	}
+
+	gst_util_set_object_arg(G_OBJECT (element), name, value);
+}
@@ -0,0 +1,18 @@
+#ifndef ENCPROFILE_H_
+#define ENCPROFILE_H_
+
+#include <gst/gst.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Profile names are the RTSPMODULE_PROFILE_* ones */
+int encprofile_check	(const char *profile);
+void encprofile_apply	(const char *profile, GstElement *element, int fps);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ENCPROFILE_H_ */
@@ -0,0 +1,174 @@
+/* ============================================================================
+ * @File: 	 framebox.c
+ * @Author: 	 Ozgur Eralp [ozgur.eralp@outlook.com]
+ * @Description: Lock-free Frame Mailbox between Capture and Streaming
+ *
+ * ============================================================================
+ *
+ * Copyright 2014 Ozgur Eralp.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * ============================================================================
+ */
+
+
+#include <string.h>
+#include "framebox.h"
+
+static void release_frame (struct framebox_frame *frame);
+static int take_slot (struct framebox *box, unsigned int head, struct framebox_frame *frame);
+
+/* ============================================================================
+ * @Function: 	 framebox_init
+ * @Description: Initialize an empty mailbox holding up to depth frames.
+ * ============================================================================
+ */
+int framebox_init (struct framebox *box, unsigned int depth, int policy)
+{
+	if (depth == 0)
+		depth = FRAMEBOX_DEFAULT_DEPTH;
+	if (depth > FRAMEBOX_MAX_DEPTH)
+		return -1;
+
+	memset(box, 0, sizeof(*box));
+	box->depth = depth;
+	box->policy = policy;
+
+	return 0;
+}
+
+/* ============================================================================
+ * @Function: 	 framebox_put
+ * @Description: Producer side. Never blocks, if the box is full the oldest
+ * frame is taken out and released to make room.
+ * ============================================================================
+ */
+int framebox_put (struct framebox *box, const struct framebox_frame *frame)
+{
+	struct framebox_frame old;
+	unsigned int head, tail;
+
+	tail = box->tail;
+	for (;;) {
+		head = __atomic_load_n(&box->head, __ATOMIC_SEQ_CST);
+		if (tail - head < box->depth)
+			break;
+
+		/* full, steal the oldest frame from the consumer */
+		if (take_slot(box, head, &old) == 0) {
+			release_frame(&old);
+			__atomic_fetch_add(&box->producer_drops, 1, __ATOMIC_RELAXED);
+		}
+	}
+
+	box->slot[tail % box->depth] = *frame;
+	__atomic_store_n(&box->tail, tail + 1, __ATOMIC_SEQ_CST);
+
+	return 0;
+}
+
+/* ============================================================================
+ * @Function: 	 framebox_get
+ * @Description: Consumer side. Never blocks, returns 1 when the box is empty.
+ * With FRAMEBOX_LATEST_WINS the frames older than the newest are released.
+ * ============================================================================
+ */
+int framebox_get (struct framebox *box, struct framebox_frame *frame)
+{
+	unsigned int head, tail;
+
+	for (;;) {
+		head = __atomic_load_n(&box->head, __ATOMIC_SEQ_CST);
+		tail = __atomic_load_n(&box->tail, __ATOMIC_SEQ_CST);
+		if (head == tail)
+			return 1;
+
+		if (take_slot(box, head, frame) != 0)
+			continue;
+
+		if (box->policy == FRAMEBOX_LATEST_WINS && tail - head > 1) {
+			/* a newer one is already waiting */
+			release_frame(frame);
+			__atomic_fetch_add(&box->consumer_drops, 1, __ATOMIC_RELAXED);
+			continue;
+		}
+
+		return 0;
+	}
+}
+
+/* ============================================================================
+ * @Function: 	 framebox_pending
+ * @Description: Frames waiting, either side. Only a hint while the other
+ * side moves.
+ * ============================================================================
+ */
+unsigned int framebox_pending (struct framebox *box)
+{
+	unsigned int head = __atomic_load_n(&box->head, __ATOMIC_SEQ_CST);
+
+	return __atomic_load_n(&box->tail, __ATOMIC_SEQ_CST) - head;
+}
+
+/* ============================================================================
+ * @Function: 	 framebox_flush
+ * @Description: Release every frame still waiting in the box.
+ * ============================================================================
+ */
+void framebox_flush (struct framebox *box)
+{
+	struct framebox_frame frame;
+	unsigned int head;
+
+	for (;;) {
+		head = __atomic_load_n(&box->head, __ATOMIC_SEQ_CST);
+		if (head == __atomic_load_n(&box->tail, __ATOMIC_SEQ_CST))
+			break;
+		if (take_slot(box, head, &frame) == 0)
+			release_frame(&frame);
+	}
+}
+
+/* ============================================================================
+ * @Function: 	 take_slot
+ * @Description: Copy the frame at head and claim it by moving head on. Both
+ * sides may race for the same slot, only the one winning the CAS owns it and
+ * the loser throws its (possibly torn) copy away.
+ * ============================================================================
+ */
+static int take_slot (struct framebox *box, unsigned int head, struct framebox_frame *frame)
+{
+	*frame = box->slot[head % box->depth];
+
+	if (!__atomic_compare_exchange_n(&box->head, &head, head + 1, 0,
+					__ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+		return 1;
+
+	return 0;
+}
+
+static void release_frame (struct framebox_frame *frame)
+{
+	if (frame->release)
+		frame->release(frame->user_data);
+}
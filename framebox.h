@@ -0,0 +1,50 @@
+#ifndef FRAMEBOX_H_
+#define FRAMEBOX_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FRAMEBOX_MAX_DEPTH	8
+#define FRAMEBOX_DEFAULT_DEPTH	3
+
+/* Policies, what the consumer takes out of the box */
+#define FRAMEBOX_LATEST_WINS	0	/* newest frame, older ones are dropped */
+#define FRAMEBOX_DROP_OLDEST	1	/* frames in order, oldest dropped when full */
+
+struct framebox_frame
+{
+	char 		*data;
+	unsigned int 	size;
+	unsigned long long timestamp;	/* capture time, CLOCK_MONOTONIC in ns */
+	long long 	pts_offset;	/* presentation minus decode time, reordered frames */
+	unsigned int 	sequence;
+	int 		keyframe;	/* decodable on its own, always for raw frames */
+	void 		(*release) (void *user_data);
+	void 		*user_data;
+};
+
+/* Lock-free frame mailbox between one producer and the consumer side.
+ * Neither side ever blocks; a frame that is dropped is released right away. */
+struct framebox
+{
+	struct framebox_frame slot[FRAMEBOX_MAX_DEPTH];
+	unsigned int 	depth;
+	int 		policy;
+	unsigned int 	head;		/* next frame to take, moved by CAS */
+	unsigned int 	tail;		/* next slot to fill, producer only */
+	unsigned int 	producer_drops;
+	unsigned int 	consumer_drops;
+};
+
+int framebox_init	(struct framebox *box, unsigned int depth, int policy);
+int framebox_put	(struct framebox *box, const struct framebox_frame *frame);
+int framebox_get	(struct framebox *box, struct framebox_frame *frame);
+unsigned int framebox_pending	(struct framebox *box);
+void framebox_flush	(struct framebox *box);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FRAMEBOX_H_ */
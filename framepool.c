@@ -0,0 +1,130 @@
+/* ============================================================================
+ * @File: 	 framepool.c
+ * @Author: 	 Ozgur Eralp [ozgur.eralp@outlook.com]
+ * @Description: Pool of Recycled Frame Buffers
+ *
+ * ============================================================================
+ *
+ * Copyright 2014 Ozgur Eralp.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * ============================================================================
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "framepool.h"
+
+/* Every buffer is preceded by one aligned header line pointing back to its
+ * pool, so a buffer can be returned from a plain release(data) callback. */
+#define SLOT_DATA(pool, i)	((pool)->mem + (size_t)(i) * (pool)->stride + FRAMEPOOL_ALIGN)
+
+/* ============================================================================
+ * @Function: 	 framepool_init
+ * @Description: Allocate count buffers of size bytes, all of them free.
+ * ============================================================================
+ */
+int framepool_init (struct framepool *pool, unsigned int size, unsigned int count)
+{
+	void *mem;
+	unsigned int i;
+
+	memset(pool, 0, sizeof(*pool));
+	if (size == 0 || count == 0 || count > FRAMEPOOL_MAX_COUNT)
+		return -1;
+
+	pool->size = size;
+	pool->stride = FRAMEPOOL_ALIGN + ((size + FRAMEPOOL_ALIGN - 1) & ~(FRAMEPOOL_ALIGN - 1));
+	pool->count = count;
+
+	if (posix_memalign(&mem, FRAMEPOOL_ALIGN, (size_t) pool->stride * count) != 0)
+		return -1;
+	pool->mem = (char *) mem;
+
+	for (i = 0; i < count; i++)
+		*(struct framepool **) (SLOT_DATA(pool, i) - FRAMEPOOL_ALIGN) = pool;
+
+	pool->free_mask = (count == 64) ? ~0ULL : (1ULL << count) - 1;
+
+	return 0;
+}
+
+/* ============================================================================
+ * @Function: 	 framepool_destroy
+ * @Description: Free the pool memory. Every buffer must be back by now.
+ * ============================================================================
+ */
+void framepool_destroy (struct framepool *pool)
+{
+	free(pool->mem);
+	pool->mem = NULL;
+	pool->count = 0;
+	pool->free_mask = 0;
+}
+
+/* ============================================================================
+ * @Function: 	 framepool_get
+ * @Description: Take a free buffer. Never blocks, returns NULL and counts a
+ * starvation when all of them are in use.
+ * ============================================================================
+ */
+char *framepool_get (struct framepool *pool)
+{
+	unsigned long long mask;
+	unsigned int i, in_use, high;
+
+	mask = __atomic_load_n(&pool->free_mask, __ATOMIC_ACQUIRE);
+	do {
+		if (mask == 0) {
+			__atomic_fetch_add(&pool->starvations, 1, __ATOMIC_RELAXED);
+			return NULL;
+		}
+		i = __builtin_ctzll(mask);
+	} while (!__atomic_compare_exchange_n(&pool->free_mask, &mask, mask & ~(1ULL << i), 0,
+					__ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+
+	in_use = __atomic_add_fetch(&pool->in_use, 1, __ATOMIC_RELAXED);
+	high = __atomic_load_n(&pool->high_water, __ATOMIC_RELAXED);
+	while (in_use > high &&
+	       !__atomic_compare_exchange_n(&pool->high_water, &high, in_use, 0,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+
+	return SLOT_DATA(pool, i);
+}
+
+/* ============================================================================
+ * @Function: 	 framepool_release
+ * @Description: Give a buffer back to its pool, from any thread. Matches the
+ * release(user_data) callbacks of the frame interfaces.
+ * ============================================================================
+ */
+void framepool_release (void *data)
+{
+	struct framepool *pool = *(struct framepool **) ((char *) data - FRAMEPOOL_ALIGN);
+	unsigned int i = ((char *) data - pool->mem) / pool->stride;
+
+	__atomic_fetch_sub(&pool->in_use, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_or(&pool->free_mask, 1ULL << i, __ATOMIC_RELEASE);
+}
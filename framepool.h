@@ -0,0 +1,35 @@
+#ifndef FRAMEPOOL_H_
+#define FRAMEPOOL_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FRAMEPOOL_MAX_COUNT	64
+#define FRAMEPOOL_ALIGN		64	/* cache line, also enough for SIMD loads */
+
+/* Fixed set of preallocated, aligned frame buffers. Taking and returning a
+ * buffer is lock-free (one bit per buffer) and safe from any thread. The
+ * buffers are allocated once, memory use is count x size for good. */
+struct framepool
+{
+	char 		*mem;
+	unsigned int 	size;		/* usable bytes per buffer */
+	unsigned int 	stride;		/* header plus size, rounded to FRAMEPOOL_ALIGN */
+	unsigned int 	count;
+	unsigned long long free_mask;	/* bit set = buffer free */
+	unsigned int 	in_use;
+	unsigned int 	high_water;	/* most buffers ever in use at once */
+	unsigned int 	starvations;	/* framepool_get found no free buffer */
+};
+
+int framepool_init	(struct framepool *pool, unsigned int size, unsigned int count);
+void framepool_destroy	(struct framepool *pool);
+char *framepool_get	(struct framepool *pool);
+void framepool_release	(void *data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FRAMEPOOL_H_ */
@@ -0,0 +1,495 @@
+/* ============================================================================
+ * @File: 	 frametrace.c
+ * @Author: 	 Ozgur Eralp [ozgur.eralp@outlook.com]
+ * @Description: Per-Frame Latency Tracing
+ *
+ * ============================================================================
+ *
+ * Copyright 2014 Ozgur Eralp.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * ============================================================================
+ */
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "frametrace.h"
+
+/* One stamp. seq is written last, (index << 1) | 1 of the ring position the
+ * record was taken for, and cleared while the record is being rewritten, so
+ * a reader can tell a complete record from a torn or overwritten one. */
+struct trace_record
+{
+	unsigned long long key;
+	unsigned long long time;
+	unsigned int 	seq;
+	unsigned short 	stage;
+	unsigned short 	track;
+};
+
+/* A record with the stamp it follows, what the reports are made of */
+struct trace_span
+{
+	unsigned long long key;
+	unsigned long long start;	/* previous stage of the frame, or capture */
+	unsigned long long end;
+	int 		stage;
+	unsigned int 	track;
+};
+
+static const char *stage_names[FRAMETRACE_STAGES] = {
+	"dqbuf", "getframe", "setdata", "push", "encoded", "payloaded"
+};
+
+static struct trace_record *ring;
+static unsigned int ring_mask;
+static unsigned int ring_head;		/* records ever taken, moved by fetch-add */
+static unsigned int ring_base;		/* reports start here, see frametrace_reset */
+static unsigned int next_track = FRAMETRACE_TRACK_CAPTURE + 1;
+static int dump_requested;
+
+static int take_spans (struct trace_span **spans);
+static int compare_records (const void *a, const void *b);
+static int compare_values (const void *a, const void *b);
+static unsigned long long percentile (unsigned long long *values, int count, int pct);
+
+/* ============================================================================
+ * @Function: 	 frametrace_init
+ * @Description: Allocate the ring, records rounded up to a power of two,
+ * 0 = FRAMETRACE_DEFAULT_RECORDS. Stamping starts right away.
+ * ============================================================================
+ */
+int frametrace_init (unsigned int records)
+{
+	struct trace_record *mem;
+	unsigned int size;
+
+	if (ring)
+		return 0;
+	if (records == 0)
+		records = FRAMETRACE_DEFAULT_RECORDS;
+	for (size = 2; size < records && size < (1u << 30); size <<= 1)
+		;
+
+	mem = calloc(size, sizeof(*mem));
+	if (!mem) {
+		printf("$$ frametrace: no memory for %u records\n", size);
+		return 1;
+	}
+
+	ring_mask = size - 1;
+	__atomic_store_n(&ring_head, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&ring_base, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&ring, mem, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/* ============================================================================
+ * @Function: 	 frametrace_close
+ * @Description: Stop tracing and free the ring. Only once nothing stamps any
+ * more, i.e. after capture and streaming were stopped.
+ * ============================================================================
+ */
+void frametrace_close (void)
+{
+	struct trace_record *mem;
+
+	mem = __atomic_exchange_n(&ring, NULL, __ATOMIC_ACQ_REL);
+	free(mem);
+}
+
+/* ============================================================================
+ * @Function: 	 frametrace_reset
+ * @Description: Leave the records taken so far out of the reports, e.g. the
+ * ones of a warm-up period. Stamping goes on undisturbed.
+ * ============================================================================
+ */
+void frametrace_reset (void)
+{
+	__atomic_store_n(&ring_base, __atomic_load_n(&ring_head, __ATOMIC_RELAXED),
+			 __ATOMIC_RELAXED);
+}
+
+/* ============================================================================
+ * @Function: 	 frametrace_enabled
+ * @Description: Whether stamps are recorded, e.g. to add pad probes or not.
+ * ============================================================================
+ */
+int frametrace_enabled (void)
+{
+	return __atomic_load_n(&ring, __ATOMIC_ACQUIRE) != NULL;
+}
+
+/* ============================================================================
+ * @Function: 	 frametrace_track
+ * @Description: New track number, one per encoder branch.
+ * ============================================================================
+ */
+unsigned int frametrace_track (void)
+{
+	return __atomic_fetch_add(&next_track, 1, __ATOMIC_RELAXED);
+}
+
+/* ============================================================================
+ * @Function: 	 frametrace_now
+ * @Description: CLOCK_MONOTONIC in ns, the clock the frames are keyed on.
+ * ============================================================================
+ */
+unsigned long long frametrace_now (void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* ============================================================================
+ * @Function: 	 frametrace_stamp
+ * @Description: Record that the frame captured at key reached stage at time,
+ * 0 = now. Lock-free and wait-free, safe from any thread; the oldest records
+ * are overwritten once the ring is full.
+ * ============================================================================
+ */
+void frametrace_stamp (int stage, unsigned long long key, unsigned int track,
+			unsigned long long time)
+{
+	struct trace_record *mem, *rec;
+	unsigned int n;
+
+	mem = __atomic_load_n(&ring, __ATOMIC_ACQUIRE);
+	if (!mem || stage < 0 || stage >= FRAMETRACE_STAGES)
+		return;
+	if (!time)
+		time = frametrace_now();
+
+	n = __atomic_fetch_add(&ring_head, 1, __ATOMIC_RELAXED);
+	rec = &mem[n & ring_mask];
+
+	__atomic_store_n(&rec->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&rec->key, key, __ATOMIC_RELAXED);
+	__atomic_store_n(&rec->time, time, __ATOMIC_RELAXED);
+	__atomic_store_n(&rec->stage, (unsigned short) stage, __ATOMIC_RELAXED);
+	__atomic_store_n(&rec->track, (unsigned short) track, __ATOMIC_RELAXED);
+	__atomic_store_n(&rec->seq, (n << 1) | 1, __ATOMIC_RELEASE);
+}
+
+/* ============================================================================
+ * @Function: 	 frametrace_getstats
+ * @Description: p50/p99/max of every stage, since capture and since the
+ * stage before it, over the records still in the ring. Returns the number of
+ * frames seen, -1 when tracing is off.
+ * ============================================================================
+ */
+int frametrace_getstats (struct frametrace_stats stats[FRAMETRACE_STAGES])
+{
+	struct trace_span *spans;
+	unsigned long long *total, *step;
+	int count, frames, stage, n, i;
+
+	memset(stats, 0, sizeof(*stats) * FRAMETRACE_STAGES);
+	count = take_spans(&spans);
+	if (count < 0)
+		return -1;
+
+	total = malloc(sizeof(*total) * (count + 1));
+	step = malloc(sizeof(*step) * (count + 1));
+	if (!total || !step) {
+		free(total);
+		free(step);
+		free(spans);
+		return -1;
+	}
+
+	for (frames = 0, i = 0; i < count; i++)
+		if (i == 0 || spans[i].key != spans[i - 1].key)
+			frames++;
+
+	for (stage = 0; stage < FRAMETRACE_STAGES; stage++) {
+		for (n = 0, i = 0; i < count; i++) {
+			if (spans[i].stage != stage)
+				continue;
+			total[n] = spans[i].end - spans[i].key;
+			step[n] = spans[i].end - spans[i].start;
+			n++;
+		}
+		if (n == 0)
+			continue;
+
+		qsort(total, n, sizeof(*total), compare_values);
+		qsort(step, n, sizeof(*step), compare_values);
+		stats[stage].count = n;
+		stats[stage].total_p50 = percentile(total, n, 50);
+		stats[stage].total_p99 = percentile(total, n, 99);
+		stats[stage].total_max = total[n - 1];
+		stats[stage].step_p50 = percentile(step, n, 50);
+		stats[stage].step_p99 = percentile(step, n, 99);
+		stats[stage].step_max = step[n - 1];
+	}
+
+	free(total);
+	free(step);
+	free(spans);
+	return frames;
+}
+
+/* ============================================================================
+ * @Function: 	 frametrace_dump
+ * @Description: Print frametrace_getstats() as a table, times in us.
+ * ============================================================================
+ */
+int frametrace_dump (FILE *out)
+{
+	struct frametrace_stats stats[FRAMETRACE_STAGES];
+	int frames, stage;
+
+	frames = frametrace_getstats(stats);
+	if (frames < 0)
+		return 1;
+
+	fprintf(out, "frametrace: %d frames, times in us\n", frames);
+	fprintf(out, "%-10s %8s %10s %10s %10s %10s %10s %10s\n", "stage", "count",
+			"total p50", "p99", "max", "step p50", "p99", "max");
+
+	for (stage = 0; stage < FRAMETRACE_STAGES; stage++) {
+		struct frametrace_stats *st = &stats[stage];
+
+		if (st->count == 0)
+			continue;
+		fprintf(out, "%-10s %8u %10llu %10llu %10llu %10llu %10llu %10llu\n",
+				stage_names[stage], st->count,
+				st->total_p50 / 1000, st->total_p99 / 1000, st->total_max / 1000,
+				st->step_p50 / 1000, st->step_p99 / 1000, st->step_max / 1000);
+	}
+	fflush(out);
+
+	return 0;
+}
+
+/* ============================================================================
+ * @Function: 	 frametrace_export
+ * @Description: Write the records still in the ring as Chrome trace JSON
+ * (chrome://tracing, Perfetto). Every frame is an async track, every stage a
+ * slice on it from the stage before to its own stamp.
+ * ============================================================================
+ */
+int frametrace_export (const char *path)
+{
+	struct trace_span *spans;
+	FILE *fp;
+	int count, i;
+
+	count = take_spans(&spans);
+	if (count < 0)
+		return 1;
+
+	fp = fopen(path, "w");
+	if (!fp) {
+		printf("$$ frametrace: cannot write %s\n", path);
+		free(spans);
+		return 1;
+	}
+
+	fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(fp, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+			"\"args\":{\"name\":\"capture\"}}", FRAMETRACE_TRACK_CAPTURE);
+	for (i = 0; i < count; i++) {
+		struct trace_span *s = &spans[i];
+
+		fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"frame\",\"ph\":\"b\",\"id\":\"0x%llx\","
+				"\"pid\":1,\"tid\":%u,\"ts\":%llu.%03llu,\"args\":{\"track\":%u}}",
+				stage_names[s->stage], s->key, s->track,
+				s->start / 1000, s->start % 1000, s->track);
+		fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"frame\",\"ph\":\"e\",\"id\":\"0x%llx\","
+				"\"pid\":1,\"tid\":%u,\"ts\":%llu.%03llu}",
+				stage_names[s->stage], s->key, s->track,
+				s->end / 1000, s->end % 1000);
+	}
+	fprintf(fp, "\n]}\n");
+
+	free(spans);
+	if (fclose(fp) != 0) {
+		printf("$$ frametrace: cannot write %s\n", path);
+		return 1;
+	}
+
+	return 0;
+}
+
+/* ============================================================================
+ * @Function: 	 frametrace_request
+ * @Description: Ask for a report at the next frametrace_poll(). Only sets a
+ * flag, safe from a signal handler.
+ * ============================================================================
+ */
+void frametrace_request (void)
+{
+	__atomic_store_n(&dump_requested, 1, __ATOMIC_RELAXED);
+}
+
+/* ============================================================================
+ * @Function: 	 frametrace_poll
+ * @Description: If a report was requested, print it and, if path is given,
+ * export the Chrome trace there. Returns 1 when a report was made.
+ * ============================================================================
+ */
+int frametrace_poll (const char *path)
+{
+	if (!__atomic_exchange_n(&dump_requested, 0, __ATOMIC_RELAXED))
+		return 0;
+
+	frametrace_dump(stdout);
+	if (path && frametrace_export(path) == 0)
+		printf("...frame trace written to %s\n", path);
+
+	return 1;
+}
+
+/* ============================================================================
+ * @Function: 	 take_spans
+ * @Description: Copy the complete records out of the ring, grouped by frame
+ * and in time order, and find the stamp each one follows: the latest earlier
+ * stage of the same frame on the capture track or on its own track.
+ * Returns the number of spans, -1 on error.
+ * ============================================================================
+ */
+static int take_spans (struct trace_span **spans)
+{
+	struct trace_record *mem, *copy, *rec;
+	struct trace_span *s;
+	unsigned int head, base, first, n, seq;
+	int count, group, i, j;
+
+	*spans = NULL;
+	mem = __atomic_load_n(&ring, __ATOMIC_ACQUIRE);
+	if (!mem)
+		return -1;
+
+	head = __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE);
+	base = __atomic_load_n(&ring_base, __ATOMIC_RELAXED);
+	first = head > ring_mask + 1 ? head - (ring_mask + 1) : 0;
+	if (head - base < head - first)
+		first = base;
+
+	copy = malloc(sizeof(*copy) * (head - first + 1));
+	*spans = malloc(sizeof(**spans) * (head - first + 1));
+	if (!copy || !*spans) {
+		free(copy);
+		free(*spans);
+		*spans = NULL;
+		return -1;
+	}
+
+	/* records rewritten meanwhile, or still being written, are left out */
+	for (count = 0, n = first; n != head; n++) {
+		rec = &mem[n & ring_mask];
+		seq = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+		if (seq != ((n << 1) | 1))
+			continue;
+		copy[count].key = __atomic_load_n(&rec->key, __ATOMIC_RELAXED);
+		copy[count].time = __atomic_load_n(&rec->time, __ATOMIC_RELAXED);
+		copy[count].stage = __atomic_load_n(&rec->stage, __ATOMIC_RELAXED);
+		copy[count].track = __atomic_load_n(&rec->track, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&rec->seq, __ATOMIC_RELAXED) == seq)
+			count++;
+	}
+
+	qsort(copy, count, sizeof(*copy), compare_records);
+
+	for (group = 0, i = 0; i < count; i++) {
+		if (copy[i].key != copy[group].key)
+			group = i;
+
+		s = &(*spans)[i];
+		s->key = copy[i].key;
+		s->end = copy[i].time;
+		s->stage = copy[i].stage;
+		s->track = copy[i].track;
+		s->start = s->key;
+		for (j = group; j < i; j++) {
+			if (copy[j].stage < copy[i].stage && copy[j].time > s->start &&
+			    (copy[j].track == copy[i].track ||
+			     copy[j].track == FRAMETRACE_TRACK_CAPTURE))
+				s->start = copy[j].time;
+		}
+
+		/* stamped before its capture time, the clocks disagree */
+		if (s->end < s->key)
+			s->end = s->key;
+		if (s->start > s->end)
+			s->start = s->end;
+	}
+
+	free(copy);
+	return count;
+}
+
+/* ============================================================================
+ * @Function: 	 compare_records
+ * @Description: qsort order, by frame then by time.
+ * ============================================================================
+ */
+static int compare_records (const void *a, const void *b)
+{
+	const struct trace_record *ra = a, *rb = b;
+
+	if (ra->key != rb->key)
+		return ra->key < rb->key ? -1 : 1;
+	if (ra->time != rb->time)
+		return ra->time < rb->time ? -1 : 1;
+	return (int) ra->stage - (int) rb->stage;
+}
+
+/* ============================================================================
+ * @Function: 	 compare_values
+ * @Description: qsort order, ascending.
+ * ============================================================================
+ */
+static int compare_values (const void *a, const void *b)
+{
+	unsigned long long va = *(const unsigned long long *) a;
+	unsigned long long vb = *(const unsigned long long *) b;
+
+	return va < vb ? -1 : va > vb;
+}
+
+/* ============================================================================
+ * @Function: 	 percentile
+ * @Description: Nearest-rank percentile of sorted values.
+ * ============================================================================
+ */
+static unsigned long long percentile (unsigned long long *values, int count, int pct)
+{
+	int rank;
+
+	rank = (count * pct + 99) / 100;
+	if (rank < 1)
+		rank = 1;
+	return values[rank - 1];
+}
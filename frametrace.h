@@ -0,0 +1,62 @@
+#ifndef FRAMETRACE_H_
+#define FRAMETRACE_H_
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Points a frame is stamped at, in the order it passes them */
+#define FRAMETRACE_DQBUF	0	/* VIDIOC_DQBUF returned */
+#define FRAMETRACE_GETFRAME	1	/* cammodule handed the frame out */
+#define FRAMETRACE_SETDATA	2	/* rtspmodule took the frame in */
+#define FRAMETRACE_PUSH		3	/* need-data pushed it into appsrc */
+#define FRAMETRACE_ENCODED	4	/* left the encoder, pad probe */
+#define FRAMETRACE_PAYLOADED	5	/* first RTP packet left the payloader */
+#define FRAMETRACE_STAGES	6
+
+#define FRAMETRACE_DEFAULT_RECORDS	16384
+
+/* Track of the stages shared by every encoding of a frame, capture and
+ * handoff. Each encoder branch stamps on a track of its own. */
+#define FRAMETRACE_TRACK_CAPTURE	0
+
+/* A frame is identified by its capture time (CLOCK_MONOTONIC in ns), so the
+ * latency of every stamp is its time minus the key. Stamping is lock-free
+ * and does nothing until frametrace_init() is called. */
+int frametrace_init		(unsigned int records);
+void frametrace_close		(void);
+void frametrace_reset		(void);
+int frametrace_enabled		(void);
+unsigned int frametrace_track	(void);
+unsigned long long frametrace_now	(void);
+void frametrace_stamp		(int stage, unsigned long long key, unsigned int track,
+				 unsigned long long time);
+
+/* Latency of one stage in ns, since capture and since the stage before */
+struct frametrace_stats
+{
+	unsigned int 	count;
+	unsigned long long total_p50;
+	unsigned long long total_p99;
+	unsigned long long total_max;
+	unsigned long long step_p50;
+	unsigned long long step_p99;
+	unsigned long long step_max;
+};
+
+/* Reports over the records still in the ring */
+int frametrace_getstats		(struct frametrace_stats stats[FRAMETRACE_STAGES]);
+int frametrace_dump		(FILE *out);
+int frametrace_export		(const char *path);
+
+/* Dump on demand: request is async-signal-safe, poll does the work */
+void frametrace_request		(void);
+int frametrace_poll		(const char *path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FRAMETRACE_H_ */
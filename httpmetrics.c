@@ -0,0 +1,318 @@
+/* ============================================================================
+ * @File: 	 httpmetrics.c
+ * @Author: 	 Ozgur Eralp [ozgur.eralp@outlook.com]
+ * @Description: Prometheus Metrics Endpoint
+ *
+ * ============================================================================
+ *
+ * Copyright 2014 Ozgur Eralp.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * ============================================================================
+ */
+
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <gio/gio.h>
+#include "httpmetrics.h"
+
+#define REQUEST_MAX	2048
+#define CLIENT_TIMEOUT	2	/* seconds, a stalled scraper is dropped */
+
+struct httpmetrics
+{
+	GSocketService 	*service;
+	httpmetrics_render_func render;
+	gpointer 	user_data;
+	GCancellable 	*cancel;	/* of every scrape, on free */
+	GList 		*clients;
+};
+
+/* One scrape, read and answered asynchronously: the main loop never waits
+ * on a scraper. http is NULL once the server is freed, the client then only
+ * closes as its pending operation comes back cancelled. */
+struct http_client
+{
+	struct httpmetrics *http;
+	GSocketConnection *connection;
+	GCancellable 	*cancel;
+	gchar 		request[REQUEST_MAX];
+	gsize 		length;
+	GString 	*response;
+	gsize 		sent;
+};
+
+static gboolean cb_incoming (GSocketService *service, GSocketConnection *connection,
+				GObject *source, gpointer user_data);
+static void read_request (struct http_client *client);
+static void cb_request (GObject *stream, GAsyncResult *result, gpointer user_data);
+static void send_response (struct http_client *client);
+static void write_response (struct http_client *client);
+static void cb_written (GObject *stream, GAsyncResult *result, gpointer user_data);
+static void close_client (struct http_client *client);
+
+/* ============================================================================
+ * @Function: 	 httpmetrics_new
+ * @Description: Listen on service (port) for scrapes. Requests are read and
+ * answered from the default main context, i.e. from the RTSP main loop, never
+ * from a capture or streaming thread.
+ * ============================================================================
+ */
+struct httpmetrics *httpmetrics_new (const char *service,
+				     httpmetrics_render_func render, gpointer user_data)
+{
+	struct httpmetrics *http;
+	GError *error = NULL;
+	gint port;
+
+	port = atoi(service);
+	if (port <= 0 || port > 65535) {
+		g_printerr("$$ Invalid metrics port %s\n", service);
+		return NULL;
+	}
+
+	http = g_new0(struct httpmetrics, 1);
+	http->render = render;
+	http->user_data = user_data;
+	http->cancel = g_cancellable_new();
+	http->service = g_socket_service_new();
+
+	if (!g_socket_listener_add_inet_port(G_SOCKET_LISTENER (http->service), port,
+					     NULL, &error)) {
+		g_printerr("$$ Failed to listen for metrics on port %d: %s\n", port,
+				error->message);
+		g_error_free(error);
+		httpmetrics_free(http);
+		return NULL;
+	}
+
+	g_signal_connect(http->service, "incoming", G_CALLBACK (cb_incoming), http);
+	g_socket_service_start(http->service);
+	g_print("metrics ready at http://127.0.0.1:%d/metrics\n", port);
+
+	return http;
+}
+
+/* ============================================================================
+ * @Function: 	 httpmetrics_free
+ * @Description: Stop listening. Scrapes in progress are cancelled and let go
+ * of the server, their connections close when the cancelled operations come
+ * back in the default main context.
+ * ============================================================================
+ */
+void httpmetrics_free (struct httpmetrics *http)
+{
+	GList *item;
+
+	if ( !http )
+		return;
+
+	for (item = http->clients; item; item = item->next)
+		((struct http_client *) item->data)->http = NULL;
+	g_list_free(http->clients);
+	g_cancellable_cancel(http->cancel);
+	g_object_unref(http->cancel);
+
+	g_socket_service_stop(http->service);
+	g_socket_listener_close(G_SOCKET_LISTENER (http->service));
+	g_object_unref(http->service);
+	g_free(http);
+}
+
+/* ============================================================================
+ * @Function: 	 httpmetrics_header
+ * @Description: HELP and TYPE lines of a metric family.
+ * ============================================================================
+ */
+void httpmetrics_header (GString *out, const char *name, const char *type, const char *help)
+{
+	g_string_append_printf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/* ============================================================================
+ * @Function: 	 httpmetrics_value
+ * @Description: One sample, labels like mount="/bbwatch" or NULL.
+ * ============================================================================
+ */
+void httpmetrics_value (GString *out, const char *name, const char *labels, guint64 value)
+{
+	if (labels)
+		g_string_append_printf(out, "%s{%s} %" G_GUINT64_FORMAT "\n", name, labels, value);
+	else
+		g_string_append_printf(out, "%s %" G_GUINT64_FORMAT "\n", name, value);
+}
+
+void httpmetrics_value_double (GString *out, const char *name, const char *labels, gdouble value)
+{
+	gchar number[G_ASCII_DTOSTR_BUF_SIZE];
+
+	/* never a decimal comma, whatever the locale */
+	g_ascii_dtostr(number, sizeof(number), value);
+	if (labels)
+		g_string_append_printf(out, "%s{%s} %s\n", name, labels, number);
+	else
+		g_string_append_printf(out, "%s %s\n", name, number);
+}
+
+/* ============================================================================
+ * @Function: 	 cb_incoming
+ * @Description: New scraper connected, start reading its request.
+ * ============================================================================
+ */
+static gboolean cb_incoming (GSocketService *service, GSocketConnection *connection,
+				GObject *source, gpointer user_data)
+{
+	struct http_client *client;
+
+	client = g_new0(struct http_client, 1);
+	client->http = (struct httpmetrics *) user_data;
+	client->http->clients = g_list_prepend(client->http->clients, client);
+	client->cancel = g_object_ref(client->http->cancel);
+	client->connection = g_object_ref(connection);
+	g_socket_set_timeout(g_socket_connection_get_socket(connection), CLIENT_TIMEOUT);
+
+	read_request(client);
+	return TRUE;
+}
+
+static void read_request (struct http_client *client)
+{
+	GInputStream *in;
+
+	in = g_io_stream_get_input_stream(G_IO_STREAM (client->connection));
+	g_input_stream_read_async(in, client->request + client->length,
+				  REQUEST_MAX - 1 - client->length, G_PRIORITY_DEFAULT,
+				  client->cancel, cb_request, client);
+}
+
+/* ============================================================================
+ * @Function: 	 cb_request
+ * @Description: Part of the request arrived, answer once the headers are in.
+ * ============================================================================
+ */
+static void cb_request (GObject *stream, GAsyncResult *result, gpointer user_data)
+{
+	struct http_client *client = (struct http_client *) user_data;
+	gssize n;
+
+	n = g_input_stream_read_finish(G_INPUT_STREAM (stream), result, NULL);
+	if (n <= 0 || !client->http) {
+		close_client(client);
+		return;
+	}
+
+	client->length += n;
+	client->request[client->length] = '\0';
+	if (!strstr(client->request, "\r\n\r\n") && client->length < REQUEST_MAX - 1) {
+		read_request(client);
+		return;
+	}
+
+	send_response(client);
+}
+
+/* ============================================================================
+ * @Function: 	 send_response
+ * @Description: Render the metrics for GET /metrics (or /), 404 otherwise,
+ * and start writing the answer.
+ * ============================================================================
+ */
+static void send_response (struct http_client *client)
+{
+	GString *body, *response;
+	const char *status;
+
+	body = g_string_sized_new(4096);
+	if (g_str_has_prefix(client->request, "GET /metrics ") ||
+	    g_str_has_prefix(client->request, "GET / ")) {
+		status = "200 OK";
+		client->http->render(body, client->http->user_data);
+	} else {
+		status = "404 Not Found";
+		g_string_append(body, "see /metrics\n");
+	}
+
+	response = g_string_sized_new(body->len + 128);
+	g_string_append_printf(response, "HTTP/1.0 %s\r\n"
+			"Content-Type: text/plain; version=0.0.4\r\n"
+			"Content-Length: %" G_GSIZE_FORMAT "\r\n"
+			"Connection: close\r\n\r\n", status, body->len);
+	g_string_append_len(response, body->str, body->len);
+	g_string_free(body, TRUE);
+
+	client->response = response;
+	client->sent = 0;
+	write_response(client);
+}
+
+static void write_response (struct http_client *client)
+{
+	GOutputStream *out;
+
+	out = g_io_stream_get_output_stream(G_IO_STREAM (client->connection));
+	g_output_stream_write_async(out, client->response->str + client->sent,
+				    client->response->len - client->sent, G_PRIORITY_DEFAULT,
+				    client->cancel, cb_written, client);
+}
+
+/* ============================================================================
+ * @Function: 	 cb_written
+ * @Description: Part of the answer went out, write the rest. A scraper that
+ * stops reading runs into the socket timeout and is dropped.
+ * ============================================================================
+ */
+static void cb_written (GObject *stream, GAsyncResult *result, gpointer user_data)
+{
+	struct http_client *client = (struct http_client *) user_data;
+	gssize n;
+
+	n = g_output_stream_write_finish(G_OUTPUT_STREAM (stream), result, NULL);
+	if (n <= 0) {
+		if (client->http)
+			g_printerr("$$ Failed to send metrics\n");
+		close_client(client);
+		return;
+	}
+
+	client->sent += n;
+	if (client->sent < client->response->len && client->http) {
+		write_response(client);
+		return;
+	}
+
+	close_client(client);
+}
+
+static void close_client (struct http_client *client)
+{
+	if (client->http)
+		client->http->clients = g_list_remove(client->http->clients, client);
+	g_io_stream_close(G_IO_STREAM (client->connection), NULL, NULL);
+	g_object_unref(client->connection);
+	g_object_unref(client->cancel);
+	if (client->response)
+		g_string_free(client->response, TRUE);
+	g_free(client);
+}
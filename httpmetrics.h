@@ -0,0 +1,32 @@
+#ifndef HTTPMETRICS_H_
+#define HTTPMETRICS_H_
+
+#include <glib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Appends the metrics, Prometheus text format, to out */
+typedef void (*httpmetrics_render_func) (GString *out, gpointer user_data);
+
+struct httpmetrics;
+
+/* Serves GET /metrics on service (port) from the default main context */
+struct httpmetrics *httpmetrics_new	(const char *service,
+					 httpmetrics_render_func render, gpointer user_data);
+void httpmetrics_free			(struct httpmetrics *http);
+
+/* Prometheus text format helpers */
+void httpmetrics_header		(GString *out, const char *name, const char *type,
+				 const char *help);
+void httpmetrics_value		(GString *out, const char *name, const char *labels,
+				 guint64 value);
+void httpmetrics_value_double	(GString *out, const char *name, const char *labels,
+				 gdouble value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HTTPMETRICS_H_ */
@@ -33,7 +33,8 @@
  *
  * THIS IS A TEST APPLICATION IMPLEMENTED BY CAMMODULE AND RTSPMODULE
  * ASSUMPTION(S):
- *	- Camera able to capture YUV (UYVY) format.
+ *	- Camera able to capture YUV 4:2:2 (UYVY/YUYV) or 4:2:0 (NV12/I420),
+ *	  or to encode H.264/MJPEG itself (sent as is).
  *	- GStreamer 0.10 installed.
  *
  * ============================================================================
@@ -47,20 +48,39 @@
 #include <time.h>
 #include <pthread.h>
 #include <semaphore.h>
+#include <signal.h>
 #include <asm/errno.h>
 #include "cammodule.h"
 #include "rtspmodule.h"
+#include "pixfmt.h"
+#include "frametrace.h"
 
 struct t_arguments {
     int width;
     int height;
+    unsigned int fourcc;	/* negotiated by the camera thread */
+    int stride;
 };
 
 void* t_cammodule_interface (void *arg);
 void* t_rtspmodule_interface(void *arg);
+static void release_camframe(void *frame);
+static void on_camframe(struct cammodule_frame *frame, void *user_data);
+static void on_sigusr1(int sig);
+static void on_sigusr2(int sig);
+static void switch_resolution(void);
+static void on_motion(int moving, unsigned int blocks, void *user_data);
 
+sem_t cam_ready;
 sem_t rtsp_ready;
 
+/* BBWATCH_TRACE=file.json traces frame latency, kill -USR1 reports it */
+const char *trace_path;
+
+/* kill -USR2 switches between the full and half capture size, live */
+static volatile sig_atomic_t switch_requested;
+static int full_width, full_height;
+
 int main(int argc, char *argv[])
 {
 	int err = 0;
@@ -69,6 +89,15 @@ int main(int argc, char *argv[])
 
 	dim.width = 640;
 	dim.height = 480;
+	dim.fourcc = 0;
+	dim.stride = 0;
+	sem_init(&cam_ready, 0, 0);
+	sem_init(&rtsp_ready, 0, 0);
+
+	trace_path = getenv("BBWATCH_TRACE");
+	if (trace_path && frametrace_init(0) == 0)
+		signal(SIGUSR1, on_sigusr1);
+	signal(SIGUSR2, on_sigusr2);
 
 	err = pthread_create(&tid1, NULL, &t_rtspmodule_interface, (void *)&dim);	
 	err = pthread_create(&tid2, NULL, &t_cammodule_interface, (void *)&dim);
@@ -77,6 +106,12 @@ int main(int argc, char *argv[])
 	if (err != 0)
 		printf(">$$ Thread Initilization Error\n");
 
+	if (frametrace_enabled()) {
+		frametrace_request();
+		frametrace_poll(trace_path);
+		frametrace_close();
+	}
+
 	printf("\n.Good Bye!.\n\n");
 
 	return 0;
@@ -90,34 +125,46 @@ int main(int argc, char *argv[])
 void* t_cammodule_interface(void *arg)
 {
 	struct cammodule_arguments camarg;
+	struct cammodule_format camfmt;
 	struct t_arguments* dim = (struct t_arguments*) arg;
 
 	/* Initialize CAMMODULE */
     	camarg.width = dim->width;
 	camarg.height = dim->height;
+	camarg.pixelformat = 0;
+	/* let the camera encode when it can, saves x264enc's CPU */
+	camarg.prefer_compressed = 1;
+	camarg.io_method = CAMMODULE_IO_MMAP;
+	camarg.export_dmabuf = 0;
+	camarg.buffer_count = 4;
+	camarg.max_buffer_count = 8;
+	camarg.timeout_ms = 2000;
     	camarg.device_name = (char *)"/dev/video0";
+	/* a recording stands in for the camera, e.g. on a bench without one */
+	camarg.replay_file = getenv("BBWATCH_REPLAY");
+	camarg.replay_mode = CAMMODULE_REPLAY_REALTIME;
+	camarg.replay_loop = 1;
+	camarg.record_file = getenv("BBWATCH_RECORD");
 	cammodule_init(&camarg);
 
+	/* Streaming side is sized from what the camera settled on */
+	if (cammodule_getformat(&camfmt) == 0 && camfmt.fourcc) {
+		dim->width = camfmt.width;
+		dim->height = camfmt.height;
+		dim->fourcc = camfmt.fourcc;
+		dim->stride = camfmt.stride[0];
+		full_width = camfmt.width;
+		full_height = camfmt.height;
+	}
+	sem_post(&cam_ready);
+
 	/* Start CAMMODULE */
 	cammodule_start();
 
-	/* Get video frame(s) */
+	/* Get video frame(s), delivered as soon as the driver completes them */
 	sem_wait(&rtsp_ready);	
 	int count = 0;
-	int size = (camarg.width)*(camarg.height)*4;
-	char * fdata = malloc ((sizeof(char))*size);
-	while (count < 25000)  //Around 15 minutes if assume 25fps
-   	{
-		count++;
-		cammodule_getframe(fdata);
-
-		if (count != 1)
-			sem_wait(&gdata_wait);			
-		rtspmodule_setdata(fdata);
-		sem_post(&gdata_ready);
-
-		usleep(20000);
-	}
+	cammodule_run(on_camframe, &count);
 
 	/* Stop CAMMODULE */
 	cammodule_stop();
@@ -125,6 +172,115 @@ void* t_cammodule_interface(void *arg)
 	return 0;
 }
 
+/* ============================================================================
+ * @Function: 	 on_camframe
+ * @Description: Called by CAMMODULE for every captured frame.
+ * ============================================================================
+ */
+static void on_camframe(struct cammodule_frame *frame, void *user_data)
+{
+	int *count = (int *) user_data;
+	struct rtspmodule_frame rtspframe;
+
+	/* zero-copy: the driver buffer is re-queued when GStreamer is done */
+	rtspframe.data = frame->data;
+	rtspframe.size = frame->size;
+	rtspframe.timestamp = frame->timestamp;
+	rtspframe.sequence = frame->sequence;
+	rtspframe.keyframe = frame->keyframe;
+	rtspframe.release = release_camframe;
+	rtspframe.user_data = frame;
+	if (rtspmodule_setframe(&rtspframe) < 0)
+		release_camframe(frame);
+
+	if (++(*count) == 25000)  //Around 15 minutes if assume 25fps
+		cammodule_wakeup();
+
+	/* latency report asked for with SIGUSR1 */
+	frametrace_poll(trace_path);
+
+	/* resolution switch asked for with SIGUSR2 */
+	if (switch_requested) {
+		switch_requested = 0;
+		switch_resolution();
+	}
+}
+
+/* ============================================================================
+ * @Function: 	 switch_resolution
+ * @Description: Switch capture and stream between the full and half size,
+ * the RTSP sessions stay connected.
+ * ============================================================================
+ */
+static void switch_resolution(void)
+{
+	static int half;
+	struct cammodule_format camfmt;
+	int width, height;
+
+	if (!full_width)
+		return;
+	width = half ? full_width : full_width / 2;
+	height = half ? full_height : full_height / 2;
+
+	/* frames queued for the encoder hold capture buffers, give them back */
+	rtspmodule_flush();
+	if (cammodule_reformat(width, height, 0, 0) != 0 || cammodule_getformat(&camfmt) != 0)
+		return;
+
+	if (rtspmodule_reformat(camfmt.width, camfmt.height, camfmt.stride[0], 0) != 0) {
+		/* the stream cannot take it, the camera goes back */
+		cammodule_reformat(half ? full_width / 2 : full_width,
+				   half ? full_height / 2 : full_height, 0, 0);
+		return;
+	}
+	half = !half;
+}
+
+/* ============================================================================
+ * @Function: 	 on_sigusr1
+ * @Description: Ask for a latency report, made by the capture thread.
+ * ============================================================================
+ */
+static void on_sigusr1(int sig)
+{
+	frametrace_request();
+}
+
+/* ============================================================================
+ * @Function: 	 on_sigusr2
+ * @Description: Ask for a resolution switch, made by the capture thread.
+ * ============================================================================
+ */
+static void on_sigusr2(int sig)
+{
+	switch_requested = 1;
+}
+
+/* ============================================================================
+ * @Function: 	 on_motion
+ * @Description: Motion events of the scene, with their wall clock time.
+ * ============================================================================
+ */
+static void on_motion(int moving, unsigned int blocks, void *user_data)
+{
+	char stamp[32];
+	time_t now = time(NULL);
+
+	strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime(&now));
+	printf(">$$ %s motion %s (%u blocks)\n", stamp, moving ? "started" : "stopped", blocks);
+}
+
+/* ============================================================================
+ * @Function: 	 release_camframe
+ * @Description: Give the camera frame back to the driver queue.
+ * ============================================================================
+ */
+static void release_camframe(void *frame)
+{
+	cammodule_putframe((struct cammodule_frame *) frame);
+}
+
 /* ============================================================================
  * @Function: 	 t_rtspmodule_interface
  * @Description: Interface to RTSPMODULE
@@ -134,17 +290,51 @@ void* t_rtspmodule_interface(void *arg)
 {
 	struct rtspmodule_arguments rtsparg;
 	struct t_arguments* dim = (struct t_arguments*) arg;	
+	const struct pixfmt_desc *desc;
+	char informat[5];
 
 	/* Initialize RTSPMODULE */
+	sem_wait(&cam_ready);
+	desc = pixfmt_lookup(dim->fourcc);
 	rtsparg.width = dim->width;
 	rtsparg.height = dim->height;
 	rtsparg.gfps = 10;
 	rtsparg.gbitrate = 286;
+	/* softer picture rather than a broken one when a viewer loses packets */
+	rtsparg.min_bitrate = 96;
+	rtsparg.max_bitrate = 0;
 	rtsparg.gmtu = 704;
+	/* frames waiting here hold capture buffers, keep it shallow */
+	rtsparg.queue_depth = 2;
+	rtsparg.queue_policy = RTSPMODULE_QUEUE_LATEST_WINS;
+	rtsparg.pool_count = 0;
 	rtsparg.vsrc = (char *)"appsrc";
 	rtsparg.vencoder = (char *)"x264enc";
 	rtsparg.rtpencoder = (char *)"rtph264pay";
+	rtsparg.profile = (char *)RTSPMODULE_PROFILE_ULTRA_LOW_LATENCY;
+	/* H.264 or MJPEG from the camera, picks rtph264pay or rtpjpegpay */
+	if (desc && desc->planes == 0)
+		rtsparg.rtpencoder = NULL;
+	/* x264enc takes planar 4:2:0, 4:2:2 cameras are converted */
+	rtsparg.informat = desc ? (char *)pixfmt_name(desc->fourcc, informat) : (char *)"UYVY";
+	rtsparg.stride = dim->stride;
+	rtsparg.vformat = (!desc || desc->planes == 1) ? (char *)"I420" : NULL;
+	rtsparg.metrics_service = (char *)"9554";
+	/* an empty room is sent at 1 fps until something moves */
+	rtsparg.motion_fps = 1;
+	rtsparg.motion_threshold = 0;
+	/* BBWATCH_MULTICAST=239.255.42.1-239.255.42.254 sends each mount once */
+	rtsparg.multicast = getenv("BBWATCH_MULTICAST");
+	rtsparg.multicast_port_min = 50000;
+	rtsparg.multicast_port_max = 50999;
+	rtsparg.multicast_ttl = 0;
+	/* a viewer on a slow TCP link loses frames, about 2 s behind at most */
+	rtsparg.send_queue = 64;
+	rtsparg.send_policy = RTSPMODULE_SEND_DROP_NONREF;
+	/* a frame is some tens of packets at this MTU, one call sends them */
+	rtsparg.send_batch = 1;
 	rtspmodule_init(&rtsparg);
+	rtspmodule_set_motion_callback(on_motion, NULL);
 	sem_post(&rtsp_ready);
 
 	/* Start RTSPMODULE */
@@ -0,0 +1,136 @@
+/* ============================================================================
+ * @File: 	 mcastpool.c
+ * @Author: 	 Ozgur Eralp [ozgur.eralp@outlook.com]
+ * @Description: Multicast Address Pool
+ *
+ * ============================================================================
+ *
+ * Copyright 2014 Ozgur Eralp.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * ============================================================================
+ */
+
+
+
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include "mcastpool.h"
+
+#define MCAST_FIRST	0xe0000000	/* 224.0.0.0/4 */
+#define MCAST_MASK	0xf0000000
+#define MCAST_LOCAL	0xe0000000	/* 224.0.0.0/24, link-local control */
+#define MCAST_LOCAL_MASK 0xffffff00
+
+static int parse_group (const char *text, unsigned int *group);
+
+/* ============================================================================
+ * @Function: 	 mcastpool_init
+ * @Description: Set the pool up from an address range, "239.255.42.1" or
+ * "239.255.42.1-239.255.42.254", an even port range and the TTL (0 =
+ * default).
+ * ============================================================================
+ */
+int mcastpool_init (struct mcastpool *pool, const char *range, int port_min,
+		    int port_max, int ttl)
+{
+	char first[INET_ADDRSTRLEN];
+	const char *dash;
+	size_t len;
+
+	memset(pool, 0, sizeof(*pool));
+
+	if (!range)
+		return -EINVAL;
+	dash = strchr(range, '-');
+	len = dash ? (size_t) (dash - range) : strlen(range);
+	if (len >= sizeof(first))
+		return -EINVAL;
+	memcpy(first, range, len);
+	first[len] = '\0';
+
+	if (parse_group(first, &pool->first) < 0 ||
+	    parse_group(dash ? dash + 1 : first, &pool->last) < 0 ||
+	    pool->last < pool->first)
+		return -EINVAL;
+
+	if (ttl == 0)
+		ttl = MCASTPOOL_DEFAULT_TTL;
+	if (port_min <= 0 || port_max > 65535 || port_max < port_min + 1 ||
+	    (port_min & 1) || ttl < 1 || ttl > 255)
+		return -EINVAL;
+
+	pool->port_min = port_min;
+	pool->port_max = port_max;
+	pool->ttl = ttl;
+
+	return 0;
+}
+
+/* ============================================================================
+ * @Function: 	 mcastpool_get
+ * @Description: Hand out the next group and its RTP port. Every group goes
+ * to one mount point only; ports are reused once the range runs out, the
+ * groups tell the streams apart.
+ * ============================================================================
+ */
+int mcastpool_get (struct mcastpool *pool, char *address, unsigned int size, int *port)
+{
+	struct in_addr addr;
+	unsigned int ports;
+
+	if (pool->used > pool->last - pool->first)
+		return -ENOSPC;
+
+	addr.s_addr = htonl(pool->first + pool->used);
+	if (!inet_ntop(AF_INET, &addr, address, size))
+		return -EINVAL;
+
+	ports = (pool->port_max - pool->port_min + 1) / 2;
+	*port = pool->port_min + 2 * (pool->used % ports);
+	pool->used++;
+
+	return 0;
+}
+
+/* ============================================================================
+ * @Function: 	 parse_group
+ * @Description: IPv4 multicast address, outside the link-local control block.
+ * ============================================================================
+ */
+static int parse_group (const char *text, unsigned int *group)
+{
+	struct in_addr addr;
+
+	if (inet_pton(AF_INET, text, &addr) != 1)
+		return -EINVAL;
+
+	*group = ntohl(addr.s_addr);
+	if ((*group & MCAST_MASK) != MCAST_FIRST ||
+	    (*group & MCAST_LOCAL_MASK) == MCAST_LOCAL)
+		return -EINVAL;
+
+	return 0;
+}
@@ -0,0 +1,31 @@
+#ifndef MCASTPOOL_H_
+#define MCASTPOOL_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MCASTPOOL_DEFAULT_TTL	4	/* a few routed hops, enough for a home LAN */
+
+/* IPv4 multicast groups handed out to the mount points, one each, with an
+ * even RTP port (RTCP on the next one) taken in turn from the port range */
+struct mcastpool
+{
+	unsigned int 	first;		/* host byte order */
+	unsigned int 	last;
+	unsigned int 	port_min;
+	unsigned int 	port_max;
+	unsigned int 	ttl;
+	unsigned int 	used;		/* groups handed out */
+};
+
+/* These functions return ERROR value as an integer */
+int mcastpool_init	(struct mcastpool *pool, const char *range, int port_min,
+			 int port_max, int ttl);
+int mcastpool_get	(struct mcastpool *pool, char *address, unsigned int size, int *port);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MCASTPOOL_H_ */
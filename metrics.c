@@ -0,0 +1,120 @@
+/* ============================================================================
+ * @File: 	 metrics.c
+ * @Author: 	 Ozgur Eralp [ozgur.eralp@outlook.com]
+ * @Description: Contention-free Statistics Counters
+ *
+ * ============================================================================
+ *
+ * Copyright 2014 Ozgur Eralp.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * ============================================================================
+ */
+
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "metrics.h"
+
+/* One block per counting thread, handed out on the thread's first count.
+ * Threads beyond METRICS_MAX_THREADS share the overflow block, atomically. */
+static struct metrics_counters thread_blocks[METRICS_MAX_THREADS];
+static struct metrics_counters overflow_block;
+static unsigned int thread_count;
+static __thread struct metrics_counters *thread_block;
+
+/* ============================================================================
+ * @Function: 	 metrics_counters_new
+ * @Description: Allocate a zeroed block of counters, cache line aligned.
+ * ============================================================================
+ */
+struct metrics_counters *metrics_counters_new (void)
+{
+	void *mem;
+
+	if (posix_memalign(&mem, METRICS_CACHE_LINE, sizeof(struct metrics_counters)) != 0)
+		return NULL;
+	memset(mem, 0, sizeof(struct metrics_counters));
+
+	return (struct metrics_counters *) mem;
+}
+
+/* ============================================================================
+ * @Function: 	 metrics_counters_free
+ * @Description: Free a block from metrics_counters_new().
+ * ============================================================================
+ */
+void metrics_counters_free (struct metrics_counters *counters)
+{
+	free(counters);
+}
+
+/* ============================================================================
+ * @Function: 	 metrics_add
+ * @Description: Add n to a process wide counter, METRICS_*. Safe from any
+ * thread, no two threads write the same cache line.
+ * ============================================================================
+ */
+void metrics_add (int counter, unsigned long long n)
+{
+	unsigned int slot;
+
+	if (counter < 0 || counter >= METRICS_COUNTERS)
+		return;
+
+	if (!thread_block) {
+		slot = __atomic_fetch_add(&thread_count, 1, __ATOMIC_RELAXED);
+		thread_block = slot < METRICS_MAX_THREADS ? &thread_blocks[slot] : &overflow_block;
+	}
+
+	if (thread_block == &overflow_block)
+		__atomic_fetch_add(&overflow_block.value[counter], n, __ATOMIC_RELAXED);
+	else
+		metrics_count(thread_block, counter, n);
+}
+
+/* ============================================================================
+ * @Function: 	 metrics_read
+ * @Description: Current value of a process wide counter, summed over the
+ * threads. Counts of other threads may be a moment late.
+ * ============================================================================
+ */
+unsigned long long metrics_read (int counter)
+{
+	unsigned long long sum;
+	unsigned int i, threads;
+
+	if (counter < 0 || counter >= METRICS_COUNTERS)
+		return 0;
+
+	threads = __atomic_load_n(&thread_count, __ATOMIC_RELAXED);
+	if (threads > METRICS_MAX_THREADS)
+		threads = METRICS_MAX_THREADS;
+
+	sum = metrics_value(&overflow_block, counter);
+	for (i = 0; i < threads; i++)
+		sum += metrics_value(&thread_blocks[i], counter);
+
+	return sum;
+}
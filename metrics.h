@@ -0,0 +1,51 @@
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define METRICS_CACHE_LINE	64
+#define METRICS_MAX_VALUES	8	/* one cache line of counters */
+#define METRICS_MAX_THREADS	32
+
+/* Process wide counters, each thread adds to a block of its own */
+#define METRICS_CAPTURE_FRAMES		0	/* dequeued from the driver */
+#define METRICS_CAPTURE_BYTES		1
+#define METRICS_CAPTURE_LOST		2	/* missing from the driver sequence */
+#define METRICS_CAPTURE_STARVATIONS	3	/* driver found no buffer queued */
+#define METRICS_HANDOFF_FRAMES		4	/* taken in by rtspmodule */
+#define METRICS_COUNTERS		5
+
+/* Counters with a single writer thread, on a cache line of their own so that
+ * counting never bounces a line between cores. Readers may run anywhere. */
+struct metrics_counters
+{
+	unsigned long long value[METRICS_MAX_VALUES];
+} __attribute__ ((aligned (METRICS_CACHE_LINE)));
+
+struct metrics_counters *metrics_counters_new	(void);
+void metrics_counters_free	(struct metrics_counters *counters);
+
+static inline void metrics_count (struct metrics_counters *counters, int index,
+				  unsigned long long n)
+{
+	unsigned long long *value = &counters->value[index];
+
+	/* single writer: a plain add, published without a locked instruction */
+	__atomic_store_n(value, __atomic_load_n(value, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+static inline unsigned long long metrics_value (struct metrics_counters *counters, int index)
+{
+	return __atomic_load_n(&counters->value[index], __ATOMIC_RELAXED);
+}
+
+void metrics_add			(int counter, unsigned long long n);
+unsigned long long metrics_read		(int counter);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* METRICS_H_ */
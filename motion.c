@@ -0,0 +1,252 @@
+/* ============================================================================
+ * @File: 	 motion.c
+ * @Author: 	 Ozgur Eralp [ozgur.eralp@outlook.com]
+ * @Description: Static Scene Detection, Luma Block Differences
+ *
+ * ============================================================================
+ *
+ * Copyright 2014 Ozgur Eralp.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * ============================================================================
+ */
+
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <asm/errno.h>
+#if defined(__arm__) || defined(__aarch64__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#include "motion.h"
+
+#define MOTION_FOURCC(a, b, c, d) \
+	((unsigned int)(a) | ((unsigned int)(b) << 8) | \
+	 ((unsigned int)(c) << 16) | ((unsigned int)(d) << 24))
+
+static void planar_c (const unsigned char *row, unsigned char *prev,
+			unsigned int groups, unsigned int *sums);
+static void uyvy_c (const unsigned char *row, unsigned char *prev,
+			unsigned int groups, unsigned int *sums);
+static void yuyv_c (const unsigned char *row, unsigned char *prev,
+			unsigned int groups, unsigned int *sums);
+
+static const struct motion_kernels c_kernels = {
+	"c", planar_c, uyvy_c, yuyv_c
+};
+
+static const struct motion_kernels *kernels;
+
+/* ============================================================================
+ * @Function: 	 motion_select
+ * @Description: Choose the kernel implementation. AUTO takes NEON or SSE2
+ * when the CPU has it, the portable C version otherwise.
+ * ============================================================================
+ */
+int motion_select (int impl)
+{
+	const struct motion_kernels *simd = NULL;
+
+	switch (impl)
+	{
+		case MOTION_IMPL_C:
+			kernels = &c_kernels;
+			return 0;
+		case MOTION_IMPL_SSE2:
+			simd = motion_sse2_kernels();
+			break;
+		case MOTION_IMPL_NEON:
+			simd = motion_neon_kernels();
+			break;
+		case MOTION_IMPL_AUTO:
+#if defined(__x86_64__) || defined(__i386__)
+			if (__builtin_cpu_supports("sse2"))
+				simd = motion_sse2_kernels();
+#elif defined(__aarch64__)
+			simd = motion_neon_kernels();
+#elif defined(__arm__) && defined(HWCAP_NEON)
+			if (getauxval(AT_HWCAP) & HWCAP_NEON)
+				simd = motion_neon_kernels();
+#endif
+			kernels = simd ? simd : &c_kernels;
+			return 0;
+		default:
+			return -EINVAL;
+	}
+
+	if (!simd)
+		return -ENOSYS;
+
+	kernels = simd;
+	return 0;
+}
+
+/* ============================================================================
+ * @Function: 	 motion_name
+ * @Description: Name of the kernel implementation in use.
+ * ============================================================================
+ */
+const char *motion_name (void)
+{
+	if (!kernels)
+		motion_select(MOTION_IMPL_AUTO);
+
+	return kernels->name;
+}
+
+/* ============================================================================
+ * @Function: 	 motion_init
+ * @Description: Set a detector up for frames of the given V4L2 fourcc, packed
+ * 4:2:2 or with the luma plane first. Pixels past the last whole block on
+ * the right and bottom edges are not looked at.
+ * ============================================================================
+ */
+int motion_init (struct motion *m, unsigned int fourcc, int width, int height, int stride)
+{
+	memset(m, 0, sizeof(*m));
+
+	if (!kernels)
+		motion_select(MOTION_IMPL_AUTO);
+
+	if (fourcc == MOTION_FOURCC('U', 'Y', 'V', 'Y'))
+		m->row = kernels->uyvy;
+	else if (fourcc == MOTION_FOURCC('Y', 'U', 'Y', 'V'))
+		m->row = kernels->yuyv;
+	else if (fourcc == MOTION_FOURCC('Y', 'U', '1', '2') ||
+		 fourcc == MOTION_FOURCC('Y', 'V', '1', '2') ||
+		 fourcc == MOTION_FOURCC('N', 'V', '1', '2') ||
+		 fourcc == MOTION_FOURCC('N', 'V', '2', '1'))
+		m->row = kernels->planar;
+	else
+		return -EINVAL;
+
+	m->stride = stride;
+	m->blocks_x = width / MOTION_BLOCK;
+	m->blocks_y = height / MOTION_BLOCK;
+	m->threshold = MOTION_DEFAULT_THRESHOLD;
+	m->min_blocks = MOTION_DEFAULT_BLOCKS;
+	if (m->blocks_x == 0 || m->blocks_y == 0)
+		return -EINVAL;
+
+	m->prev = malloc((size_t) m->blocks_x * MOTION_BLOCK *
+			 m->blocks_y * (MOTION_BLOCK / MOTION_ROW_STEP));
+	m->sums = malloc(m->blocks_x * sizeof(*m->sums));
+	if (!m->prev || !m->sums) {
+		motion_free(m);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+/* ============================================================================
+ * @Function: 	 motion_free
+ * @Description: Free the detector's frame copy.
+ * ============================================================================
+ */
+void motion_free (struct motion *m)
+{
+	free(m->prev);
+	free(m->sums);
+	m->prev = NULL;
+	m->sums = NULL;
+	m->have_prev = 0;
+}
+
+/* ============================================================================
+ * @Function: 	 motion_detect
+ * @Description: Compare the frame with the last one, block by block, and keep
+ * it for the next call. Returns how many blocks changed by more than the
+ * threshold on average; all of them for the first frame.
+ * ============================================================================
+ */
+int motion_detect (struct motion *m, const unsigned char *frame)
+{
+	const unsigned int rows = MOTION_BLOCK / MOTION_ROW_STEP;
+	const unsigned int limit = m->threshold * MOTION_BLOCK * rows;
+	unsigned char *prev = m->prev;
+	unsigned int by, r, bx;
+	int changed = 0;
+
+	for (by = 0; by < m->blocks_y; by++) {
+		memset(m->sums, 0, m->blocks_x * sizeof(*m->sums));
+		for (r = 0; r < rows; r++) {
+			m->row(frame + (size_t) (by * MOTION_BLOCK + r * MOTION_ROW_STEP) * m->stride,
+			       prev, m->blocks_x, m->sums);
+			prev += m->blocks_x * MOTION_BLOCK;
+		}
+		for (bx = 0; bx < m->blocks_x; bx++)
+			if (m->sums[bx] > limit)
+				changed++;
+	}
+
+	if (!m->have_prev) {
+		m->have_prev = 1;
+		return m->blocks_x * m->blocks_y;
+	}
+
+	return changed;
+}
+
+/* ============================================================================
+ * Portable kernels, also the reference the SIMD ones must match.
+ * ============================================================================
+ */
+static inline void sad_row (const unsigned char *row, unsigned char *prev,
+			    unsigned int groups, unsigned int *sums, int step, int offset)
+{
+	unsigned int g, x, sum;
+	int d;
+
+	for (g = 0; g < groups; g++) {
+		sum = 0;
+		for (x = 0; x < MOTION_BLOCK; x++) {
+			d = row[x * step + offset] - prev[x];
+			sum += d < 0 ? -d : d;
+			prev[x] = row[x * step + offset];
+		}
+		sums[g] += sum;
+		row += MOTION_BLOCK * step;
+		prev += MOTION_BLOCK;
+	}
+}
+
+static void planar_c (const unsigned char *row, unsigned char *prev,
+			unsigned int groups, unsigned int *sums)
+{
+	sad_row(row, prev, groups, sums, 1, 0);
+}
+
+static void uyvy_c (const unsigned char *row, unsigned char *prev,
+			unsigned int groups, unsigned int *sums)
+{
+	sad_row(row, prev, groups, sums, 2, 1);
+}
+
+static void yuyv_c (const unsigned char *row, unsigned char *prev,
+			unsigned int groups, unsigned int *sums)
+{
+	sad_row(row, prev, groups, sums, 2, 0);
+}
@@ -0,0 +1,63 @@
+#ifndef MOTION_H_
+#define MOTION_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MOTION_BLOCK		16	/* frames are compared in blocks of 16x16 pixels */
+#define MOTION_ROW_STEP		2	/* of which every second row is looked at */
+
+#define MOTION_DEFAULT_THRESHOLD	10	/* mean luma change of a changed block */
+#define MOTION_DEFAULT_BLOCKS		2	/* changed blocks that make motion */
+
+/* Kernel implementations */
+#define MOTION_IMPL_AUTO	0	/* best one the CPU supports */
+#define MOTION_IMPL_C		1
+#define MOTION_IMPL_SSE2	2
+#define MOTION_IMPL_NEON	3
+
+/* Adds the sum of absolute luma differences of each group of 16 pixels of a
+ * row against the same row of the last frame to sums[group], then keeps the
+ * row's luma in prev for the next frame. */
+typedef void (*motion_row_func) (const unsigned char *row, unsigned char *prev,
+			unsigned int groups, unsigned int *sums);
+
+struct motion_kernels
+{
+	const char 	*name;
+	motion_row_func planar;		/* 4:2:0, luma plane first */
+	motion_row_func uyvy;
+	motion_row_func yuyv;
+};
+
+/* Block difference detector between consecutive frames */
+struct motion
+{
+	motion_row_func row;
+	unsigned int 	stride;		/* bytes per line of the frames */
+	unsigned int 	blocks_x;
+	unsigned int 	blocks_y;
+	unsigned int 	threshold;	/* mean luma change of a changed block */
+	unsigned int 	min_blocks;	/* changed blocks that make motion */
+	unsigned char 	*prev;		/* sampled luma of the last frame */
+	unsigned int 	*sums;		/* per block of the current block row */
+	int 		have_prev;
+};
+
+/* These functions return ERROR value as an integer */
+int motion_select	(int impl);
+const char *motion_name	(void);
+int motion_init		(struct motion *m, unsigned int fourcc, int width, int height, int stride);
+void motion_free	(struct motion *m);
+int motion_detect	(struct motion *m, const unsigned char *frame);
+
+/* SIMD kernel sets, NULL when not built for this CPU */
+const struct motion_kernels *motion_sse2_kernels (void);
+const struct motion_kernels *motion_neon_kernels (void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MOTION_H_ */
@@ -0,0 +1,110 @@
+/* ============================================================================
+ * @File: 	 motion_neon.c
+ * @Author: 	 Ozgur Eralp [ozgur.eralp@outlook.com]
+ * @Description: NEON Static Scene Detection Kernels
+ *
+ * ============================================================================
+ *
+ * Copyright 2014 Ozgur Eralp.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * ============================================================================
+ */
+
+
+
+#include <stddef.h>
+#include "motion.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+#include <arm_neon.h>
+
+/* ============================================================================
+ * vld2 splits a packed row into its even and odd bytes, so the luma of 16
+ * pixels is one of the two lanes. vabd gives the absolute differences and
+ * the pairwise widening adds sum them into four 32 bit lanes per group.
+ * ============================================================================
+ */
+static inline void sad_rows (const unsigned char *row, unsigned char *prev,
+			     unsigned int groups, unsigned int *sums, int packed, int luma_odd)
+{
+	uint8x16x2_t p;
+	uint8x16_t y;
+	uint32x4_t s;
+	uint64x2_t t;
+	unsigned int g;
+
+	for (g = 0; g < groups; g++) {
+		if (!packed) {
+			y = vld1q_u8(row);
+			row += 16;
+		} else {
+			p = vld2q_u8(row);
+			y = luma_odd ? p.val[1] : p.val[0];
+			row += 32;
+		}
+
+		s = vpaddlq_u16(vpaddlq_u8(vabdq_u8(y, vld1q_u8(prev))));
+		vst1q_u8(prev, y);
+		t = vpaddlq_u32(s);
+		sums[g] += (unsigned int) (vgetq_lane_u64(t, 0) + vgetq_lane_u64(t, 1));
+		prev += 16;
+	}
+}
+
+static void planar_neon (const unsigned char *row, unsigned char *prev,
+			unsigned int groups, unsigned int *sums)
+{
+	sad_rows(row, prev, groups, sums, 0, 0);
+}
+
+static void uyvy_neon (const unsigned char *row, unsigned char *prev,
+			unsigned int groups, unsigned int *sums)
+{
+	sad_rows(row, prev, groups, sums, 1, 1);
+}
+
+static void yuyv_neon (const unsigned char *row, unsigned char *prev,
+			unsigned int groups, unsigned int *sums)
+{
+	sad_rows(row, prev, groups, sums, 1, 0);
+}
+
+static const struct motion_kernels neon_kernels = {
+	"neon", planar_neon, uyvy_neon, yuyv_neon
+};
+
+const struct motion_kernels *motion_neon_kernels (void)
+{
+	return &neon_kernels;
+}
+
+#else
+
+const struct motion_kernels *motion_neon_kernels (void)
+{
+	return NULL;
+}
+
+#endif /* __ARM_NEON */
@@ -0,0 +1,112 @@
+/* ============================================================================
+ * @File: 	 motion_sse2.c
+ * @Author: 	 Ozgur Eralp [ozgur.eralp@outlook.com]
+ * @Description: SSE2 Static Scene Detection Kernels
+ *
+ * ============================================================================
+ *
+ * Copyright 2014 Ozgur Eralp.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * ============================================================================
+ */
+
+
+
+#include <stddef.h>
+#include "motion.h"
+
+#ifdef __SSE2__
+
+#include <emmintrin.h>
+
+/* ============================================================================
+ * psadbw sums the absolute differences of 8 byte pairs into each 64 bit
+ * half, so one instruction covers a group of 16 pixels. Packed rows give
+ * their luma bytes with a mask or a shift on 16 bit lanes, packed back with
+ * unsigned saturation, which is exact since the lanes hold bytes.
+ * ============================================================================
+ */
+static inline void sad_rows (const unsigned char *row, unsigned char *prev,
+			     unsigned int groups, unsigned int *sums, int packed, int luma_odd)
+{
+	const __m128i mask = _mm_set1_epi16(0x00ff);
+	__m128i y, a, b, sad;
+	unsigned int g;
+
+	for (g = 0; g < groups; g++) {
+		if (!packed) {
+			y = _mm_loadu_si128((const __m128i *)row);
+			row += 16;
+		} else {
+			a = _mm_loadu_si128((const __m128i *)row);
+			b = _mm_loadu_si128((const __m128i *)(row + 16));
+			if (luma_odd)
+				y = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+			else
+				y = _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask));
+			row += 32;
+		}
+
+		sad = _mm_sad_epu8(y, _mm_loadu_si128((const __m128i *)prev));
+		_mm_storeu_si128((__m128i *)prev, y);
+		sums[g] += _mm_cvtsi128_si32(sad) + _mm_cvtsi128_si32(_mm_srli_si128(sad, 8));
+		prev += 16;
+	}
+}
+
+static void planar_sse2 (const unsigned char *row, unsigned char *prev,
+			unsigned int groups, unsigned int *sums)
+{
+	sad_rows(row, prev, groups, sums, 0, 0);
+}
+
+static void uyvy_sse2 (const unsigned char *row, unsigned char *prev,
+			unsigned int groups, unsigned int *sums)
+{
+	sad_rows(row, prev, groups, sums, 1, 1);
+}
+
+static void yuyv_sse2 (const unsigned char *row, unsigned char *prev,
+			unsigned int groups, unsigned int *sums)
+{
+	sad_rows(row, prev, groups, sums, 1, 0);
+}
+
+static const struct motion_kernels sse2_kernels = {
+	"sse2", planar_sse2, uyvy_sse2, yuyv_sse2
+};
+
+const struct motion_kernels *motion_sse2_kernels (void)
+{
+	return &sse2_kernels;
+}
+
+#else
+
+const struct motion_kernels *motion_sse2_kernels (void)
+{
+	return NULL;
+}
+
+#endif /* __SSE2__ */
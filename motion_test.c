@@ -0,0 +1,237 @@
+/* ============================================================================
+ * @File: 	 motion_test.c
+ * @Author: 	 Ozgur Eralp [ozgur.eralp@outlook.com]
+ * @Description: MOTION SIMD Kernel Test
+ *
+ * ============================================================================
+ *
+ * Copyright 2014 Ozgur Eralp.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * ============================================================================
+ */
+
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "motion.h"
+
+#define FOURCC(a, b, c, d) \
+	((unsigned int)(a) | ((unsigned int)(b) << 8) | \
+	 ((unsigned int)(c) << 16) | ((unsigned int)(d) << 24))
+
+#define MAX_GROUPS	130	/* 2080 pixels wide */
+#define GUARD		64
+#define GUARD_BYTE	0xa5
+#define FRAMES		6
+
+#define FILL_RANDOM	0
+#define FILL_EXTREME	1	/* 0 against 255, the largest sums */
+#define FILL_NOISE	2	/* the last frame give or take 20, about the threshold */
+
+static const struct {
+	unsigned int 	fourcc;
+	unsigned int 	bpp;		/* bytes per pixel of the luma row */
+	const char 	*name;
+} formats[] = {
+	{ FOURCC('Y', 'U', '1', '2'), 1, "planar" },
+	{ FOURCC('U', 'Y', 'V', 'Y'), 2, "uyvy" },
+	{ FOURCC('Y', 'U', 'Y', 'V'), 2, "yuyv" },
+};
+
+static const int sizes[][2] = {
+	{ 16, 16 }, { 31, 17 }, { 48, 32 }, { 176, 144 }, { 200, 120 }, { 352, 288 },
+	{ 640, 480 }, { 1282, 34 },
+};
+static const int pads[] = { 0, 1, 64 };	/* luma row bytes past each line */
+
+static int check_rows (int impl, const char *name);
+static int check_frames (int impl, const char *name);
+static motion_row_func row_kernel (int impl, unsigned int fourcc);
+static void fill (unsigned char *buf, unsigned int size, const unsigned char *last, int how);
+
+int main (void)
+{
+	int failed = 0;
+
+	if (motion_sse2_kernels())
+		failed += check_rows(MOTION_IMPL_SSE2, "sse2") + check_frames(MOTION_IMPL_SSE2, "sse2");
+	else
+		printf("..sse2 kernels not built, skipped\n");
+
+	if (motion_neon_kernels())
+		failed += check_rows(MOTION_IMPL_NEON, "neon") + check_frames(MOTION_IMPL_NEON, "neon");
+	else
+		printf("..neon kernels not built, skipped\n");
+
+	return failed ? 1 : 0;
+}
+
+/* ============================================================================
+ * @Function: 	 check_rows
+ * @Description: Run the C and the impl row kernels on the same rows, from
+ * one to MAX_GROUPS groups and off alignment, on sums that already hold a
+ * count. Both the sums and the luma kept in prev must match exactly.
+ * Returns the number of mismatches.
+ * ============================================================================
+ */
+static int check_rows (int impl, const char *name)
+{
+	static unsigned char row[MAX_GROUPS * 32 + 1], prev_c[MAX_GROUPS * 16 + GUARD];
+	static unsigned char prev_s[MAX_GROUPS * 16 + GUARD];
+	static unsigned int sums_c[MAX_GROUPS + 1], sums_s[MAX_GROUPS + 1];
+	motion_row_func ref, simd;
+	unsigned int f, groups, how, g, cases = 0, failed = 0;
+
+	for (f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+		ref = row_kernel(MOTION_IMPL_C, formats[f].fourcc);
+		simd = row_kernel(impl, formats[f].fourcc);
+
+		for (groups = 1; groups <= MAX_GROUPS; groups++)
+		for (how = FILL_RANDOM; how <= FILL_NOISE; how++) {
+			fill(prev_c, groups * 16, NULL, FILL_RANDOM);
+			if (how == FILL_EXTREME) {
+				memset(prev_c, 0, groups * 16);
+				memset(row, 255, sizeof(row));
+			} else {
+				fill(row, sizeof(row), NULL, FILL_RANDOM);
+			}
+			memset(prev_c + groups * 16, GUARD_BYTE, GUARD);
+			memcpy(prev_s, prev_c, groups * 16 + GUARD);
+			for (g = 0; g <= groups; g++)
+				sums_c[g] = sums_s[g] = rand() & 0xffff;
+
+			ref(row + 1, prev_c, groups, sums_c);
+			simd(row + 1, prev_s, groups, sums_s);
+
+			if (memcmp(sums_c, sums_s, (groups + 1) * sizeof(sums_c[0])) != 0 ||
+			    memcmp(prev_c, prev_s, groups * 16 + GUARD) != 0) {
+				printf("$$ %s %s row of %u groups (fill %u) differs from c\n",
+				       name, formats[f].name, groups, how);
+				failed++;
+			}
+			cases++;
+		}
+	}
+
+	printf("..%s: %u of %u rows identical to c\n", name, cases - failed, cases);
+	return failed;
+}
+
+/* ============================================================================
+ * @Function: 	 check_frames
+ * @Description: Feed the same frames to a C and an impl detector and compare
+ * the changed block counts they return, for every format, size and pitch.
+ * ============================================================================
+ */
+static int check_frames (int impl, const char *name)
+{
+	struct motion ref, simd;
+	unsigned char *frames[FRAMES];
+	unsigned int f, s, p, i, size, cases = 0, failed = 0;
+	int width, height, stride, a, b;
+
+	for (f = 0; f < sizeof(formats) / sizeof(formats[0]); f++)
+	for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+	for (p = 0; p < sizeof(pads) / sizeof(pads[0]); p++) {
+		width = sizes[s][0];
+		height = sizes[s][1];
+		stride = width * formats[f].bpp + pads[p];
+		size = stride * height;
+
+		for (i = 0; i < FRAMES; i++) {
+			frames[i] = malloc(size);
+			if (!frames[i]) {
+				printf("$$ No memory\n");
+				exit(1);
+			}
+			/* still, changing a little, then a new scene */
+			fill(frames[i], size, i ? frames[i - 1] : NULL,
+			     i == 0 || i == FRAMES - 1 ? FILL_RANDOM : FILL_NOISE);
+		}
+
+		motion_select(MOTION_IMPL_C);
+		if (motion_init(&ref, formats[f].fourcc, width, height, stride) != 0)
+			exit(1);
+		motion_select(impl);
+		if (motion_init(&simd, formats[f].fourcc, width, height, stride) != 0)
+			exit(1);
+
+		for (i = 0; i < FRAMES; i++) {
+			a = motion_detect(&ref, frames[i]);
+			b = motion_detect(&simd, frames[i]);
+			if (a != b) {
+				printf("$$ %s %s %dx%d stride %d frame %u: %d changed blocks, c %d\n",
+				       name, formats[f].name, width, height, stride, i, b, a);
+				failed++;
+			}
+			cases++;
+		}
+
+		motion_free(&ref);
+		motion_free(&simd);
+		for (i = 0; i < FRAMES; i++)
+			free(frames[i]);
+	}
+
+	printf("..%s: %u of %u frames detected as c does\n", name, cases - failed, cases);
+	return failed;
+}
+
+/* ============================================================================
+ * @Function: 	 row_kernel
+ * @Description: Row kernel of impl for the fourcc, as a detector takes it.
+ * ============================================================================
+ */
+static motion_row_func row_kernel (int impl, unsigned int fourcc)
+{
+	struct motion m;
+	motion_row_func row;
+
+	if (motion_select(impl) != 0 || motion_init(&m, fourcc, 16, 16, 32) != 0) {
+		printf("$$ No kernel %d\n", impl);
+		exit(1);
+	}
+	row = m.row;
+	motion_free(&m);
+
+	return row;
+}
+
+static void fill (unsigned char *buf, unsigned int size, const unsigned char *last, int how)
+{
+	unsigned int i;
+	int v;
+
+	for (i = 0; i < size; i++) {
+		if (how == FILL_NOISE && last) {
+			v = last[i] + (rand() % 41) - 20;
+			buf[i] = v < 0 ? 0 : v > 255 ? 255 : v;
+		} else {
+			buf[i] = rand() & 0xff;
+		}
+	}
+}
@@ -0,0 +1,160 @@
+/* ============================================================================
+ * @File: 	 pixfmt.c
+ * @Author: 	 Ozgur Eralp [ozgur.eralp@outlook.com]
+ * @Description: Pixel Format Descriptors
+ *
+ * ============================================================================
+ *
+ * Copyright 2014 Ozgur Eralp.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * ============================================================================
+ */
+
+
+#include <string.h>
+#include <asm/errno.h>
+#include "pixfmt.h"
+
+static const struct pixfmt_desc formats[] = {
+	/* packed 4:2:2 */
+	{ PIXFMT_FOURCC('U', 'Y', 'V', 'Y'), "UYVY", 1, 1, { 2 }, 0, 0 },
+	{ PIXFMT_FOURCC('Y', 'U', 'Y', 'V'), "YUY2", 1, 1, { 2 }, 0, 0 },
+	/* 4:2:0, one buffer */
+	{ PIXFMT_FOURCC('N', 'V', '1', '2'), "NV12", 2, 1, { 1, 2 }, 1, 1 },
+	{ PIXFMT_FOURCC('N', 'V', '2', '1'), "NV21", 2, 1, { 1, 2 }, 1, 1 },
+	{ PIXFMT_FOURCC('Y', 'U', '1', '2'), "I420", 3, 1, { 1, 1, 1 }, 1, 1 },
+	{ PIXFMT_FOURCC('Y', 'V', '1', '2'), "YV12", 3, 1, { 1, 1, 1 }, 1, 1 },
+	/* 4:2:0, one buffer per plane */
+	{ PIXFMT_FOURCC('N', 'M', '1', '2'), "NV12", 2, 2, { 1, 2 }, 1, 1 },
+	{ PIXFMT_FOURCC('Y', 'M', '1', '2'), "I420", 3, 3, { 1, 1, 1 }, 1, 1 },
+	/* compressed, sized by the driver */
+	{ PIXFMT_FOURCC('M', 'J', 'P', 'G'), "MJPG", 0, 1, { 0 }, 0, 0 },
+	{ PIXFMT_FOURCC('J', 'P', 'E', 'G'), "JPEG", 0, 1, { 0 }, 0, 0 },
+	{ PIXFMT_FOURCC('H', '2', '6', '4'), "H264", 0, 1, { 0 }, 0, 0 },
+	{ PIXFMT_FOURCC('H', 'E', 'V', 'C'), "H265", 0, 1, { 0 }, 0, 0 },
+};
+
+#define FORMAT_COUNT	(sizeof(formats) / sizeof(formats[0]))
+
+/* ============================================================================
+ * @Function: 	 pixfmt_lookup
+ * @Description: Descriptor of a V4L2 fourcc, NULL if unknown.
+ * ============================================================================
+ */
+const struct pixfmt_desc *pixfmt_lookup (unsigned int fourcc)
+{
+	unsigned int i;
+
+	for (i = 0; i < FORMAT_COUNT; i++)
+		if (formats[i].fourcc == fourcc)
+			return &formats[i];
+
+	return NULL;
+}
+
+/* ============================================================================
+ * @Function: 	 pixfmt_parse
+ * @Description: Descriptor of a format given by its V4L2 fourcc ("YUYV",
+ * "YU12") or its GStreamer name ("YUY2", "I420"). Single buffer formats win
+ * over the multi-planar ones sharing a GStreamer name.
+ * ============================================================================
+ */
+const struct pixfmt_desc *pixfmt_parse (const char *name)
+{
+	unsigned int i;
+
+	if (!name || strlen(name) != 4)
+		return NULL;
+
+	for (i = 0; i < FORMAT_COUNT; i++)
+		if (formats[i].fourcc == PIXFMT_FOURCC(name[0], name[1], name[2], name[3]))
+			return &formats[i];
+	for (i = 0; i < FORMAT_COUNT; i++)
+		if (strcmp(formats[i].name, name) == 0)
+			return &formats[i];
+
+	return NULL;
+}
+
+/* ============================================================================
+ * @Function: 	 pixfmt_name
+ * @Description: Printable fourcc, buf must hold 5 bytes.
+ * ============================================================================
+ */
+const char *pixfmt_name (unsigned int fourcc, char *buf)
+{
+	buf[0] = fourcc & 0xff;
+	buf[1] = (fourcc >> 8) & 0xff;
+	buf[2] = (fourcc >> 16) & 0xff;
+	buf[3] = (fourcc >> 24) & 0xff;
+	buf[4] = '\0';
+
+	return buf;
+}
+
+/* ============================================================================
+ * @Function: 	 pixfmt_fill
+ * @Description: Layout of a width x height frame. stride is the bytes per
+ * line of the first plane, 0 for tightly packed lines; the chroma planes
+ * follow it the way V4L2 derives their bytesperline.
+ * ============================================================================
+ */
+int pixfmt_fill (struct pixfmt *fmt, unsigned int fourcc,
+		 unsigned int width, unsigned int height, unsigned int stride)
+{
+	const struct pixfmt_desc *desc = pixfmt_lookup(fourcc);
+	unsigned int p, lines;
+
+	memset(fmt, 0, sizeof(*fmt));
+	if (!desc)
+		return -EINVAL;
+
+	fmt->fourcc = fourcc;
+	fmt->width = width;
+	fmt->height = height;
+	fmt->num_planes = desc->planes;
+
+	/* compressed, only the driver knows the size */
+	if (desc->planes == 0)
+		return 0;
+
+	if (stride == 0)
+		stride = width * desc->cpp[0];
+	if (stride < width * desc->cpp[0])
+		return -EINVAL;
+
+	for (p = 0; p < desc->planes; p++) {
+		if (p == 0) {
+			fmt->stride[p] = stride;
+			lines = height;
+		} else {
+			fmt->stride[p] = stride * desc->cpp[p] / (desc->cpp[0] << desc->hsub);
+			lines = (height + (1 << desc->vsub) - 1) >> desc->vsub;
+		}
+		fmt->plane_size[p] = fmt->stride[p] * lines;
+		fmt->size += fmt->plane_size[p];
+	}
+
+	return 0;
+}
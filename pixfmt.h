@@ -0,0 +1,48 @@
+#ifndef PIXFMT_H_
+#define PIXFMT_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PIXFMT_FOURCC(a, b, c, d) \
+	((unsigned int)(a) | ((unsigned int)(b) << 8) | \
+	 ((unsigned int)(c) << 16) | ((unsigned int)(d) << 24))
+
+#define PIXFMT_MAX_PLANES	3
+
+/* What is known about a pixel format, keyed by its V4L2 fourcc */
+struct pixfmt_desc
+{
+	unsigned int 	fourcc;
+	const char 	*name;		/* fourcc in GStreamer caps */
+	unsigned int 	planes;		/* color planes, 0 = compressed */
+	unsigned int 	mem_planes;	/* separate buffers, V4L2 "M" formats */
+	unsigned char 	cpp[PIXFMT_MAX_PLANES];	/* bytes per pixel in each plane */
+	unsigned char 	hsub;		/* log2 chroma subsampling of planes 1.. */
+	unsigned char 	vsub;
+};
+
+/* Layout of one frame, per color plane */
+struct pixfmt
+{
+	unsigned int 	fourcc;
+	unsigned int 	width;
+	unsigned int 	height;
+	unsigned int 	num_planes;
+	unsigned int 	stride[PIXFMT_MAX_PLANES];	/* bytes per line */
+	unsigned int 	plane_size[PIXFMT_MAX_PLANES];
+	unsigned int 	size;		/* whole frame, 0 if compressed */
+};
+
+const struct pixfmt_desc *pixfmt_lookup	(unsigned int fourcc);
+const struct pixfmt_desc *pixfmt_parse	(const char *name);
+const char *pixfmt_name			(unsigned int fourcc, char *buf);
+int pixfmt_fill		(struct pixfmt *fmt, unsigned int fourcc,
+			 unsigned int width, unsigned int height, unsigned int stride);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PIXFMT_H_ */
@@ -0,0 +1,118 @@
+/* ============================================================================
+ * @File: 	 ratectl.c
+ * @Author: 	 Ozgur Eralp [ozgur.eralp@outlook.com]
+ * @Description: Encoder Bitrate Control from RTCP Receiver Reports
+ *
+ * ============================================================================
+ *
+ * Copyright 2014 Ozgur Eralp.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * ============================================================================
+ */
+
+
+
+#include "ratectl.h"
+
+/* ============================================================================
+ * @Function: 	 ratectl_init
+ * @Description: Start at bitrate, kept within min and max.
+ * ============================================================================
+ */
+void ratectl_init (struct ratectl *rc, unsigned int bitrate, unsigned int min, unsigned int max)
+{
+	rc->min = min < max ? min : max;
+	rc->max = max;
+	rc->bitrate = bitrate < rc->min ? rc->min : bitrate > max ? max : bitrate;
+	rc->clean = 0;
+	rc->hold = 0;
+	rc->jitter_ms = 0;
+	rc->reason = "start";
+}
+
+/* ============================================================================
+ * @Function: 	 ratectl_update
+ * @Description: Decide on the bitrate after one interval. Loss cuts it in
+ * proportion, at most by half; rising jitter cuts it a little before loss
+ * shows up. It only goes up again, by a tenth, after RATECTL_RAISE_AFTER
+ * clean intervals and not before RATECTL_HOLD_AFTER_CUT have passed since the
+ * last cut. Returns 1 when rc->bitrate changed.
+ * ============================================================================
+ */
+int ratectl_update (struct ratectl *rc, const struct ratectl_report *report)
+{
+	unsigned int target = rc->bitrate, loss, diff;
+	int rising;
+
+	if (report->receivers == 0) {
+		/* nobody to hear from, keep what was found to work */
+		rc->clean = 0;
+		rc->reason = "no receiver reports";
+		return 0;
+	}
+
+	loss = report->fraction_lost;
+	rising = report->jitter_ms > RATECTL_JITTER_HIGH_MS && report->jitter_ms > rc->jitter_ms;
+	rc->jitter_ms = report->jitter_ms;
+
+	if (loss > RATECTL_LOSS_HIGH) {
+		target -= (unsigned long long) target * (loss < 128 ? loss : 128) / 256;
+		rc->clean = 0;
+		rc->hold = RATECTL_HOLD_AFTER_CUT;
+		rc->reason = "loss";
+	} else if (rising) {
+		target -= target / 16;
+		rc->clean = 0;
+		rc->hold = RATECTL_HOLD_AFTER_CUT;
+		rc->reason = "jitter rising";
+	} else if (loss > RATECTL_LOSS_LOW) {
+		rc->clean = 0;
+		rc->reason = "some loss, holding";
+	} else {
+		rc->clean++;
+		if (rc->hold)
+			rc->hold--;
+		rc->reason = "clean";
+		if (rc->clean >= RATECTL_RAISE_AFTER && rc->hold == 0) {
+			target += target / 10 ? target / 10 : 1;
+			rc->clean = 0;
+			rc->reason = "clean, raising";
+		}
+	}
+
+	if (target < rc->min)
+		target = rc->min;
+	if (target > rc->max)
+		target = rc->max;
+	if (target == rc->bitrate)
+		return 0;
+
+	/* small steps churn the encoder for nothing, except onto a bound */
+	diff = target > rc->bitrate ? target - rc->bitrate : rc->bitrate - target;
+	if (diff * 100 < rc->bitrate * RATECTL_DEADBAND && target != rc->min && target != rc->max)
+		return 0;
+
+	rc->bitrate = target;
+	return 1;
+}
@@ -0,0 +1,48 @@
+#ifndef RATECTL_H_
+#define RATECTL_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RATECTL_INTERVAL_MS	1000	/* receiver reports are looked at this often */
+
+/* Loss in RTCP fraction lost units (1/256). Above HIGH the bitrate is cut,
+ * below LOW it may be raised again, in between it is held. */
+#define RATECTL_LOSS_HIGH	26	/* 10% */
+#define RATECTL_LOSS_LOW	5	/* 2% */
+#define RATECTL_JITTER_HIGH_MS	40	/* rising above this, queues are building */
+
+#define RATECTL_RAISE_AFTER	4	/* clean intervals before each raise */
+#define RATECTL_HOLD_AFTER_CUT	8	/* intervals without a raise after a cut */
+#define RATECTL_DEADBAND	5	/* percent, smaller changes are not applied */
+
+/* Worst of the receiver reports that came in during the interval */
+struct ratectl_report
+{
+	unsigned int 	receivers;	/* sessions with a new report */
+	unsigned int 	fraction_lost;	/* 0..255 */
+	unsigned int 	jitter_ms;
+};
+
+/* Bitrates in kbits/s */
+struct ratectl
+{
+	unsigned int 	min;
+	unsigned int 	max;
+	unsigned int 	bitrate;	/* what the encoder is set to */
+	unsigned int 	clean;		/* clean intervals in a row */
+	unsigned int 	hold;		/* intervals left before a raise is allowed */
+	unsigned int 	jitter_ms;	/* of the interval before, for the trend */
+	const char 	*reason;	/* of the last decision, for the log */
+};
+
+void ratectl_init	(struct ratectl *rc, unsigned int bitrate,
+			 unsigned int min, unsigned int max);
+int ratectl_update	(struct ratectl *rc, const struct ratectl_report *report);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RATECTL_H_ */
@@ -0,0 +1,521 @@
+/* ============================================================================
+ * @File: 	 rtpbatch.c
+ * @Author: 	 Ozgur Eralp [ozgur.eralp@outlook.com]
+ * @Description: Batched RTP Sending
+ *
+ * ============================================================================
+ *
+ * Copyright 2014 Ozgur Eralp.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * ============================================================================
+ */
+
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <errno.h>
+#include "rtpbatch.h"
+
+#ifndef SOL_UDP
+#define SOL_UDP		17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT	103	/* Linux 4.18, older headers lack it */
+#endif
+
+#define RTP_HEADER	12
+#define RTP_VERSION	2
+
+static void dests_sync (struct rtpbatch *batch);
+static int dest_resolve (struct rtpbatch *batch, const char *host, int port,
+			 struct rtpbatch_dest *dest);
+static struct rtpbatch_dest *dest_find (struct rtpbatch *batch, struct rtpbatch_dest *dest);
+static unsigned int build_runs (struct rtpbatch *batch);
+static int send_messages (struct rtpbatch *batch, unsigned int count);
+static void send_segments (struct rtpbatch *batch, struct msghdr *run);
+
+/* ============================================================================
+ * @Function: 	 rtpbatch_init
+ * @Description: Send from the UDP socket sock. With enable the packets of a
+ * frame are held and sent together, UDP_SEGMENT is used when the kernel
+ * answers for it on the socket; without, they are only counted.
+ * ============================================================================
+ */
+int rtpbatch_init (struct rtpbatch *batch, int sock, int enable)
+{
+	struct sockaddr_storage addr;
+	socklen_t len = sizeof(addr), optlen;
+	int gso = 0;
+
+	memset(batch, 0, sizeof(*batch));
+	batch->sock = sock;
+
+	memset(&addr, 0, sizeof(addr));
+	if (sock < 0 || getsockname(sock, (struct sockaddr *) &addr, &len) < 0)
+		return -EINVAL;
+	batch->family = addr.ss_family;
+	if (!enable)
+		return 0;
+
+	batch->mem = malloc(RTPBATCH_MEMORY);
+	batch->iov = calloc(RTPBATCH_MAX_PACKETS, sizeof(*batch->iov));
+	batch->runs = calloc(RTPBATCH_MAX_PACKETS, sizeof(*batch->runs));
+	batch->msgs = calloc(RTPBATCH_MAX_MESSAGES, sizeof(*batch->msgs));
+	batch->control = calloc(RTPBATCH_MAX_PACKETS, CMSG_SPACE(sizeof(uint16_t)));
+	if (!batch->mem || !batch->iov || !batch->runs || !batch->msgs || !batch->control) {
+		rtpbatch_free(batch);
+		return -ENOMEM;
+	}
+
+	optlen = sizeof(gso);
+	batch->gso = getsockopt(sock, SOL_UDP, UDP_SEGMENT, &gso, &optlen) == 0;
+	batch->batch = 1;
+
+	return 0;
+}
+
+/* ============================================================================
+ * @Function: 	 rtpbatch_free
+ * @Description: Drop the pending packets, nothing may push any more.
+ * ============================================================================
+ */
+void rtpbatch_free (struct rtpbatch *batch)
+{
+	free(batch->mem);
+	free(batch->iov);
+	free(batch->runs);
+	free(batch->msgs);
+	free(batch->control);
+	memset(batch, 0, sizeof(*batch));
+}
+
+/* ============================================================================
+ * @Function: 	 rtpbatch_add
+ * @Description: One more reference to host:port. A destination that does not
+ * resolve or fit is left to the caller: the batch stops taking packets
+ * until it is removed again, nobody misses any.
+ * ============================================================================
+ */
+int rtpbatch_add (struct rtpbatch *batch, const char *host, int port)
+{
+	struct rtpbatch_dest dest, *found;
+	int i, slot = -1, ret;
+
+	ret = dest_resolve(batch, host, port, &dest);
+
+	__atomic_add_fetch(&batch->generation, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	found = ret == 0 ? dest_find(batch, &dest) : NULL;
+	if (found) {
+		found->refs++;
+	} else if (ret == 0) {
+		for (i = 0; i < RTPBATCH_MAX_DESTS && slot < 0; i++)
+			if (!batch->dests[i].refs)
+				slot = i;
+		if (slot >= 0) {
+			dest.refs = 1;
+			dest.slot = slot;
+			batch->dests[slot] = dest;
+		} else {
+			ret = -ENOSPC;
+		}
+	}
+	if (ret < 0)
+		batch->untracked++;
+
+	__atomic_add_fetch(&batch->generation, 1, __ATOMIC_RELEASE);
+
+	return ret;
+}
+
+/* ============================================================================
+ * @Function: 	 rtpbatch_remove
+ * @Description: Drop a reference to host:port, or with all every one it has,
+ * from the thread adding them. An untracked destination only drops one: the
+ * batch stays stopped rather than miss a destination still there.
+ * ============================================================================
+ */
+int rtpbatch_remove (struct rtpbatch *batch, const char *host, int port, int all)
+{
+	struct rtpbatch_dest dest, *found;
+	int ret;
+
+	ret = dest_resolve(batch, host, port, &dest);
+
+	__atomic_add_fetch(&batch->generation, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	found = ret == 0 ? dest_find(batch, &dest) : NULL;
+	if (found)
+		found->refs = all ? 0 : found->refs - 1;
+	else if (batch->untracked)
+		batch->untracked--;
+	else
+		ret = -ENOENT;
+
+	__atomic_add_fetch(&batch->generation, 1, __ATOMIC_RELEASE);
+
+	return ret;
+}
+
+/* ============================================================================
+ * @Function: 	 rtpbatch_stats
+ * @Description: Packets and bytes sent to host:port so far, from the thread
+ * adding the destinations.
+ * ============================================================================
+ */
+int rtpbatch_stats (struct rtpbatch *batch, const char *host, int port,
+		    unsigned long long *packets, unsigned long long *bytes)
+{
+	struct rtpbatch_dest dest, *found;
+
+	if (dest_resolve(batch, host, port, &dest) < 0)
+		return -EINVAL;
+	found = dest_find(batch, &dest);
+	if (!found)
+		return -ENOENT;
+
+	*packets = __atomic_load_n(&found->packets, __ATOMIC_RELAXED);
+	*bytes = __atomic_load_n(&found->bytes, __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+/* ============================================================================
+ * @Function: 	 rtpbatch_push
+ * @Description: Queue an RTP packet. Its frame goes out on the marker bit,
+ * or when the next frame starts if the payloader sets none. Anything the
+ * batch cannot hold is sent by the caller, after the packets pending.
+ * ============================================================================
+ */
+int rtpbatch_push (struct rtpbatch *batch, const void *packet, unsigned int size)
+{
+	const unsigned char *rtp = (const unsigned char *) packet;
+	unsigned int timestamp;
+
+	dests_sync(batch);
+
+	if (!batch->batch || batch->copy_untracked || size < RTP_HEADER ||
+	    (rtp[0] >> 6) != RTP_VERSION || size > RTPBATCH_MEMORY) {
+		rtpbatch_flush(batch);
+		/* the caller's one sendto per destination */
+		batch->sent += batch->copy_count;
+		batch->calls += batch->copy_count;
+		return 0;
+	}
+
+	timestamp = (unsigned int) rtp[4] << 24 | rtp[5] << 16 | rtp[6] << 8 | rtp[7];
+	if (batch->packets && (timestamp != batch->timestamp ||
+			       batch->packets == RTPBATCH_MAX_PACKETS ||
+			       batch->used + size > RTPBATCH_MEMORY))
+		rtpbatch_flush(batch);
+
+	memcpy(batch->mem + batch->used, packet, size);
+	batch->iov[batch->packets].iov_base = batch->mem + batch->used;
+	batch->iov[batch->packets].iov_len = size;
+	batch->used += size;
+	batch->packets++;
+	batch->timestamp = timestamp;
+
+	if (rtp[1] & 0x80)
+		rtpbatch_flush(batch);
+
+	return 1;
+}
+
+/* ============================================================================
+ * @Function: 	 rtpbatch_flush
+ * @Description: Send the pending packets to every destination, as few
+ * sendmmsg() calls as the messages take. Returns the error of the last
+ * packet refused, they are counted and not sent again.
+ * ============================================================================
+ */
+int rtpbatch_flush (struct rtpbatch *batch)
+{
+	unsigned int i, r, runs, count = 0;
+	int ret = 0, err;
+
+	if (!batch->packets)
+		return 0;
+
+	runs = build_runs(batch);
+	for (i = 0; i < batch->copy_count; i++) {
+		struct rtpbatch_dest *dest = &batch->copy[i];
+
+		__atomic_add_fetch(&batch->dests[dest->slot].packets, batch->packets, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&batch->dests[dest->slot].bytes, batch->used, __ATOMIC_RELAXED);
+
+		for (r = 0; r < runs; r++) {
+			struct msghdr *hdr = &batch->msgs[count].msg_hdr;
+
+			*hdr = batch->runs[r];
+			hdr->msg_name = &dest->addr;
+			hdr->msg_namelen = dest->addrlen;
+			batch->msgs[count].msg_len = 0;
+
+			if (++count == RTPBATCH_MAX_MESSAGES) {
+				err = send_messages(batch, count);
+				ret = err < 0 ? err : ret;
+				count = 0;
+			}
+		}
+	}
+	if (count) {
+		err = send_messages(batch, count);
+		ret = err < 0 ? err : ret;
+	}
+
+	batch->used = 0;
+	batch->packets = 0;
+
+	return ret;
+}
+
+/* ============================================================================
+ * @Function: 	 dests_sync
+ * @Description: Take over the destinations when they changed. A copy torn
+ * by a change is thrown away, the next packet tries again.
+ * ============================================================================
+ */
+static void dests_sync (struct rtpbatch *batch)
+{
+	unsigned int gen, untracked, i, count;
+
+	gen = __atomic_load_n(&batch->generation, __ATOMIC_ACQUIRE);
+	if (gen == batch->copy_generation || (gen & 1))
+		return;
+
+	memcpy(batch->copy, batch->dests, sizeof(batch->copy));
+	untracked = batch->untracked;
+
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&batch->generation, __ATOMIC_RELAXED) != gen)
+		return;
+
+	for (i = 0, count = 0; i < RTPBATCH_MAX_DESTS; i++) {
+		if (!batch->copy[i].refs)
+			continue;
+		if (i != count)
+			batch->copy[count] = batch->copy[i];
+		count++;
+	}
+	batch->copy_count = count;
+	batch->copy_untracked = untracked;
+	batch->copy_generation = gen;
+}
+
+/* ============================================================================
+ * @Function: 	 dest_resolve
+ * @Description: Numeric host and port into an address of the socket's
+ * family, IPv4 ones as mapped addresses on an IPv6 socket.
+ * ============================================================================
+ */
+static int dest_resolve (struct rtpbatch *batch, const char *host, int port,
+			 struct rtpbatch_dest *dest)
+{
+	struct addrinfo hints, *addr;
+	char service[16];
+
+	memset(dest, 0, sizeof(*dest));
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+	snprintf(service, sizeof(service), "%d", port);
+	if (!host || getaddrinfo(host, service, &hints, &addr) != 0)
+		return -EINVAL;
+
+	if (addr->ai_family == batch->family && addr->ai_addrlen <= sizeof(dest->addr)) {
+		memcpy(&dest->addr, addr->ai_addr, addr->ai_addrlen);
+		dest->addrlen = addr->ai_addrlen;
+	} else if (addr->ai_family == AF_INET && batch->family == AF_INET6) {
+		struct sockaddr_in *in = (struct sockaddr_in *) addr->ai_addr;
+		struct sockaddr_in6 *in6 = (struct sockaddr_in6 *) &dest->addr;
+
+		in6->sin6_family = AF_INET6;
+		in6->sin6_port = in->sin_port;
+		in6->sin6_addr.s6_addr[10] = 0xff;
+		in6->sin6_addr.s6_addr[11] = 0xff;
+		memcpy(&in6->sin6_addr.s6_addr[12], &in->sin_addr, 4);
+		dest->addrlen = sizeof(*in6);
+	}
+	freeaddrinfo(addr);
+
+	return dest->addrlen ? 0 : -EAFNOSUPPORT;
+}
+
+/* ============================================================================
+ * @Function: 	 dest_find
+ * @Description: The table's entry of a resolved destination, NULL if none.
+ * ============================================================================
+ */
+static struct rtpbatch_dest *dest_find (struct rtpbatch *batch, struct rtpbatch_dest *dest)
+{
+	int i;
+
+	for (i = 0; i < RTPBATCH_MAX_DESTS; i++) {
+		struct rtpbatch_dest *d = &batch->dests[i];
+
+		if (d->refs && d->addrlen == dest->addrlen &&
+		    memcmp(&d->addr, &dest->addr, dest->addrlen) == 0)
+			return d;
+	}
+
+	return NULL;
+}
+
+/* ============================================================================
+ * @Function: 	 build_runs
+ * @Description: Group the pending packets into messages. With GSO a run of
+ * packets of one size, the last one maybe shorter, is one message the
+ * kernel cuts at that size; the fragments of a slice are all payloaded to
+ * the MTU, so a frame takes a few runs. Without, a message per packet.
+ * ============================================================================
+ */
+static unsigned int build_runs (struct rtpbatch *batch)
+{
+	struct msghdr *run = NULL;
+	struct cmsghdr *cmsg;
+	unsigned int i, runs = 0, segment = 0, bytes = 0;
+	size_t space = CMSG_SPACE(sizeof(uint16_t));
+	int ended = 0;
+
+	for (i = 0; i < batch->packets; i++) {
+		unsigned int size = batch->iov[i].iov_len;
+
+		if (run && batch->gso && !ended && size <= segment &&
+		    run->msg_iovlen < RTPBATCH_GSO_SEGMENTS && bytes + size <= RTPBATCH_GSO_BYTES) {
+			run->msg_iovlen++;
+			bytes += size;
+			ended = size < segment;
+			continue;
+		}
+
+		run = &batch->runs[runs++];
+		memset(run, 0, sizeof(*run));
+		run->msg_iov = &batch->iov[i];
+		run->msg_iovlen = 1;
+		segment = size;
+		bytes = size;
+		ended = 0;
+	}
+
+	for (i = 0; i < runs; i++) {
+		uint16_t size;
+
+		run = &batch->runs[i];
+		if (run->msg_iovlen < 2)
+			continue;
+
+		size = (uint16_t) run->msg_iov[0].iov_len;
+		run->msg_control = batch->control + i * space;
+		run->msg_controllen = space;
+		memset(run->msg_control, 0, space);
+		cmsg = CMSG_FIRSTHDR(run);
+		cmsg->cmsg_level = SOL_UDP;
+		cmsg->cmsg_type = UDP_SEGMENT;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(size));
+		memcpy(CMSG_DATA(cmsg), &size, sizeof(size));
+	}
+
+	return runs;
+}
+
+/* ============================================================================
+ * @Function: 	 send_messages
+ * @Description: sendmmsg() until every message went out or was refused. A
+ * GSO run the kernel or the device cannot take turns GSO off and goes out
+ * packet by packet.
+ * ============================================================================
+ */
+static int send_messages (struct rtpbatch *batch, unsigned int count)
+{
+	struct mmsghdr *msgs = batch->msgs;
+	unsigned int i = 0, k;
+	int n, err, ret = 0;
+
+	while (i < count) {
+		n = sendmmsg(batch->sock, msgs + i, count - i, 0);
+		batch->calls++;
+		if (n > 0) {
+			for (k = i; k < i + (unsigned int) n; k++)
+				batch->sent += msgs[k].msg_hdr.msg_iovlen;
+			i += n;
+			continue;
+		}
+
+		err = n < 0 ? errno : EIO;
+		if (err == EINTR)
+			continue;
+
+		if (msgs[i].msg_hdr.msg_controllen && (err == EIO || err == EINVAL)) {
+			batch->gso = 0;
+			send_segments(batch, &msgs[i].msg_hdr);
+		} else {
+			batch->errors += msgs[i].msg_hdr.msg_iovlen;
+			batch->last_error = err;
+			ret = -err;
+		}
+		i++;
+	}
+
+	return ret;
+}
+
+/* ============================================================================
+ * @Function: 	 send_segments
+ * @Description: The packets of a run, one sendmsg() each.
+ * ============================================================================
+ */
+static void send_segments (struct rtpbatch *batch, struct msghdr *run)
+{
+	struct msghdr hdr;
+	size_t i;
+
+	for (i = 0; i < run->msg_iovlen; i++) {
+		memset(&hdr, 0, sizeof(hdr));
+		hdr.msg_name = run->msg_name;
+		hdr.msg_namelen = run->msg_namelen;
+		hdr.msg_iov = &run->msg_iov[i];
+		hdr.msg_iovlen = 1;
+
+		batch->calls++;
+		if (sendmsg(batch->sock, &hdr, 0) < 0) {
+			batch->errors++;
+			batch->last_error = errno;
+		} else {
+			batch->sent++;
+		}
+	}
+}
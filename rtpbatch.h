@@ -0,0 +1,86 @@
+#ifndef RTPBATCH_H_
+#define RTPBATCH_H_
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RTPBATCH_MEMORY		(256 * 1024)	/* packet bytes held, a frame or part of one */
+#define RTPBATCH_MAX_PACKETS	512
+#define RTPBATCH_MAX_DESTS	32
+#define RTPBATCH_MAX_MESSAGES	1024	/* per system call, UIO_MAXIOV */
+#define RTPBATCH_GSO_SEGMENTS	64	/* per message, UDP_MAX_SEGMENTS */
+#define RTPBATCH_GSO_BYTES	60000	/* per message, under the 64k of a datagram */
+
+/* One destination of the socket, a reference per add */
+struct rtpbatch_dest
+{
+	struct sockaddr_storage addr;
+	socklen_t 	addrlen;
+	unsigned int 	refs;
+	unsigned int 	slot;		/* in the table, of a sender's copy */
+	unsigned long long packets;	/* handed to the socket, counted in the table */
+	unsigned long long bytes;
+};
+
+/* RTP packets of a frame sent to every destination of a UDP socket in one
+ * sendmmsg() call, as runs of equal sized packets under UDP_SEGMENT (GSO)
+ * where the kernel has it, rather than one sendto() per packet and
+ * destination. One thread changes the destinations, another sends: the
+ * sender copies them over when their generation moves, the changing side
+ * never waits. Without batch the packets are only counted, as the calls a
+ * sender of one packet per call would make. */
+struct rtpbatch
+{
+	int 		sock;
+	int 		family;		/* of sock, IPv4 destinations mapped for AF_INET6 */
+	int 		batch;
+	int 		gso;
+
+	/* Destinations, odd generation while they change */
+	struct rtpbatch_dest dests[RTPBATCH_MAX_DESTS];
+	unsigned int 	untracked;	/* added past the table, batching stops */
+	unsigned int 	generation;
+
+	/* Sending side: its copy of the destinations and the packets pending */
+	struct rtpbatch_dest copy[RTPBATCH_MAX_DESTS];
+	unsigned int 	copy_count;
+	unsigned int 	copy_untracked;
+	unsigned int 	copy_generation;
+	unsigned char 	*mem;
+	unsigned int 	used;
+	unsigned int 	packets;
+	unsigned int 	timestamp;	/* RTP time of the pending packets */
+	struct iovec 	*iov;		/* one per packet */
+	struct msghdr 	*runs;		/* the packets of one datagram or GSO run */
+	struct mmsghdr 	*msgs;		/* the runs, to every destination */
+	char 		*control;	/* UDP_SEGMENT of each run */
+
+	/* Counters, written by the sending thread */
+	unsigned long long sent;	/* packets, once per destination */
+	unsigned long long calls;	/* system calls they took */
+	unsigned long long errors;	/* packets the socket refused */
+	int 		last_error;	/* errno of the last refused */
+};
+
+/* These functions return ERROR value as an integer */
+int rtpbatch_init	(struct rtpbatch *batch, int sock, int enable);
+void rtpbatch_free	(struct rtpbatch *batch);
+int rtpbatch_add	(struct rtpbatch *batch, const char *host, int port);
+int rtpbatch_remove	(struct rtpbatch *batch, const char *host, int port, int all);
+int rtpbatch_stats	(struct rtpbatch *batch, const char *host, int port,
+			 unsigned long long *packets, unsigned long long *bytes);
+
+/* Take one RTP packet: 1 when it is the batch's to send (queued, or sent
+ * with its frame on the marker bit), 0 when the caller sends it itself */
+int rtpbatch_push	(struct rtpbatch *batch, const void *packet, unsigned int size);
+int rtpbatch_flush	(struct rtpbatch *batch);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RTPBATCH_H_ */
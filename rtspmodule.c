@@ -47,195 +47,2646 @@
  *
  * ============================================================================ 
  */
+#include <stdio.h>
+#include <gst/gst.h>
+#include <gst/rtsp-server/rtsp-server.h>
+#include <glib.h>
+#include <time.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "framebox.h"
+#include "framepool.h"
+#include "pixfmt.h"
+#include "encprofile.h"
+#include "frametrace.h"
+#include "metrics.h"
+#include "httpmetrics.h"
+#include "ratectl.h"
+#include "yuvconv.h"
+#include "motion.h"
+#include "mcastpool.h"
+#include "sendq.h"
+#include "rtpbatch.h"
+#include "rtspmedia.h"
+#include "rtspmodule.h"
+
+/* One RTSP server and main loop, shared by all the streams */
+struct rtspmodule
+{
+	GMainLoop 	*loop;
+	GstRTSPServer 	*server;
+	guint 		server_source;		/* sources on the default context */
+	guint 		cleanup_source;
+	gchar 		*service;
+	GList 		*streams;
+	struct httpmetrics *metrics;	/* Prometheus endpoint, NULL = none */
+	struct mcastpool *mcast;	/* groups of the mount points, NULL = unicast only */
+};
+
+struct rtspmodule_stream;
+
+/* Capture time of a pushed frame, found again by pts in the pad probes */
+#define BRANCH_TRACE_FRAMES	32
+
+struct branch_trace
+{
+	GstClockTime 	pts;
+	guint64 	key;
+};
+
+/* Counters of a branch, counted by its streaming thread only */
+#define BRANCH_ENCODED_FRAMES	0
+#define BRANCH_ENCODED_BYTES	1
+
+/* Counters of the RTP a branch sends over UDP, by the thread of its RTP sink */
+#define BRANCH_UDP_PACKETS	0
+#define BRANCH_UDP_CALLS	1
+
+/* Per branch metric families, see render_branches */
+#define METRIC_QUEUE_DEPTH	0
+#define METRIC_PRODUCER_DROPS	1
+#define METRIC_CONSUMER_DROPS	2
+#define METRIC_UNDERRUNS	3
+#define METRIC_KEYFRAME_WAITS	4
+#define METRIC_ENCODED_FRAMES	5
+#define METRIC_ENCODED_BYTES	6
+#define METRIC_ENCODER_BITRATE	7
+#define METRIC_UDP_PACKETS	8
+#define METRIC_UDP_CALLS	9
+
+/* Receiver report of one session stream, see session_rtcp */
+struct session_rtcp
+{
+	guint 		fraction_lost;	/* 1/256 */
+	gint 		packets_lost;
+	guint 		jitter;		/* RTP clock units */
+	guint 		exthighestseq;	/* moves with every new report */
+};
+
+/* One encoder pipeline of a stream, served on its own mount point */
+struct stream_branch
+{
+	struct rtspmodule_stream *stream;
+	struct rtspmodule_branch arguments;
+	GstElement 	*pipeline;
+	GstElement 	*appsrc;
+	GstRTSPMediaFactory *factory;
+
+	/* Frames waiting to be pushed, references of the stream's buffers */
+	struct framebox framebox;
+	gint 		starving;	/* appsrc asked for a frame it has not had */
+	gint 		pushing;	/* push_frame held, by need-data or stream_put */
+	guint 		underruns;
+	guint64 	next_due;	/* capture time of the next frame to take */
+	gint 		discont;
+	guint 		seen_drops;
+	gboolean 	resync;		/* next frame pushed starts after a gap */
+	guint 		keyframe_waits;
+
+	/* Timing of the pushed frames */
+	GstClockTime 	last_pts;
+	guint64 	first_capture;
+
+	/* Latency tracing, see frametrace.h */
+	guint 		trace_track;
+	struct branch_trace trace[BRANCH_TRACE_FRAMES];
+	guint 		trace_next;
+	GstClockTime 	trace_encoded;		/* pts last stamped by each probe */
+	GstClockTime 	trace_payloaded;
+
+	struct metrics_counters *counters;	/* BRANCH_*, a cache line of their own */
+	struct metrics_counters *udp_counters;	/* BRANCH_UDP_* */
+
+	/* Adaptive bitrate, see ratectl.h */
+	GstElement 	*venc;
+	struct ratectl 	ratectl;
+	guint 		ratectl_source;		/* main loop timeout, 0 = fixed bitrate */
+	const char 	*ratectl_logged;	/* reason of the last decision logged */
+	GHashTable 	*rtcp_seen;		/* session stream -> its last report */
+
+	/* Multicast group the shared media is sent to once, NULL = none */
+	gchar 		*mcast_group;
+	gint 		mcast_port;
+
+	guint 		sendq_source;		/* main loop timeout, 0 = unbounded clients */
+	GList 		*send_clients;		/* struct send_client, main loop only */
+	gboolean 	send_table_full;	/* logged */
+
+	guint 		bus_source;
+	gint 		failed;			/* pipeline stopped on an error, fed no more */
+};
+
+/* One video source, fanned out to one or more encoder branches */
+struct rtspmodule_stream
+{
+	struct rtspmodule *module;
+	struct rtspmodule_arguments arguments;
+	guint 		datasize;
+	guint 		datasequence;
+
+	/* Layout of the frames handed in, as captured */
+	struct pixfmt 	layout;
+	const gchar 	*capsformat;	/* fourcc in the appsrc caps */
+
+	/* Compressed by the camera, fed to the payloader without vencoder */
+	gboolean 	passthrough;
+	gboolean 	interframe;	/* frames depend on earlier ones (H.264/H.265) */
+
+	/* 4:2:2 to 4:2:0 conversion ahead of appsrc, outformat 0 = none */
+	guint32 	informat;
+	guint32 	outformat;
+	guint 		outsize;
+
+	/* Buffers the frames are copied or converted into, allocated on first use */
+	struct framepool pool;
+
+	guint 		last_sequence;
+	gboolean 	have_sequence;
+	GList 		*branches;
+
+	/* Static scene detection, branches slow down to motion_fps while still */
+	struct motion 	motion;
+	gboolean 	motion_detect;
+	gint 		still;
+	guint 		static_frames;		/* in a row, still after a second of them */
+	rtspmodule_motion_func motion_callback;
+	void 		*motion_data;
+};
+
+static gboolean cleanup_timeout(GstRTSPServer * server, gboolean ignored);
+static gboolean bus_watch(GstBus *bus, GstMessage *msg, gpointer data);
+static void branch_fail (struct stream_branch *branch);
+static void cb_need_data (GstElement *appsrc, guint unused_size, gpointer user_data);
+static void frame_release (gpointer mem);
+static void data_keep (void *data);
+static gboolean stream_pool (struct rtspmodule_stream *stream);
+static int stream_put (struct rtspmodule_stream *stream, struct rtspmodule_frame *data,
+			gint64 pts_offset);
+static void buffer_release (void *buffer);
+static gboolean branch_takes (struct stream_branch *branch, guint64 timestamp);
+static void branch_feed (struct stream_branch *branch);
+static gboolean push_frame (struct stream_branch *branch, struct framebox_frame *frame);
+static GstClockTime frame_pts (struct stream_branch *branch, struct framebox_frame *frame);
+static guint64 monotonic_time (void);
+static void trace_probe (GstElement *element, GCallback callback, struct stream_branch *branch);
+static gboolean cb_trace_encoded (GstPad *pad, GstBuffer *buffer, gpointer user_data);
+static gboolean cb_trace_payloaded (GstPad *pad, GstBuffer *buffer, gpointer user_data);
+static void trace_stamp (struct stream_branch *branch, GstBuffer *buffer, int stage,
+			 GstClockTime *last);
+static GstElement* construct_app_pipeline(struct stream_branch *branch);
+static GstCaps *source_caps (struct stream_branch *branch);
+static void force_keyframe (struct stream_branch *branch);
+static gboolean stream_pool_drain (struct rtspmodule_stream *stream);
+static struct stream_branch *add_branch (struct rtspmodule_stream *stream,
+				struct rtspmodule_branch *arg);
+static void destroy_stream (struct rtspmodule_stream *stream);
+static void stream_motion_init (struct rtspmodule_stream *stream);
+static void stream_motion (struct rtspmodule_stream *stream, const char *data);
+static gboolean cb_count_encoded (GstPad *pad, GstBuffer *buffer, gpointer user_data);
+static void cb_media_configure (GstRTSPMediaFactory *factory, GstRTSPMedia *media,
+				gpointer user_data);
+static void cb_media_prepared (GstRTSPMedia *media, gpointer user_data);
+static void mcast_setup (struct stream_branch *branch, GstRTSPMediaStream *mstream);
+static void cb_client_removed (GstElement *udpsink, gchar *host, gint port, gpointer user_data);
+static void cb_client_added (GstElement *udpsink, gchar *host, gint port, gpointer user_data);
+static void udp_attach (struct stream_branch *branch, GstRTSPMediaStream *mstream);
+static void udp_batch_free (gpointer data);
+static void cb_udp_added (GstElement *udpsink, gchar *host, gint port, gpointer user_data);
+static void cb_udp_removed (GstElement *udpsink, gchar *host, gint port, gpointer user_data);
+static gboolean cb_udp_packet (GstPad *pad, GstBuffer *buffer, gpointer user_data);
+static void render_metrics (GString *out, gpointer user_data);
+static void render_branches (GString *out, struct rtspmodule *rtsp, const char *name,
+			     const char *type, const char *help, int which);
+static void render_sessions (GString *out, struct rtspmodule *rtsp);
+static gboolean session_rtcp (GstRTSPSessionStream *sstream, struct session_rtcp *rtcp);
+static void set_bitrate (struct stream_branch *branch, int bitrate);
+static gboolean cb_ratectl (gpointer user_data);
+static gboolean cb_sendq_scan (gpointer user_data);
+static gboolean cb_send_rtp (GstBuffer *buffer, guint8 channel, gpointer user_data);
+static guint send_slot (gpointer client, guint8 channel);
+static struct send_client *send_client_find (gpointer client, guint8 channel);
+static int send_client_insert (struct send_client *sc);
+static void send_client_remove (struct send_client *sc);
+static struct send_client *send_client_of (GstRTSPSessionStream *sstream);
+static void unwrap_send_clients (struct stream_branch *branch);
+static void forget_send_clients (struct stream_branch *branch, gboolean all);
+static int sendq_codec (struct stream_branch *branch);
+static void branch_report (struct stream_branch *branch, struct ratectl_report *report);
+
+/* TCP clients of a branch, see sendq.h. The server's RTP send function of
+ * each is swapped for cb_send_rtp, its user data is left alone: the media's
+ * streaming thread may be calling it at any time. The branch's list of
+ * them is only walked by the main loop */
+#define SENDQ_SCAN_MS	250	/* new clients are looked for this often */
+
+struct send_client
+{
+	struct stream_branch *branch;
+	GstRTSPSessionStream *sstream;
+	gpointer 	client;		/* user data of the send functions */
+	guint8 		channel;
+	GstRTSPSendFunc send_rtp;	/* the server's own, admitted packets go there */
+	struct sendq 	queue;
+	gboolean 	seen;
+	gboolean 	gone;		/* out of send_table, freed on the next scan */
+	gboolean 	closing;
+};
+
+/* Send queues by the client and channel cb_send_rtp is called with, open
+ * addressing. Written by the main loop only; the streaming thread reads a
+ * slot once and checks that queue's own client and channel, so a slot
+ * taken over under it is never mistaken for its own */
+#define SEND_TABLE_SIZE	256	/* power of 2, TCP streams queued at once */
+
+static struct send_client *send_table[SEND_TABLE_SIZE];
+static struct send_client send_removed;	/* freed slot the probes go on past */
+
+/* RTP sink of a media stream and its UDP clients, see rtpbatch.h. Owned by
+ * the sink, freed with it */
+#define UDP_BATCH_KEY	"bbwatch-rtpbatch"
+
+struct udp_batch
+{
+	struct stream_branch *branch;
+	struct rtpbatch batch;
+	guint64 	packets;	/* of the batch's counters, added to the branch's */
+	guint64 	calls;
+	gboolean 	failed;		/* a refused packet was reported */
+};
+
+/* Instance behind the single camera rtspmodule_init/start/... interface */
+static struct rtspmodule *defaultmodule;
+static struct rtspmodule_stream *defaultstream;
+
+/* ============================================================================
+ * @Function: 	 rtspmodule_init
+ * @Description: Initialize GST Application interface.
+ * ============================================================================
+ */
+int rtspmodule_init (struct rtspmodule_arguments *arg)
+{
+	defaultmodule = rtspmodule_create(NULL);
+	if ( !defaultmodule )
+		return -1;
+
+	if (arg->multicast &&
+	    rtspmodule_set_multicast(defaultmodule, arg->multicast, arg->multicast_port_min,
+				     arg->multicast_port_max, arg->multicast_ttl) != 0)
+		return -1;
+
+	defaultstream = rtspmodule_add_stream(defaultmodule, "/bbwatch", arg);
+	if ( !defaultstream )
+		return -1;
+
+	if (arg->metrics_service &&
+	    rtspmodule_serve_metrics(defaultmodule, arg->metrics_service) != 0)
+		return -1;
+
+	return 0;
+}
+
+/* ============================================================================
+ * @Function: 	 rtspmodule_start
+ * @Description: Start GST Pipeline.
+ * ============================================================================
+ */
+int rtspmodule_start(void)
+{
+	return rtspmodule_run(defaultmodule);
+}
+
+/* ============================================================================
+ * @Function: 	 rtspmodule_close
+ * @Description: Close GST Pipeline.
+ * ============================================================================
+ */
+int rtspmodule_close(void)
+{
+	GList *item;
+
+	rtspmodule_quit(defaultmodule);
+	for (item = defaultstream->branches; item; item = item->next) {
+		struct stream_branch *branch = item->data;
+		framebox_flush(&branch->framebox);
+	}
+	return 0;
+}
+
+
+/* ============================================================================
+ * @Function: 	 rtspmodule_setdata
+ * @Description: Copy the input data into a buffer of the stream's pool.
+ * Returns -1 and drops the frame when every pool buffer is in use.
+ * ============================================================================
+ */
+int rtspmodule_setdata (char *data)
+{
+	return rtspmodule_stream_setdata(defaultstream, data);
+}
+
+/* ============================================================================
+ * @Function: 	 rtspmodule_setframe
+ * @Description: Hand the frame memory over to the pipeline without a copy.
+ * ============================================================================
+ */
+int rtspmodule_setframe (struct rtspmodule_frame *frame)
+{
+	return rtspmodule_stream_setframe(defaultstream, frame);
+}
+
+/* ============================================================================
+ * @Function: 	 rtspmodule_setencoded
+ * @Description: Hand a pre-encoded access unit over to the pipeline.
+ * ============================================================================
+ */
+int rtspmodule_setencoded (struct rtspmodule_encoded *au)
+{
+	return rtspmodule_stream_setencoded(defaultstream, au);
+}
+
+/* ============================================================================
+ * @Function: 	 rtspmodule_getstats
+ * @Description: Report the frame queue counters.
+ * ============================================================================
+ */
+int rtspmodule_getstats (struct rtspmodule_stats *stats)
+{
+	return rtspmodule_stream_getstats(defaultstream, stats);
+}
+
+/* ============================================================================
+ * @Function: 	 rtspmodule_flush
+ * @Description: Give back the frames waiting in the queues.
+ * ============================================================================
+ */
+int rtspmodule_flush (void)
+{
+	return rtspmodule_stream_flush(defaultstream);
+}
+
+/* ============================================================================
+ * @Function: 	 rtspmodule_reformat
+ * @Description: Switch the stream to another capture size or rate.
+ * ============================================================================
+ */
+int rtspmodule_reformat (int width, int height, int stride, int gfps)
+{
+	return rtspmodule_stream_reformat(defaultstream, width, height, stride, gfps);
+}
+
+/* ============================================================================
+ * @Function: 	 rtspmodule_set_motion_callback
+ * @Description: Be told when the scene starts or stops moving.
+ * ============================================================================
+ */
+int rtspmodule_set_motion_callback (rtspmodule_motion_func callback, void *user_data)
+{
+	return rtspmodule_stream_set_motion_callback(defaultstream, callback, user_data);
+}
+
+/* ============================================================================
+ * @Function: 	 rtspmodule_create
+ * @Description: Create the RTSP server and its main loop. All the streams
+ * added to it are served from this one server, on service (port).
+ * ============================================================================
+ */
+struct rtspmodule *rtspmodule_create (const char *service)
+{
+	guint major, minor, micro, nano;
+	struct rtspmodule *rtsp;
+
+	/* GSTAPP Setup */
+	gst_init(NULL, NULL);
+
+	gst_version(&major, &minor, &micro, &nano);
+	g_print("..This program is linked against GStreamer %d.%d.%d\n", major, minor, micro);
+
+	rtsp = g_new0(struct rtspmodule, 1);
+	rtsp->loop = g_main_loop_new(NULL, FALSE);
+	rtsp->service = g_strdup(service ? service : RTSPMODULE_DEFAULT_SERVICE);
+
+	/* create a server instance */
+  	rtsp->server = gst_rtsp_server_new ();
+	gst_rtsp_server_set_service (rtsp->server, rtsp->service);
+
+  	/* attach the server to the default maincontext */
+	rtsp->server_source = gst_rtsp_server_attach (rtsp->server, NULL);
+  	if (rtsp->server_source == 0) {
+		g_printerr("Failed to attach the server on port %s\n", rtsp->service);
+		rtspmodule_destroy(rtsp);
+		return NULL;
+	}
+	 /* add a timeout for the session cleanup */
+  	rtsp->cleanup_source = g_timeout_add_seconds (2, (GSourceFunc) cleanup_timeout,
+  			rtsp->server);
+
+	return rtsp;
+}
+
+/* ============================================================================
+ * @Function: 	 rtspmodule_add_stream
+ * @Description: Build a pipeline for one video source and serve it on the
+ * mount point (e.g. "/bbwatch").
+ * ============================================================================
+ */
+struct rtspmodule_stream *rtspmodule_add_stream (struct rtspmodule *rtsp,
+				const char *mount, struct rtspmodule_arguments *arg)
+{
+	struct rtspmodule_branch branch;
+
+	branch.mount = (char *) mount;
+	branch.width = arg->width;
+	branch.height = arg->height;
+	branch.gfps = arg->gfps;
+	branch.gbitrate = arg->gbitrate;
+	branch.min_bitrate = arg->min_bitrate;
+	branch.max_bitrate = arg->max_bitrate;
+
+	return rtspmodule_add_simulcast(rtsp, arg, &branch, 1);
+}
+
+/* ============================================================================
+ * @Function: 	 rtspmodule_add_simulcast
+ * @Description: Serve one video source as several encodings, one per branch,
+ * each with its own size, rate and bitrate on its own mount point. The raw
+ * frames are shared by all the branches by reference.
+ * ============================================================================
+ */
+struct rtspmodule_stream *rtspmodule_add_simulcast (struct rtspmodule *rtsp,
+				struct rtspmodule_arguments *arg,
+				struct rtspmodule_branch *branches, int count)
+{
+	struct rtspmodule_stream *stream;
+	const struct pixfmt_desc *indesc, *outdesc;
+	struct pixfmt packed;
+	int i;
+
+	stream = g_new0(struct rtspmodule_stream, 1);
+	stream->module = rtsp;
+
+	/* Settings - Source, Encoder and Streaming */
+	stream->arguments = *arg;
+	stream->arguments.vencoder = g_strdup(arg->vencoder);
+	stream->arguments.rtpencoder = g_strdup(arg->rtpencoder);
+	stream->arguments.profile = g_strdup(arg->profile);
+	stream->arguments.informat = g_strdup(arg->informat ? arg->informat : "UYVY");
+	stream->arguments.vformat = g_strdup(arg->vformat);
+
+	if (encprofile_check(arg->profile) < 0) {
+		g_printerr("$$ Unknown latency profile %s\n", arg->profile);
+		destroy_stream(stream);
+		return NULL;
+	}
+
+	/* Frames are sized from the capture format and its line pitch */
+	indesc = pixfmt_parse(stream->arguments.informat);
+	if (!indesc || indesc->mem_planes > 1 ||
+	    pixfmt_fill(&stream->layout, indesc->fourcc, arg->width, arg->height, arg->stride) < 0) {
+		g_printerr("$$ Unsupported input format %s (stride %d)\n",
+				stream->arguments.informat, arg->stride);
+		destroy_stream(stream);
+		return NULL;
+	}
+	stream->datasize = stream->layout.size;
+	stream->informat = indesc->fourcc;
+	stream->capsformat = indesc->name;
+
+	/* Pixel format conversion, done here with the SIMD kernels rather than
+	 * by a colorspace element in every branch */
+	outdesc = arg->vformat ? pixfmt_parse(arg->vformat) : indesc;
+	if (indesc->planes == 0) {
+		/* Compressed by the camera, nothing to encode or convert */
+		if (outdesc != indesc) {
+			g_printerr("$$ Cannot convert %s to %s\n", stream->arguments.informat, arg->vformat);
+			destroy_stream(stream);
+			return NULL;
+		}
+		stream->passthrough = TRUE;
+		stream->interframe = (g_strcmp0(indesc->name, "H264") == 0 ||
+				      g_strcmp0(indesc->name, "H265") == 0);
+
+		/* every skipped delta frame costs a wait for the next keyframe,
+		 * keep frames in order and drop only when the queue is full */
+		if (stream->interframe)
+			stream->arguments.queue_policy = RTSPMODULE_QUEUE_DROP_OLDEST;
+		g_print("..Passing %s through without encoding\n", stream->arguments.informat);
+	} else if (outdesc != indesc) {
+		stream->outformat = outdesc ? outdesc->fourcc : 0;
+		stream->outsize = yuvconv_size(stream->outformat, arg->width, arg->height);
+		if ((stream->informat != YUVCONV_UYVY && stream->informat != YUVCONV_YUYV) ||
+		    !stream->outsize || (arg->width & 1)) {
+			g_printerr("$$ Cannot convert %s to %s\n", stream->arguments.informat, arg->vformat);
+			destroy_stream(stream);
+			return NULL;
+		}
+		stream->capsformat = outdesc->name;
+		g_print("..Converting %s to %s (%s)\n", stream->arguments.informat,
+				arg->vformat, yuvconv_name());
+	} else {
+		/* appsrc caps imply GStreamer's own line pitch */
+		pixfmt_fill(&packed, indesc->fourcc, arg->width, arg->height, 0);
+		if (stream->layout.stride[0] != GST_ROUND_UP_4 (packed.stride[0])) {
+			g_printerr("$$ %s lines of %u bytes need a vformat conversion\n",
+					stream->arguments.informat, stream->layout.stride[0]);
+			destroy_stream(stream);
+			return NULL;
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		if ( !add_branch(stream, &branches[i]) ) {
+			destroy_stream(stream);
+			return NULL;
+		}
+	}
+
+	if (arg->motion_fps > 0) {
+		if (stream->passthrough)
+			g_printerr("$$ No motion detection on %s frames\n", stream->arguments.informat);
+		else
+			stream_motion_init(stream);
+	}
+
+	rtsp->streams = g_list_append(rtsp->streams, stream);
+	return stream;
+}
+
+/* ============================================================================
+ * @Function: 	 add_branch
+ * @Description: Build the encoder pipeline of one branch and attach it to
+ * its mount point.
+ * ============================================================================
+ */
+static struct stream_branch *add_branch (struct rtspmodule_stream *stream,
+				struct rtspmodule_branch *arg)
+{
+	struct rtspmodule *rtsp = stream->module;
+	struct stream_branch *branch;
+	GstRTSPMediaMapping *mapping;
+	GstBus  *bus;
+
+	branch = g_new0(struct stream_branch, 1);
+	branch->stream = stream;
+	branch->arguments = *arg;
+	branch->arguments.mount = g_strdup(arg->mount);
+	stream->branches = g_list_append(stream->branches, branch);
+
+	/* start on a keyframe, marked as a discontinuity */
+	branch->resync = TRUE;
+	branch->trace_track = frametrace_enabled() ? frametrace_track() : 0;
+	branch->trace_encoded = GST_CLOCK_TIME_NONE;
+	branch->trace_payloaded = GST_CLOCK_TIME_NONE;
+
+	branch->counters = metrics_counters_new();
+	branch->udp_counters = metrics_counters_new();
+	if ( !branch->counters || !branch->udp_counters ) {
+		g_printerr("$$ No memory for the counters of %s\n", arg->mount);
+		return NULL;
+	}
+
+	/* Compressed frames are neither scaled nor, if they refer to earlier
+	 * ones, decimated */
+	if (stream->passthrough &&
+	    (arg->width != stream->arguments.width || arg->height != stream->arguments.height ||
+	     (stream->interframe && arg->gfps < stream->arguments.gfps))) {
+		g_printerr("$$ %s branch %s must keep the source size%s\n", stream->capsformat,
+				arg->mount, stream->interframe ? " and rate" : "");
+		return NULL;
+	}
+
+	if (framebox_init(&branch->framebox, stream->arguments.queue_depth,
+				stream->arguments.queue_policy) != 0) {
+		g_printerr("Invalid frame queue depth %d\n", stream->arguments.queue_depth);
+		return NULL;
+	}
+
+	branch->pipeline = construct_app_pipeline(branch);
+	if ( !branch->pipeline ) {
+		g_printerr("Failed to construct pipeline\n");
+		return NULL;
+	}
+	g_print("..GSTAPP Pipeline Setup... \n");
+
+	/* Bitrate follows the receiver reports of the viewers */
+	if (arg->min_bitrate > 0 && branch->venc) {
+		ratectl_init(&branch->ratectl, arg->gbitrate, arg->min_bitrate,
+				arg->max_bitrate > 0 ? arg->max_bitrate : arg->gbitrate);
+		if (branch->ratectl.bitrate != (guint) arg->gbitrate)
+			set_bitrate(branch, branch->ratectl.bitrate);
+		branch->ratectl_source = g_timeout_add(RATECTL_INTERVAL_MS, cb_ratectl, branch);
+		g_print("..%s bitrate adapts between %u and %u kbit/s\n", arg->mount,
+				branch->ratectl.min, branch->ratectl.max);
+	} else if (arg->min_bitrate > 0) {
+		g_printerr("$$ %s is sent at the camera's bitrate, not adapted\n", arg->mount);
+	}
+
+	/* A viewer over a slow TCP link gets frames dropped, no one else */
+	if (stream->arguments.send_queue > 0)
+		branch->sendq_source = g_timeout_add(SENDQ_SCAN_MS, cb_sendq_scan, branch);
+
+	/* we add a message handler */
+	bus = gst_pipeline_get_bus(GST_PIPELINE (branch->pipeline));
+	branch->bus_source = gst_bus_add_watch(bus, bus_watch, branch);
+	gst_object_unref(bus);
+
+  	/* get the mapping for this server, every server has a default mapper object
+   	* that be used to map uri mount points to media factories */
+  	mapping = gst_rtsp_server_get_media_mapping (rtsp->server);
+
+	/* make a media factory for a test stream.
+	* The default media factory can use
+   	* gst-launch syntax to create pipelines.
+   	* any launch line works as long as it contains elements
+	* named pay%d. Each element with pay%d names will be a stream */
+  	//factory = gst_rtsp_media_factory_new ();
+    	branch->factory = GST_RTSP_MEDIA_FACTORY(gst_rtsp_media_factory_custom_new());
+
+  	// allow multiple clients to see the same video
+  	gst_rtsp_media_factory_set_shared (branch->factory, TRUE);
+    	g_object_set(branch->factory, "bin", branch->pipeline, NULL);
+
+	/* clients joining the shared media are caught up on their own */
+	g_signal_connect(branch->factory, "media-configure", G_CALLBACK (cb_media_configure), branch);
+
+	/* SETUP answers a multicast transport with the branch's group */
+	if (rtsp->mcast) {
+		gchar group[INET_ADDRSTRLEN];
+
+		if (mcastpool_get(rtsp->mcast, group, sizeof(group), &branch->mcast_port) < 0) {
+			g_printerr("$$ No multicast group left for %s\n", arg->mount);
+			return NULL;
+		}
+		branch->mcast_group = g_strdup(group);
+		gst_rtsp_media_factory_set_multicast_group(branch->factory, branch->mcast_group);
+		gst_rtsp_media_factory_set_protocols(branch->factory, GST_RTSP_LOWER_TRANS_UDP |
+				GST_RTSP_LOWER_TRANS_UDP_MCAST | GST_RTSP_LOWER_TRANS_TCP);
+		g_print("..%s multicast to %s:%d, ttl %u\n", arg->mount, branch->mcast_group,
+				branch->mcast_port, rtsp->mcast->ttl);
+	}
+
+  	/* attach the factory to the mount point, the mapping keeps a ref */
+  	g_object_ref (branch->factory);
+  	gst_rtsp_media_mapping_add_factory (mapping, branch->arguments.mount, branch->factory);
+  	/* don't need the ref to the mapping anymore */
+  	g_object_unref (mapping);
+
+	g_print("..GST Pipeline Initialized ...\n");
+    	g_print ("stream ready at rtsp://127.0.0.1:%s%s (%dx%d@%d)\n", rtsp->service,
+			branch->arguments.mount, arg->width, arg->height, arg->gfps);
+
+	return branch;
+}
+
+/* ============================================================================
+ * @Function: 	 rtspmodule_run
+ * @Description: Run the main loop serving all the streams, returns when the
+ * loop is quit.
+ * ============================================================================
+ */
+int rtspmodule_run (struct rtspmodule *rtsp)
+{
+	GList *item, *bitem;
+
+	g_print("..Now streaming...\n");
+	g_main_loop_run(rtsp->loop);
+
+	/* Out of the main loop, stop the pipelines */
+	for (item = rtsp->streams; item; item = item->next) {
+		struct rtspmodule_stream *stream = item->data;
+		for (bitem = stream->branches; bitem; bitem = bitem->next) {
+			struct stream_branch *branch = bitem->data;
+			gst_element_set_state(branch->pipeline, GST_STATE_NULL);
+		}
+	}
+
+	return 0;
+}
+
+/* ============================================================================
+ * @Function: 	 rtspmodule_serve_metrics
+ * @Description: Serve the capture, queue, encoder and session statistics on
+ * http://<host>:<service>/metrics in Prometheus text format, from the main
+ * loop of the server.
+ * ============================================================================
+ */
+int rtspmodule_serve_metrics (struct rtspmodule *rtsp, const char *service)
+{
+	if (rtsp->metrics)
+		return -1;
+
+	rtsp->metrics = httpmetrics_new(service, render_metrics, rtsp);
+	if ( !rtsp->metrics )
+		return -1;
+
+	return 0;
+}
+
+/* ============================================================================
+ * @Function: 	 rtspmodule_set_multicast
+ * @Description: Give every mount point added from now on a multicast group
+ * of range, with an RTP port from port_min..port_max. The shared media is
+ * sent to the group once, whatever the number of clients that SETUP a
+ * multicast transport; unicast clients are still served.
+ * ============================================================================
+ */
+int rtspmodule_set_multicast (struct rtspmodule *rtsp, const char *range,
+			      int port_min, int port_max, int ttl)
+{
+	struct mcastpool *pool;
+
+	pool = g_new0(struct mcastpool, 1);
+	if (mcastpool_init(pool, range, port_min, port_max, ttl) < 0) {
+		g_printerr("$$ Invalid multicast groups %s, ports %d-%d, ttl %d\n",
+				range, port_min, port_max, ttl);
+		g_free(pool);
+		return -1;
+	}
+
+	g_free(rtsp->mcast);
+	rtsp->mcast = pool;
+	return 0;
+}
+
+/* ============================================================================
+ * @Function: 	 rtspmodule_quit
+ * @Description: Make rtspmodule_run return, can be called from any thread.
+ * ============================================================================
+ */
+int rtspmodule_quit (struct rtspmodule *rtsp)
+{
+	g_main_loop_quit(rtsp->loop);
+	return 0;
+}
+
+/* ============================================================================
+ * @Function: 	 rtspmodule_destroy
+ * @Description: Free the server with all of its streams. The main loop must
+ * not be running anymore.
+ * ============================================================================
+ */
+void rtspmodule_destroy (struct rtspmodule *rtsp)
+{
+	GList *item;
+
+	if ( !rtsp )
+		return;
+
+	httpmetrics_free(rtsp->metrics);
+	for (item = rtsp->streams; item; item = item->next)
+		destroy_stream(item->data);
+	g_list_free(rtsp->streams);
+	g_free(rtsp->mcast);
+
+	/* the attached server holds a reference of its own, and the socket */
+	if (rtsp->cleanup_source)
+		g_source_remove(rtsp->cleanup_source);
+	if (rtsp->server_source)
+		g_source_remove(rtsp->server_source);
+
+	g_object_unref(rtsp->server);
+	g_main_loop_unref(rtsp->loop);
+	g_free(rtsp->service);
+	g_free(rtsp);
+}
+
+/* ============================================================================
+ * @Function: 	 destroy_stream
+ * @Description: Release everything a stream holds, frames still waiting are
+ * given back to their owners.
+ * ============================================================================
+ */
+static void destroy_stream (struct rtspmodule_stream *stream)
+{
+	GstRTSPMediaMapping *mapping;
+	GList *item;
+
+	mapping = gst_rtsp_server_get_media_mapping (stream->module->server);
+	for (item = stream->branches; item; item = item->next) {
+		struct stream_branch *branch = item->data;
+
+		if (branch->factory) {
+			gst_rtsp_media_mapping_remove_factory (mapping, branch->arguments.mount);
+			g_object_unref(branch->factory);
+		}
+		if (branch->bus_source)
+			g_source_remove(branch->bus_source);
+		if (branch->pipeline) {
+			gst_element_set_state(branch->pipeline, GST_STATE_NULL);
+			gst_object_unref(GST_OBJECT (branch->pipeline));
+		}
+		if (branch->ratectl_source)
+			g_source_remove(branch->ratectl_source);
+		if (branch->sendq_source) {
+			g_source_remove(branch->sendq_source);
+			unwrap_send_clients(branch);
+			forget_send_clients(branch, TRUE);
+		}
+		if (branch->rtcp_seen)
+			g_hash_table_destroy(branch->rtcp_seen);
+		framebox_flush(&branch->framebox);
+		metrics_counters_free(branch->counters);
+		metrics_counters_free(branch->udp_counters);
+		g_free(branch->mcast_group);
+		g_free(branch->arguments.mount);
+		g_free(branch);
+	}
+	g_object_unref (mapping);
+	g_list_free(stream->branches);
+
+	/* buffers still out would point into freed memory, leave the pool then */
+	if (g_atomic_int_get((gint *) &stream->pool.in_use) == 0)
+		framepool_destroy(&stream->pool);
+	else
+		g_printerr("$$ %u frame buffers still in use\n", stream->pool.in_use);
+
+	motion_free(&stream->motion);
+	g_free(stream->arguments.vencoder);
+	g_free(stream->arguments.rtpencoder);
+	g_free(stream->arguments.profile);
+	g_free(stream->arguments.informat);
+	g_free(stream->arguments.vformat);
+	g_free(stream);
+}
+
+
+/* ============================================================================
+ * @Function: 	 rtspmodule_stream_setdata
+ * @Description: Copy the input data to the buffer.
+ * ============================================================================
+ */
+int rtspmodule_stream_setdata (struct rtspmodule_stream *stream, char *data)
+{
+	struct rtspmodule_frame frame;
+
+	/* compressed frames vary in size, they come through setframe only */
+	if (stream->passthrough)
+		return -1;
+
+	frame.size = stream->datasize;
+	frame.timestamp = 0;
+	frame.sequence = stream->datasequence++;
+	frame.keyframe = 1;
+
+	/* converted into a pool buffer right away, no need for a copy */
+	if (stream->outformat) {
+		frame.data = data;
+		frame.release = data_keep;
+		frame.user_data = data;
+		return rtspmodule_stream_setframe(stream, &frame);
+	}
+
+	if ( !stream_pool(stream) )
+		return -1;
+	frame.data = framepool_get(&stream->pool);
+	if (!frame.data)
+		return -1;
+  	memcpy(frame.data, data, stream->datasize);
+	frame.release = framepool_release;
+	frame.user_data = frame.data;
+
+	return rtspmodule_stream_setframe(stream, &frame);
+}
+
+/* ============================================================================
+ * @Function: 	 rtspmodule_stream_setframe
+ * @Description: Hand the frame memory over to the pipeline without a copy.
+ * The frame is wrapped once and every branch gets a reference of it. When
+ * the stream converts the pixel format, the converted copy is wrapped instead
+ * and the frame is released right away. Never blocks; if a branch's appsrc
+ * is already waiting for data the frame is pushed right from here.
+ * ============================================================================
+ */
+int rtspmodule_stream_setframe (struct rtspmodule_stream *stream, struct rtspmodule_frame *data)
+{
+	struct rtspmodule_frame converted;
+
+	if (!data->data || data->size <= 0 || !data->release)
+		return -1;
+
+	if (stream->outformat) {
+		if (data->size < (int) stream->layout.size)
+			return -1;
+
+		if ( !stream_pool(stream) )
+			return -1;
+		converted = *data;
+		converted.data = framepool_get(&stream->pool);
+		if (!converted.data)
+			return -1;
+		converted.size = stream->outsize;
+		converted.release = framepool_release;
+		converted.user_data = converted.data;
+		yuvconv_frame(stream->informat, (const unsigned char *) data->data,
+				stream->layout.stride[0], stream->outformat,
+				(unsigned char *) converted.data,
+				stream->arguments.width, stream->arguments.height);
+
+		/* the capture buffer is free to go back to the driver */
+		data->release(data->user_data);
+		data = &converted;
+	}
+
+	return stream_put(stream, data, 0);
+}
+
+/* ============================================================================
+ * @Function: 	 rtspmodule_stream_setencoded
+ * @Description: Hand an access unit from an encoder outside GStreamer over to
+ * the payloader, no copy and no second encode. Decode time orders and paces
+ * the units like capture time does raw frames, the presentation time rides
+ * on top of it as an offset.
+ * ============================================================================
+ */
+int rtspmodule_stream_setencoded (struct rtspmodule_stream *stream, struct rtspmodule_encoded *au)
+{
+	struct rtspmodule_frame frame;
+
+	if (!stream->interframe) {
+		g_printerr("$$ %s stream takes no encoded access units\n", stream->arguments.informat);
+		return -1;
+	}
+
+	frame.data = au->data;
+	frame.size = au->size;
+	frame.timestamp = au->dts ? au->dts : monotonic_time();
+	frame.sequence = stream->datasequence++;
+	frame.keyframe = au->keyframe;
+	frame.release = au->release;
+	frame.user_data = au->user_data;
+
+	if (!frame.data || frame.size <= 0 || !frame.release)
+		return -1;
+
+	return stream_put(stream, &frame, au->pts ? (gint64) (au->pts - frame.timestamp) : 0);
+}
+
+/* ============================================================================
+ * @Function: 	 stream_put
+ * @Description: Wrap the frame once and queue a reference of it on every
+ * branch due for it.
+ * ============================================================================
+ */
+static int stream_put (struct rtspmodule_stream *stream, struct rtspmodule_frame *data,
+			gint64 pts_offset)
+{
+	struct framebox_frame frame, *ref;
+	GstBuffer *buffer;
+	gboolean discont;
+	GList *item;
+
+	/* frames lost in capture, tell the receivers */
+	discont = stream->have_sequence && data->sequence != stream->last_sequence + 1;
+	stream->last_sequence = data->sequence;
+	stream->have_sequence = TRUE;
+
+	ref = g_slice_new(struct framebox_frame);
+	ref->data = data->data;
+	ref->size = data->size;
+	ref->timestamp = data->timestamp ? data->timestamp : monotonic_time();
+	ref->sequence = data->sequence;
+	ref->pts_offset = pts_offset;
+	ref->keyframe = stream->passthrough ? data->keyframe : 1;
+	ref->release = data->release;
+	ref->user_data = data->user_data;
+	frametrace_stamp(FRAMETRACE_SETDATA, ref->timestamp, FRAMETRACE_TRACK_CAPTURE, 0);
+	metrics_add(METRICS_HANDOFF_FRAMES, 1);
+
+	/* before the branches decide whether they take the frame */
+	if (stream->motion_detect)
+		stream_motion(stream, data->data);
+
+	/* released with the last reference, whichever branch drops it */
+	buffer = gst_buffer_new();
+	GST_BUFFER_DATA (buffer) = (guint8 *) ref->data;
+	GST_BUFFER_SIZE (buffer) = ref->size;
+	GST_BUFFER_MALLOCDATA (buffer) = (guint8 *) ref;
+	GST_BUFFER_FREE_FUNC (buffer) = frame_release;
+
+	for (item = stream->branches; item; item = item->next) {
+		struct stream_branch *branch = item->data;
+
+		if (discont)
+			g_atomic_int_set(&branch->discont, 1);
+		if (g_atomic_int_get(&branch->failed) || !branch_takes(branch, ref->timestamp))
+			continue;
+
+		frame = *ref;
+		frame.release = buffer_release;
+		frame.user_data = gst_buffer_ref(buffer);
+		framebox_put(&branch->framebox, &frame);
+
+		/* need-data found the box empty, feed appsrc on its behalf */
+		if (g_atomic_int_get(&branch->starving))
+			branch_feed(branch);
+	}
+	gst_buffer_unref(buffer);
+
+	return 0;
+}
+
+/* ============================================================================
+ * @Function: 	 rtspmodule_stream_getstats
+ * @Description: Report the frame queue counters of the stream, summed over
+ * its branches.
+ * ============================================================================
+ */
+int rtspmodule_stream_getstats (struct rtspmodule_stream *stream, struct rtspmodule_stats *stats)
+{
+	GList *item;
+
+	memset(stats, 0, sizeof(*stats));
+	for (item = stream->branches; item; item = item->next) {
+		struct stream_branch *branch = item->data;
+
+		stats->producer_drops += g_atomic_int_get((gint *) &branch->framebox.producer_drops);
+		stats->consumer_drops += g_atomic_int_get((gint *) &branch->framebox.consumer_drops);
+		stats->underruns += g_atomic_int_get((gint *) &branch->underruns);
+		stats->keyframe_waits += g_atomic_int_get((gint *) &branch->keyframe_waits);
+		stats->udp_packets += metrics_value(branch->udp_counters, BRANCH_UDP_PACKETS);
+		stats->udp_calls += metrics_value(branch->udp_counters, BRANCH_UDP_CALLS);
+	}
+	stats->pool_buffers = stream->pool.count;
+	stats->pool_high_water = g_atomic_int_get((gint *) &stream->pool.high_water);
+	stats->pool_starvations = g_atomic_int_get((gint *) &stream->pool.starvations);
+
+	return 0;
+}
+
+/* ============================================================================
+ * @Function: 	 rtspmodule_stream_flush
+ * @Description: Give the frames waiting in every branch's queue back to their
+ * owners. Frames already pushed go back as the pipeline is done with them.
+ * ============================================================================
+ */
+int rtspmodule_stream_flush (struct rtspmodule_stream *stream)
+{
+	GList *item;
+
+	for (item = stream->branches; item; item = item->next) {
+		struct stream_branch *branch = item->data;
+
+		framebox_flush(&branch->framebox);
+	}
+
+	return 0;
+}
+
+/* ============================================================================
+ * @Function: 	 rtspmodule_stream_reformat
+ * @Description: Switch the stream to another capture size, line pitch or
+ * rate, keeping its pixel format and so every element of the pipelines. The
+ * appsrc caps change and the encoder follows on the next frame, which is
+ * made a keyframe; the connected sessions see a short glitch. Branches at
+ * the source size follow it, smaller ones keep theirs; branch rates are
+ * capped by the new source rate.
+ * ============================================================================
+ */
+int rtspmodule_stream_reformat (struct rtspmodule_stream *stream, int width, int height,
+				int stride, int gfps)
+{
+	struct rtspmodule_arguments *arguments = &stream->arguments;
+	struct pixfmt layout, packed;
+	guint outsize = 0;
+	GstCaps *caps;
+	GList *item;
+
+	if (gfps <= 0)
+		gfps = arguments->gfps;
+
+	if (pixfmt_fill(&layout, stream->informat, width, height, stride) < 0) {
+		g_printerr("$$ Cannot reformat %s to %dx%d (stride %d)\n",
+				arguments->informat, width, height, stride);
+		return -1;
+	}
+	if (stream->outformat) {
+		outsize = yuvconv_size(stream->outformat, width, height);
+		if (!outsize || (width & 1)) {
+			g_printerr("$$ Cannot convert %dx%d %s\n", width, height, arguments->informat);
+			return -1;
+		}
+	} else if (!stream->passthrough) {
+		pixfmt_fill(&packed, stream->informat, width, height, 0);
+		if (layout.stride[0] != GST_ROUND_UP_4 (packed.stride[0])) {
+			g_printerr("$$ %s lines of %u bytes need a vformat conversion\n",
+					arguments->informat, layout.stride[0]);
+			return -1;
+		}
+	}
+
+	/* frames waiting are of the old format */
+	rtspmodule_stream_flush(stream);
+
+	/* the pool buffers are too small, the new ones are allocated on first use */
+	if (stream->pool.mem && stream->pool.size < (outsize ? outsize : layout.size)) {
+		if ( !stream_pool_drain(stream) )
+			return -1;
+		framepool_destroy(&stream->pool);
+	}
+
+	for (item = stream->branches; item; item = item->next) {
+		struct stream_branch *branch = item->data;
+		struct rtspmodule_branch *output = &branch->arguments;
+
+		if (output->width == arguments->width && output->height == arguments->height) {
+			output->width = width;
+			output->height = height;
+		}
+		if (output->gfps == arguments->gfps || output->gfps > gfps)
+			output->gfps = gfps;
+		branch->next_due = 0;
+	}
+
+	arguments->width = width;
+	arguments->height = height;
+	arguments->stride = stride;
+	arguments->gfps = gfps;
+	stream->layout = layout;
+	stream->datasize = layout.size;
+	stream->outsize = outsize;
+
+	/* the first frame of the new size counts as motion */
+	if (arguments->motion_fps > 0 && !stream->passthrough) {
+		motion_free(&stream->motion);
+		stream_motion_init(stream);
+	}
+
+	for (item = stream->branches; item; item = item->next) {
+		struct stream_branch *branch = item->data;
+
+		/* compressed input resumes on the camera's next keyframe */
+		g_atomic_int_set(&branch->discont, 1);
+		caps = source_caps(branch);
+		g_object_set(G_OBJECT (branch->appsrc), "caps", caps, NULL);
+		gst_caps_unref(caps);
+		if (branch->venc)
+			force_keyframe(branch);
+
+		g_print("..%s reformatted to %dx%d@%d\n", branch->arguments.mount,
+				branch->arguments.width, branch->arguments.height,
+				branch->arguments.gfps);
+	}
+
+	return 0;
+}
+
+/* ============================================================================
+ * @Function: 	 rtspmodule_stream_set_motion_callback
+ * @Description: Be told when the stream's scene starts or stops moving. The
+ * callback runs in the thread handing the frames in and must not block it.
+ * ============================================================================
+ */
+int rtspmodule_stream_set_motion_callback (struct rtspmodule_stream *stream,
+				rtspmodule_motion_func callback, void *user_data)
+{
+	stream->motion_callback = callback;
+	stream->motion_data = user_data;
+
+	/* kept for a reformat that makes the frames fit the detector */
+	return stream->motion_detect ? 0 : -1;
+}
+
+/* ============================================================================
+ * @Function: 	 stream_motion_init
+ * @Description: Set the detector up for the frames put on the branches,
+ * converted ones when there is a conversion. The scene starts out moving.
+ * ============================================================================
+ */
+static void stream_motion_init (struct rtspmodule_stream *stream)
+{
+	struct rtspmodule_arguments *arguments = &stream->arguments;
+	int ret;
+
+	if (stream->outformat)
+		ret = motion_init(&stream->motion, stream->outformat, arguments->width,
+				  arguments->height, arguments->width);
+	else
+		ret = motion_init(&stream->motion, stream->informat, arguments->width,
+				  arguments->height, stream->layout.stride[0]);
+	if (ret < 0) {
+		g_printerr("$$ No motion detection on %dx%d %s\n", arguments->width,
+				arguments->height, arguments->informat);
+		stream->motion_detect = FALSE;
+		g_atomic_int_set(&stream->still, 0);
+		return;
+	}
+
+	if (arguments->motion_threshold > 0)
+		stream->motion.threshold = arguments->motion_threshold;
+	stream->motion_detect = TRUE;
+	stream->static_frames = 0;
+	g_atomic_int_set(&stream->still, 0);
+	g_print("..Motion detection (%s), %d fps while still\n", motion_name(),
+			arguments->motion_fps);
+}
+
+/* ============================================================================
+ * @Function: 	 stream_motion
+ * @Description: Compare the frame with the last one. A second of static
+ * frames slows the branches down; the first moving frame is taken by every
+ * branch and brings them back to full rate.
+ * ============================================================================
+ */
+static void stream_motion (struct rtspmodule_stream *stream, const char *data)
+{
+	guint blocks, still_after;
+	GList *item;
+
+	blocks = motion_detect(&stream->motion, (const unsigned char *) data);
+	still_after = MAX(stream->arguments.gfps, 1);
+
+	if (blocks >= stream->motion.min_blocks) {
+		stream->static_frames = 0;
+		if (!stream->still)
+			return;
+
+		for (item = stream->branches; item; item = item->next) {
+			struct stream_branch *branch = item->data;
+
+			branch->next_due = 0;
+		}
+		g_atomic_int_set(&stream->still, 0);
+		g_print("..Motion, %u blocks changed\n", blocks);
+		if (stream->motion_callback)
+			stream->motion_callback(1, blocks, stream->motion_data);
+		return;
+	}
+
+	if (stream->still || ++stream->static_frames < still_after)
+		return;
+
+	g_atomic_int_set(&stream->still, 1);
+	g_print("..Scene still, %d fps\n", stream->arguments.motion_fps);
+	if (stream->motion_callback)
+		stream->motion_callback(0, blocks, stream->motion_data);
+}
+
+/* ============================================================================
+ * @Function: 	 frame_release
+ * @Description: Free function of the wrapping GstBuffer, runs when the last
+ * reference is dropped and gives the frame memory back to its owner.
+ * ============================================================================
+ */
+static void frame_release (gpointer mem)
+{
+	struct framebox_frame *ref = (struct framebox_frame *) mem;
+
+	ref->release(ref->user_data);
+	g_slice_free(struct framebox_frame, ref);
+}
+
+static void buffer_release (void *buffer)
+{
+	gst_buffer_unref(GST_BUFFER_CAST (buffer));
+}
+
+static void data_keep (void *data)
+{
+}
+
+/* ============================================================================
+ * @Function: 	 stream_pool
+ * @Description: Allocate the stream's frame buffers on first use, sized for
+ * the converted frame when there is a conversion. Unless set, the count
+ * covers every branch's queue plus the frames held by appsrc and encoder.
+ * ============================================================================
+ */
+static gboolean stream_pool (struct rtspmodule_stream *stream)
+{
+	guint size, count, depth;
+
+	if (stream->pool.mem)
+		return TRUE;
+
+	size = stream->outformat ? stream->outsize : stream->datasize;
+	count = stream->arguments.pool_count;
+	if (count == 0) {
+		depth = stream->arguments.queue_depth ? stream->arguments.queue_depth
+						      : FRAMEBOX_DEFAULT_DEPTH;
+		count = g_list_length(stream->branches) * (depth + 2) + 1;
+		count = MIN(count, FRAMEPOOL_MAX_COUNT);
+	}
+
+	if (framepool_init(&stream->pool, size, count) < 0) {
+		g_printerr("$$ Failed to allocate %u frame buffers of %u bytes\n", count, size);
+		return FALSE;
+	}
+	g_print("..Frame pool: %u buffers of %u bytes\n", count, size);
+
+	return TRUE;
+}
+
+/* ============================================================================
+ * @Function: 	 stream_pool_drain
+ * @Description: Wait for the pipelines to give every pool buffer back, at
+ * most a second. The queues must be flushed, no new frame may come in.
+ * ============================================================================
+ */
+static gboolean stream_pool_drain (struct rtspmodule_stream *stream)
+{
+	guint in_use = 0;
+	int waited;
+
+	for (waited = 0; waited < 1000; waited += 5) {
+		in_use = g_atomic_int_get((gint *) &stream->pool.in_use);
+		if (in_use == 0)
+			return TRUE;
+		g_usleep(5000);
+	}
+
+	g_printerr("$$ %u frame buffers still in use, format kept\n", in_use);
+	return FALSE;
+}
+
+/* ============================================================================
+ * @Function: 	 branch_takes
+ * @Description: Frame rate decimation, TRUE when the frame captured at
+ * timestamp is due for a branch running at a lower rate than the source, or
+ * at motion_fps while the scene is still.
+ * ============================================================================
+ */
+static gboolean branch_takes (struct stream_branch *branch, guint64 timestamp)
+{
+	struct rtspmodule_stream *stream = branch->stream;
+	guint64 interval;
+	gint gfps;
+
+	gfps = branch->arguments.gfps;
+	if (stream->still && stream->arguments.motion_fps < gfps)
+		gfps = stream->arguments.motion_fps;
+	if (gfps >= stream->arguments.gfps)
+		return TRUE;
+
+	/* accept a frame slightly early, capture times jitter */
+	interval = GST_SECOND / gfps;
+	if (timestamp + interval / 4 < branch->next_due)
+		return FALSE;
+
+	branch->next_due += interval;
+	if (branch->next_due + interval < timestamp)
+		branch->next_due = timestamp + interval;
+
+	return TRUE;
+}
+
+
+/* ============================================================================
+ * @Function: 	 cb_need_data
+ * @Description: This callback function feed GST pipeline with video frame.
+ * ============================================================================
+ */
+static void cb_need_data (GstElement *appsrc, guint unused_size, gpointer user_data)
+{
+	struct stream_branch *branch = (struct stream_branch *) user_data;
+
+	/* Nothing captured yet, do not block the streaming thread here. The next
+	 * rtspmodule_stream_setframe() sees the flag and pushes the frame itself. */
+	g_atomic_int_set(&branch->starving, 1);
+	branch_feed(branch);
+	if (g_atomic_int_get(&branch->starving))
+		g_atomic_int_inc((gint *) &branch->underruns);
+}
+
+/* ============================================================================
+ * @Function: 	 branch_feed
+ * @Description: Push waiting frames while appsrc is starving, from need-data
+ * or the capture thread. Whichever side takes the push pushes for both, so
+ * the frames reach appsrc in order and push_frame never runs twice at once;
+ * the other side returns. The capture thread is the only producer: a frame
+ * it put while need-data held the push is looked for once it is let go.
+ * ============================================================================
+ */
+static void branch_feed (struct stream_branch *branch)
+{
+	struct framebox_frame frame;
+
+	while (g_atomic_int_get(&branch->starving) &&
+	       g_atomic_int_compare_and_exchange(&branch->pushing, 0, 1)) {
+		while (g_atomic_int_get(&branch->starving) &&
+		       framebox_get(&branch->framebox, &frame) == 0) {
+			/* cleared first, appsrc may ask again from inside the push */
+			g_atomic_int_set(&branch->starving, 0);
+			if (!push_frame(branch, &frame))
+				g_atomic_int_set(&branch->starving, 1);
+		}
+		g_atomic_int_set(&branch->pushing, 0);
+
+		if (!framebox_pending(&branch->framebox))
+			break;
+	}
+}
+
+/* ============================================================================
+ * @Function: 	 push_frame
+ * @Description: Push the frame into the appsrc of the branch. The buffer is
+ * shared with the other branches, so this branch's timing goes on a
+ * sub-buffer referencing the same memory. Returns FALSE when the frame was
+ * dropped instead, a compressed delta frame following a gap.
+ * ============================================================================
+ */
+static gboolean push_frame (struct stream_branch *branch, struct framebox_frame *frame)
+{
+	GstFlowReturn ret;
+	GstBuffer *parent, *buffer;
+	guint drops;
+
+	parent = GST_BUFFER_CAST (frame->user_data);
+
+	/* frames lost in capture or dropped on the way, tell the receivers */
+	drops = g_atomic_int_get((gint *) &branch->framebox.producer_drops) +
+		g_atomic_int_get((gint *) &branch->framebox.consumer_drops);
+	if (g_atomic_int_compare_and_exchange(&branch->discont, 1, 0) ||
+	    drops != branch->seen_drops)
+		branch->resync = TRUE;
+	branch->seen_drops = drops;
+
+	/* past a gap an inter-coded stream can only resume on a keyframe */
+	if (branch->resync && branch->stream->interframe && !frame->keyframe) {
+		gst_buffer_unref(parent);
+		g_atomic_int_inc((gint *) &branch->keyframe_waits);
+		return FALSE;
+	}
+
+	buffer = gst_buffer_create_sub(parent, 0, GST_BUFFER_SIZE (parent));
+	gst_buffer_unref(parent);
+
+	/* reordered (B) frames present later than they decode */
+	GST_BUFFER_TIMESTAMP (buffer) = frame_pts(branch, frame);
+	if (frame->pts_offset > 0)
+		GST_BUFFER_TIMESTAMP (buffer) += frame->pts_offset;
+	GST_BUFFER_DURATION (buffer) = gst_util_uint64_scale_int (1, GST_SECOND, branch->arguments.gfps);
+
+	if (branch->resync) {
+		GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_DISCONT);
+		branch->resync = FALSE;
+	}
+	if (!frame->keyframe)
+		GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+
+	/* the probes find the capture time again by pts */
+	if (branch->trace_track) {
+		struct branch_trace *trace;
+
+		trace = &branch->trace[branch->trace_next % BRANCH_TRACE_FRAMES];
+		trace->key = frame->timestamp;
+		trace->pts = GST_BUFFER_TIMESTAMP (buffer);
+		branch->trace_next++;
+	}
+
+	g_signal_emit_by_name (branch->appsrc, "push-buffer", buffer, &ret);
+	gst_buffer_unref(buffer);
+
+	if (ret != GST_FLOW_OK && ret != GST_FLOW_WRONG_STATE) {
+		/* something wrong, stop feeding this branch, the others go on */
+		if (g_atomic_int_compare_and_exchange(&branch->failed, 0, 1))
+			g_printerr("$$ %s stopped, push-buffer returned %s\n",
+					branch->arguments.mount, gst_flow_get_name(ret));
+	} else if (ret == GST_FLOW_OK && branch->trace_track)
+		frametrace_stamp(FRAMETRACE_PUSH, frame->timestamp, branch->trace_track, 0);
+
+	return TRUE;
+}
+
+
+/* ============================================================================
+ * @Function: 	 frame_pts
+ * @Description: Map the capture time of the frame onto the pipeline clock,
+ * i.e. the running time at which the frame was captured.
+ * ============================================================================
+ */
+static GstClockTime frame_pts (struct stream_branch *branch, struct framebox_frame *frame)
+{
+	GstClock *clock;
+	GstClockTime running, age, pts;
+	guint64 now;
+
+	now = monotonic_time();
+	age = now > frame->timestamp ? now - frame->timestamp : 0;
+
+	clock = gst_element_get_clock(branch->appsrc);
+	if (clock) {
+		running = gst_clock_get_time(clock) - gst_element_get_base_time(branch->appsrc);
+		gst_object_unref(clock);
+		pts = running > age ? running - age : 0;
+	} else {
+		/* not playing yet, keep the capture spacing */
+		if (!branch->first_capture)
+			branch->first_capture = frame->timestamp;
+		pts = frame->timestamp - branch->first_capture;
+	}
+
+	/* never go backwards */
+	if (pts < branch->last_pts)
+		pts = branch->last_pts;
+	branch->last_pts = pts;
+
+	return pts;
+}
+
+/* ============================================================================
+ * @Function: 	 monotonic_time
+ * @Description: CLOCK_MONOTONIC in ns, the clock frames are stamped with.
+ * ============================================================================
+ */
+static guint64 monotonic_time (void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (guint64) ts.tv_sec * GST_SECOND + ts.tv_nsec;
+}
+
+
+/* ============================================================================
+ * @Function: 	 cb_count_encoded
+ * @Description: Payloader input pad probe, counts the encoded frames and
+ * bytes of the branch. Runs in the branch's streaming thread only.
+ * ============================================================================
+ */
+static gboolean cb_count_encoded (GstPad *pad, GstBuffer *buffer, gpointer user_data)
+{
+	struct stream_branch *branch = (struct stream_branch *) user_data;
+
+	metrics_count(branch->counters, BRANCH_ENCODED_FRAMES, 1);
+	metrics_count(branch->counters, BRANCH_ENCODED_BYTES, GST_BUFFER_SIZE (buffer));
+	return TRUE;
+}
+
+/* ============================================================================
+ * @Function: 	 cb_media_configure
+ * @Description: The shared media of a branch is made, its UDP sinks come
+ * with the prepare.
+ * ============================================================================
+ */
+static void cb_media_configure (GstRTSPMediaFactory *factory, GstRTSPMedia *media,
+				gpointer user_data)
+{
+	g_signal_connect(media, "prepared", G_CALLBACK (cb_media_prepared), user_data);
+}
+
+/* ============================================================================
+ * @Function: 	 cb_media_prepared
+ * @Description: Watch the RTP sink of the media for clients being added, on
+ * their PLAY request, and removed.
+ * ============================================================================
+ */
+static void cb_media_prepared (GstRTSPMedia *media, gpointer user_data)
+{
+	struct stream_branch *branch = (struct stream_branch *) user_data;
+	guint i;
+
+	for (i = 0; media->streams && i < media->streams->len; i++) {
+		GstRTSPMediaStream *mstream = g_array_index(media->streams, GstRTSPMediaStream *, i);
+
+		if (!mstream || !mstream->udpsink[0] || !mstream->udpsink[1])
+			continue;
+		udp_attach(branch, mstream);
+		if (branch->mcast_group)
+			mcast_setup(branch, mstream);
+		g_signal_connect(mstream->udpsink[0], "client-added",
+				G_CALLBACK (cb_client_added), user_data);
+		g_signal_connect(mstream->udpsink[0], "client-removed",
+				G_CALLBACK (cb_client_removed), user_data);
+	}
+}
+
+/* ============================================================================
+ * @Function: 	 mcast_setup
+ * @Description: Ready the UDP sinks of the media stream for the branch's
+ * group. The group is not added here: the media adds it, RTCP on the next
+ * port, on the PLAY of the first client with a multicast transport, only
+ * counts the clients after it on the same port, and removes it when the
+ * last one leaves. Nothing goes to the group while nobody watches.
+ * ============================================================================
+ */
+static void mcast_setup (struct stream_branch *branch, GstRTSPMediaStream *mstream)
+{
+	guint ttl = branch->stream->module->mcast->ttl;
+	gint i;
+
+	for (i = 0; i < 2; i++) {
+		GstElement *sink = mstream->udpsink[i];
+		GObjectClass *klass = G_OBJECT_GET_CLASS (sink);
+
+		if (g_object_class_find_property(klass, "ttl-mc"))
+			g_object_set(G_OBJECT (sink), "ttl-mc", ttl, NULL);
+
+		/* the sockets are shared with the receiving side: none of our own
+		 * packets back, only the viewers' RTCP needs the group joined */
+		if (g_object_class_find_property(klass, "loop"))
+			g_object_set(G_OBJECT (sink), "loop", FALSE, NULL);
+		if (i == 0 && g_object_class_find_property(klass, "auto-multicast"))
+			g_object_set(G_OBJECT (sink), "auto-multicast", FALSE, NULL);
+	}
+}
+
+/* ============================================================================
+ * @Function: 	 cb_client_added
+ * @Description: A client joins the shared media mid-stream. The encoder is
+ * asked for a keyframe so it can decode without waiting for the next GOP,
+ * which is cut short only when someone joins. Pass-through branches and
+ * clients over TCP, not seen here, wait for the next keyframe.
+ * ============================================================================
+ */
+static void cb_client_added (GstElement *udpsink, gchar *host, gint port, gpointer user_data)
+{
+	struct stream_branch *branch = (struct stream_branch *) user_data;
+
+	/* a group joined on another port costs a second copy of the stream */
+	if (g_strcmp0(host, branch->mcast_group) == 0) {
+		if (port != branch->mcast_port)
+			g_printerr("$$ %s multicast client on port %d rather than %d, sent twice\n",
+					branch->arguments.mount, port, branch->mcast_port);
+		g_print("..%s multicast to %s:%d joined\n", branch->arguments.mount,
+				host, port);
+		if (branch->venc)
+			force_keyframe(branch);
+		return;
+	}
+
+	if (branch->venc) {
+		force_keyframe(branch);
+		g_print("..%s joined by %s:%d, keyframe forced\n", branch->arguments.mount,
+				host, port);
+	}
+}
+
+/* ============================================================================
+ * @Function: 	 cb_client_removed
+ * @Description: The last client of a destination has left. For the group,
+ * the media stops sending to it and leaves it.
+ * ============================================================================
+ */
+static void cb_client_removed (GstElement *udpsink, gchar *host, gint port, gpointer user_data)
+{
+	struct stream_branch *branch = (struct stream_branch *) user_data;
+
+	if (g_strcmp0(host, branch->mcast_group) != 0)
+		return;
+	g_print("..%s multicast to %s:%d stopped, the last client left\n",
+			branch->arguments.mount, host, port);
+}
+
+/* ============================================================================
+ * @Function: 	 udp_attach
+ * @Description: Follow the UDP clients of the media stream's RTP sink and
+ * take its packets on their way in. With send_batch the sink is left
+ * nothing to send: the packets of a frame go out together, from the sink's
+ * own socket, right after its last one. Without, they are only counted.
+ * Runs before any client is added, the multicast group included.
+ * ============================================================================
+ */
+static void udp_attach (struct stream_branch *branch, GstRTSPMediaStream *mstream)
+{
+	GstElement *sink = mstream->udpsink[0];
+	struct udp_batch *udp;
+	GstPad *pad;
+	gint sock = -1, ret;
+
+	pad = gst_element_get_static_pad(sink, "sink");
+	if (!pad)
+		return;
+
+	udp = g_new0(struct udp_batch, 1);
+	udp->branch = branch;
+	g_object_get(sink, "sock", &sock, NULL);
+	ret = rtpbatch_init(&udp->batch, sock, branch->stream->arguments.send_batch);
+	if (ret < 0) {
+		g_printerr("$$ RTP of %s not followed on socket %d (%d)\n",
+				branch->arguments.mount, sock, ret);
+		g_free(udp);
+		gst_object_unref(pad);
+		return;
+	}
+
+	if (udp->batch.batch) {
+		/* no buffer reaches the sink, it must not wait for one to preroll */
+		if (g_object_class_find_property(G_OBJECT_GET_CLASS (sink), "async"))
+			g_object_set(G_OBJECT (sink), "async", FALSE, NULL);
+		g_print("..%s RTP sent a frame per call%s\n", branch->arguments.mount,
+				udp->batch.gso ? ", UDP GSO" : "");
+	}
+
+	g_object_set_data_full(G_OBJECT (sink), UDP_BATCH_KEY, udp, udp_batch_free);
+	g_signal_connect(sink, "client-added", G_CALLBACK (cb_udp_added), udp);
+	g_signal_connect(sink, "client-removed", G_CALLBACK (cb_udp_removed), udp);
+	gst_pad_add_buffer_probe(pad, G_CALLBACK (cb_udp_packet), udp);
+	gst_object_unref(pad);
+}
+
+/* ============================================================================
+ * @Function: 	 udp_batch_free
+ * @Description: The sink is finalized, its streaming thread is gone.
+ * ============================================================================
+ */
+static void udp_batch_free (gpointer data)
+{
+	struct udp_batch *udp = (struct udp_batch *) data;
+
+	rtpbatch_free(&udp->batch);
+	g_free(udp);
+}
+
+/* ============================================================================
+ * @Function: 	 cb_udp_added
+ * @Description: The sink sends to one more client, in the main loop like
+ * every change of its clients.
+ * ============================================================================
+ */
+static void cb_udp_added (GstElement *udpsink, gchar *host, gint port, gpointer user_data)
+{
+	struct udp_batch *udp = (struct udp_batch *) user_data;
+	gint ret;
+
+	ret = rtpbatch_add(&udp->batch, host, port);
+	if (ret < 0 && udp->batch.batch)
+		g_printerr("$$ %s:%d not batched (%d), %s sent by udpsink meanwhile\n",
+				host, port, ret, udp->branch->arguments.mount);
+}
+
+/* ============================================================================
+ * @Function: 	 cb_udp_removed
+ * @Description: The sink has dropped its last reference to a client. It
+ * tells of every add but only of that remove, so the destination goes
+ * whatever the references of the batch.
+ * ============================================================================
+ */
+static void cb_udp_removed (GstElement *udpsink, gchar *host, gint port, gpointer user_data)
+{
+	struct udp_batch *udp = (struct udp_batch *) user_data;
+
+	rtpbatch_remove(&udp->batch, host, port, 1);
+}
+
+/* ============================================================================
+ * @Function: 	 cb_udp_packet
+ * @Description: An RTP packet on its way into the sink, in the sink's
+ * streaming thread. A packet the batch takes does not reach the sink.
+ * ============================================================================
+ */
+static gboolean cb_udp_packet (GstPad *pad, GstBuffer *buffer, gpointer user_data)
+{
+	struct udp_batch *udp = (struct udp_batch *) user_data;
+	struct rtpbatch *batch = &udp->batch;
+	gboolean taken;
+
+	taken = rtpbatch_push(batch, GST_BUFFER_DATA (buffer), GST_BUFFER_SIZE (buffer)) > 0;
+
+	metrics_count(udp->branch->udp_counters, BRANCH_UDP_PACKETS, batch->sent - udp->packets);
+	metrics_count(udp->branch->udp_counters, BRANCH_UDP_CALLS, batch->calls - udp->calls);
+	udp->packets = batch->sent;
+	udp->calls = batch->calls;
+
+	if (batch->errors && !udp->failed) {
+		g_printerr("$$ RTP of %s refused by the socket: %s\n", udp->branch->arguments.mount,
+				g_strerror(batch->last_error));
+		udp->failed = TRUE;
+	}
+
+	return !taken;
+}
+
+/* ============================================================================
+ * @Function: 	 render_metrics
+ * @Description: Metrics page, Prometheus text format. Runs in the main loop
+ * and only reads counters, the capture and streaming threads never wait on it.
+ * ============================================================================
+ */
+static void render_metrics (GString *out, gpointer user_data)
+{
+	struct rtspmodule *rtsp = (struct rtspmodule *) user_data;
+	GList *item;
+	gchar *labels;
+
+	httpmetrics_header(out, "bbwatch_capture_frames_total", "counter",
+			"Frames dequeued from the capture driver.");
+	httpmetrics_value(out, "bbwatch_capture_frames_total", NULL,
+			metrics_read(METRICS_CAPTURE_FRAMES));
+	httpmetrics_header(out, "bbwatch_capture_bytes_total", "counter",
+			"Bytes of the frames dequeued from the capture driver.");
+	httpmetrics_value(out, "bbwatch_capture_bytes_total", NULL,
+			metrics_read(METRICS_CAPTURE_BYTES));
+	httpmetrics_header(out, "bbwatch_capture_lost_frames_total", "counter",
+			"Frames dropped by the capture driver, gaps in its sequence numbers.");
+	httpmetrics_value(out, "bbwatch_capture_lost_frames_total", NULL,
+			metrics_read(METRICS_CAPTURE_LOST));
+	httpmetrics_header(out, "bbwatch_capture_starvations_total", "counter",
+			"Times the capture driver had no free buffer queued.");
+	httpmetrics_value(out, "bbwatch_capture_starvations_total", NULL,
+			metrics_read(METRICS_CAPTURE_STARVATIONS));
+	httpmetrics_header(out, "bbwatch_handoff_frames_total", "counter",
+			"Frames handed over to the streaming side.");
+	httpmetrics_value(out, "bbwatch_handoff_frames_total", NULL,
+			metrics_read(METRICS_HANDOFF_FRAMES));
+
+	render_branches(out, rtsp, "bbwatch_queue_depth", "gauge",
+			"Frames waiting for the encoder.", METRIC_QUEUE_DEPTH);
+	render_branches(out, rtsp, "bbwatch_queue_producer_drops_total", "counter",
+			"Frames dropped on handoff, queue full.", METRIC_PRODUCER_DROPS);
+	render_branches(out, rtsp, "bbwatch_queue_consumer_drops_total", "counter",
+			"Frames skipped by the encoder side, a newer one was waiting.",
+			METRIC_CONSUMER_DROPS);
+	render_branches(out, rtsp, "bbwatch_queue_underruns_total", "counter",
+			"Times the encoder side found no frame waiting.", METRIC_UNDERRUNS);
+	render_branches(out, rtsp, "bbwatch_queue_keyframe_waits_total", "counter",
+			"Compressed frames skipped until a keyframe.", METRIC_KEYFRAME_WAITS);
+	render_branches(out, rtsp, "bbwatch_encoded_frames_total", "counter",
+			"Encoded frames handed to the payloader.", METRIC_ENCODED_FRAMES);
+	render_branches(out, rtsp, "bbwatch_encoded_bytes_total", "counter",
+			"Encoded bytes handed to the payloader, the output bitrate.",
+			METRIC_ENCODED_BYTES);
+	render_branches(out, rtsp, "bbwatch_encoder_bitrate_kbps", "gauge",
+			"Bitrate the encoder is set to, moved by the rate control.",
+			METRIC_ENCODER_BITRATE);
+	render_branches(out, rtsp, "bbwatch_udp_packets_total", "counter",
+			"RTP packets sent over UDP, once per client.", METRIC_UDP_PACKETS);
+	render_branches(out, rtsp, "bbwatch_udp_send_calls_total", "counter",
+			"System calls the RTP packets over UDP took.", METRIC_UDP_CALLS);
+
+	/* pools belong to streams, named by their first mount point */
+	httpmetrics_header(out, "bbwatch_pool_buffers_in_use", "gauge",
+			"Frame buffers of the stream in use.");
+	for (item = rtsp->streams; item; item = item->next) {
+		struct rtspmodule_stream *stream = item->data;
+		struct stream_branch *branch = stream->branches ? stream->branches->data : NULL;
+
+		if (!branch)
+			continue;
+		labels = g_strdup_printf("mount=\"%s\"", branch->arguments.mount);
+		httpmetrics_value(out, "bbwatch_pool_buffers_in_use", labels,
+				g_atomic_int_get((gint *) &stream->pool.in_use));
+		g_free(labels);
+	}
+	httpmetrics_header(out, "bbwatch_pool_starvations_total", "counter",
+			"Frames dropped, no free frame buffer.");
+	for (item = rtsp->streams; item; item = item->next) {
+		struct rtspmodule_stream *stream = item->data;
+		struct stream_branch *branch = stream->branches ? stream->branches->data : NULL;
+
+		if (!branch)
+			continue;
+		labels = g_strdup_printf("mount=\"%s\"", branch->arguments.mount);
+		httpmetrics_value(out, "bbwatch_pool_starvations_total", labels,
+				g_atomic_int_get((gint *) &stream->pool.starvations));
+		g_free(labels);
+	}
+	httpmetrics_header(out, "bbwatch_scene_still", "gauge",
+			"1 while the scene is static and encoded at the reduced rate.");
+	for (item = rtsp->streams; item; item = item->next) {
+		struct rtspmodule_stream *stream = item->data;
+		struct stream_branch *branch = stream->branches ? stream->branches->data : NULL;
+
+		if (!branch || !stream->motion_detect)
+			continue;
+		labels = g_strdup_printf("mount=\"%s\"", branch->arguments.mount);
+		httpmetrics_value(out, "bbwatch_scene_still", labels,
+				g_atomic_int_get(&stream->still));
+		g_free(labels);
+	}
+
+	render_sessions(out, rtsp);
+}
+
+/* ============================================================================
+ * @Function: 	 render_branches
+ * @Description: One metric family with a sample per encoder branch.
+ * ============================================================================
+ */
+static void render_branches (GString *out, struct rtspmodule *rtsp, const char *name,
+			     const char *type, const char *help, int which)
+{
+	GList *item, *bitem;
+	gchar *labels;
+	guint64 value;
+
+	httpmetrics_header(out, name, type, help);
+	for (item = rtsp->streams; item; item = item->next) {
+		struct rtspmodule_stream *stream = item->data;
+
+		for (bitem = stream->branches; bitem; bitem = bitem->next) {
+			struct stream_branch *branch = bitem->data;
+			struct framebox *box = &branch->framebox;
+
+			switch (which) {
+			case METRIC_QUEUE_DEPTH:
+				value = (guint) (g_atomic_int_get((gint *) &box->tail) -
+						 g_atomic_int_get((gint *) &box->head));
+				break;
+			case METRIC_PRODUCER_DROPS:
+				value = g_atomic_int_get((gint *) &box->producer_drops);
+				break;
+			case METRIC_CONSUMER_DROPS:
+				value = g_atomic_int_get((gint *) &box->consumer_drops);
+				break;
+			case METRIC_UNDERRUNS:
+				value = g_atomic_int_get((gint *) &branch->underruns);
+				break;
+			case METRIC_KEYFRAME_WAITS:
+				value = g_atomic_int_get((gint *) &branch->keyframe_waits);
+				break;
+			case METRIC_ENCODED_FRAMES:
+				value = metrics_value(branch->counters, BRANCH_ENCODED_FRAMES);
+				break;
+			case METRIC_ENCODED_BYTES:
+				value = metrics_value(branch->counters, BRANCH_ENCODED_BYTES);
+				break;
+			case METRIC_UDP_PACKETS:
+				value = metrics_value(branch->udp_counters, BRANCH_UDP_PACKETS);
+				break;
+			case METRIC_UDP_CALLS:
+				value = metrics_value(branch->udp_counters, BRANCH_UDP_CALLS);
+				break;
+			case METRIC_ENCODER_BITRATE:
+			default:
+				value = branch->ratectl_source ? branch->ratectl.bitrate :
+						(guint) branch->arguments.gbitrate;
+				break;
+			}
+
+			labels = g_strdup_printf("mount=\"%s\"", branch->arguments.mount);
+			httpmetrics_value(out, name, labels, value);
+			g_free(labels);
+		}
+	}
+}
 
-#include <stdio.h>
-#include <gst/gst.h>
-#include <gst/rtsp-server/rtsp-server.h>
-#include <glib.h>
-#include <time.h>
-#include <string.h>
-#include <semaphore.h>
-#include "rtspmedia.h"
-#include "rtspmodule.h"
+/* ============================================================================
+ * @Function: 	 render_sessions
+ * @Description: Connected RTSP sessions, and per session stream the bytes
+ * sent to it (UDP) and the loss it reports in its RTCP receiver reports.
+ * ============================================================================
+ */
+static void render_sessions (GString *out, struct rtspmodule *rtsp)
+{
+	GstRTSPSessionPool *pool;
+	GList *sessions, *item, *mitem;
+	GString *sent, *packets, *fraction, *lost, *jitter, *dropped, *frames, *backlog;
+	guint i, count;
 
-static GMainLoop  *loop;
-static GstBuffer  *databuffer;
-static char *inputdatabuffer;
-static guint datasize;
-static GstElement *pipeline;
+	pool = gst_rtsp_server_get_session_pool(rtsp->server);
+	count = gst_rtsp_session_pool_get_n_sessions(pool);
+	sessions = gst_rtsp_session_pool_filter(pool, NULL, NULL);
+	g_object_unref(pool);
 
-static GstRTSPServer *server;
-static GstRTSPMediaMapping *mapping;
-static GstRTSPMediaFactory *factory;
+	httpmetrics_header(out, "bbwatch_rtsp_sessions", "gauge", "Connected RTSP sessions.");
+	httpmetrics_value(out, "bbwatch_rtsp_sessions", NULL, count);
 
-static gboolean cleanup_timeout(GstRTSPServer * server, gboolean ignored);
-static gboolean bus_watch(GstBus *bus, GstMessage *msg, gpointer data);
-static void cb_need_data (GstElement *appsrc, guint unused_size, gpointer user_data);
-static GstElement* construct_app_pipeline(void);
+	/* samples go out grouped by family, collected in one pass */
+	sent = g_string_new(NULL);
+	packets = g_string_new(NULL);
+	fraction = g_string_new(NULL);
+	lost = g_string_new(NULL);
+	jitter = g_string_new(NULL);
+	dropped = g_string_new(NULL);
+	frames = g_string_new(NULL);
+	backlog = g_string_new(NULL);
+
+	for (item = sessions; item; item = item->next) {
+		GstRTSPSession *session = item->data;
+
+		for (mitem = session->medias; mitem; mitem = mitem->next) {
+			GstRTSPSessionMedia *media = mitem->data;
+
+			for (i = 0; media->streams && i < media->streams->len; i++) {
+				GstRTSPSessionStream *sstream;
+				GstRTSPTransport *transport;
+				GValueArray *stats = NULL;
+				struct session_rtcp rtcp;
+				struct send_client *sc;
+				gchar *labels;
+
+				sstream = g_array_index(media->streams, GstRTSPSessionStream *, i);
+				if (!sstream || !sstream->trans.transport)
+					continue;
+				transport = sstream->trans.transport;
+				labels = g_strdup_printf("session=\"%s\",mount=\"%s\",stream=\"%u\"",
+						session->sessionid,
+						media->url ? media->url->abspath : "", i);
+
+				/* per destination counters of the shared udpsink, or of the
+				 * batch sending in its place */
+				if (transport->lower_transport != GST_RTSP_LOWER_TRANS_TCP &&
+				    sstream->media_stream && sstream->media_stream->udpsink[0]) {
+					GObject *sink = G_OBJECT (sstream->media_stream->udpsink[0]);
+					struct udp_batch *udp = g_object_get_data(sink, UDP_BATCH_KEY);
+					unsigned long long npackets, nbytes;
+
+					if (!udp || !udp->batch.batch)
+						g_signal_emit_by_name(sink, "get-stats", transport->destination,
+								transport->client_port.min, &stats);
+					else if (rtpbatch_stats(&udp->batch, transport->destination,
+								transport->client_port.min,
+								&npackets, &nbytes) == 0) {
+						httpmetrics_value(sent, "bbwatch_session_sent_bytes_total",
+								labels, nbytes);
+						httpmetrics_value(packets, "bbwatch_session_sent_packets_total",
+								labels, npackets);
+					}
+				}
+				if (stats && stats->n_values >= 2) {
+					httpmetrics_value(sent, "bbwatch_session_sent_bytes_total", labels,
+						g_value_get_uint64(g_value_array_get_nth(stats, 0)));
+					httpmetrics_value(packets, "bbwatch_session_sent_packets_total", labels,
+						g_value_get_uint64(g_value_array_get_nth(stats, 1)));
+				}
+				if (stats)
+					g_value_array_free(stats);
+
+				/* last receiver report of the client */
+				if (session_rtcp(sstream, &rtcp)) {
+					httpmetrics_value_double(fraction, "bbwatch_session_rtcp_fraction_lost",
+							labels, rtcp.fraction_lost / 256.0);
+					httpmetrics_value_double(lost, "bbwatch_session_rtcp_packets_lost",
+							labels, rtcp.packets_lost);
+					httpmetrics_value(jitter, "bbwatch_session_rtcp_jitter", labels,
+							rtcp.jitter);
+				}
 
-static struct rtspmodule_arguments arguments;
+				/* send queue of a TCP client, updated by the streaming thread */
+				sc = send_client_of(sstream);
+				if (sc) {
+					httpmetrics_value(dropped, "bbwatch_session_dropped_packets_total",
+						labels, g_atomic_int_get((gint *) &sc->queue.dropped_packets));
+					httpmetrics_value(frames, "bbwatch_session_dropped_frames_total",
+						labels, g_atomic_int_get((gint *) &sc->queue.dropped_frames));
+					httpmetrics_value(backlog, "bbwatch_session_send_backlog_bytes",
+						labels, g_atomic_int_get((gint *) &sc->queue.backlog));
+				}
+				g_free(labels);
+			}
+		}
+		g_object_unref(session);
+	}
+	g_list_free(sessions);
+
+	httpmetrics_header(out, "bbwatch_session_sent_bytes_total", "counter",
+			"RTP bytes sent to the session over UDP.");
+	g_string_append_len(out, sent->str, sent->len);
+	httpmetrics_header(out, "bbwatch_session_sent_packets_total", "counter",
+			"RTP packets sent to the session over UDP.");
+	g_string_append_len(out, packets->str, packets->len);
+	httpmetrics_header(out, "bbwatch_session_rtcp_fraction_lost", "gauge",
+			"Fraction of packets lost, last RTCP receiver report of the session.");
+	g_string_append_len(out, fraction->str, fraction->len);
+	httpmetrics_header(out, "bbwatch_session_rtcp_packets_lost", "gauge",
+			"Cumulative packets lost, last RTCP receiver report of the session.");
+	g_string_append_len(out, lost->str, lost->len);
+	httpmetrics_header(out, "bbwatch_session_rtcp_jitter", "gauge",
+			"Interarrival jitter in RTP clock units, last RTCP receiver report.");
+	g_string_append_len(out, jitter->str, jitter->len);
+	httpmetrics_header(out, "bbwatch_session_dropped_packets_total", "counter",
+			"RTP packets dropped by the send queue of the TCP session.");
+	g_string_append_len(out, dropped->str, dropped->len);
+	httpmetrics_header(out, "bbwatch_session_dropped_frames_total", "counter",
+			"Frames dropped by the send queue of the TCP session.");
+	g_string_append_len(out, frames->str, frames->len);
+	httpmetrics_header(out, "bbwatch_session_send_backlog_bytes", "gauge",
+			"Bytes the TCP session had not taken, at its last frame.");
+	g_string_append_len(out, backlog->str, backlog->len);
+
+	g_string_free(sent, TRUE);
+	g_string_free(packets, TRUE);
+	g_string_free(fraction, TRUE);
+	g_string_free(lost, TRUE);
+	g_string_free(jitter, TRUE);
+	g_string_free(dropped, TRUE);
+	g_string_free(frames, TRUE);
+	g_string_free(backlog, TRUE);
+}
 
 /* ============================================================================
- * @Function: 	 rtspmodule_init
- * @Description: Initialize GST Application interface.
+ * @Function: 	 session_rtcp
+ * @Description: Last RTCP receiver report of a session stream, FALSE while
+ * the client has sent none.
  * ============================================================================
  */
-int rtspmodule_init (struct rtspmodule_arguments *arg)
+static gboolean session_rtcp (GstRTSPSessionStream *sstream, struct session_rtcp *rtcp)
 {
-	guint major, minor, micro, nano;
-	GstBus  *bus;
+	GstStructure *stats = NULL;
+	gboolean have_rb = FALSE;
 
-	/* Settings - Encoder and Streaming */
-	arguments.width = arg->width;
-	arguments.height = arg->height;
-	arguments.gfps = arg->gfps;
-	arguments.gbitrate = arg->gbitrate;
-	arguments.gmtu = arg->gmtu;
-	arguments.vsrc = arg->vsrc;
-	arguments.vencoder = g_strdup(arg->vencoder);
-	arguments.rtpencoder = arg->rtpencoder;
+	memset(rtcp, 0, sizeof(*rtcp));
+	if (sstream->trans.rtpsource)
+		g_object_get(sstream->trans.rtpsource, "stats", &stats, NULL);
+	if ( !stats )
+		return FALSE;
 
-	/* GSTAPP Setup */
-	gst_init(NULL, NULL);
+	gst_structure_get_boolean(stats, "have-rb", &have_rb);
+	gst_structure_get_uint(stats, "rb-fractionlost", &rtcp->fraction_lost);
+	gst_structure_get_int(stats, "rb-packetslost", &rtcp->packets_lost);
+	gst_structure_get_uint(stats, "rb-jitter", &rtcp->jitter);
+	gst_structure_get_uint(stats, "rb-exthighestseq", &rtcp->exthighestseq);
+	gst_structure_free(stats);
 
-	gst_version(&major, &minor, &micro, &nano);
-	g_print("..This program is linked against GStreamer %d.%d.%d\n", major, minor, micro);
+	return have_rb;
+}
 
-	loop = g_main_loop_new(NULL, FALSE);
+/* ============================================================================
+ * @Function: 	 set_bitrate
+ * @Description: Set the encoder bitrate, in kbits/sec.
+ * ============================================================================
+ */
+static void set_bitrate (struct stream_branch *branch, int bitrate)
+{
+	//kbits/sec --> bits/sec for H.264 encoder
+	if (g_strcmp0(branch->stream->arguments.vencoder, "x264enc") != 0) {
+		bitrate *= 1024;
+	}
+	g_object_set(G_OBJECT (branch->venc), "bitrate", bitrate, NULL);
+}
 
-	datasize = arguments.height * arguments.width * 4;
-	databuffer = gst_buffer_new_and_alloc (datasize);
-	inputdatabuffer = malloc ((sizeof(char))*datasize);
+/* ============================================================================
+ * @Function: 	 cb_ratectl
+ * @Description: Rate control tick, main loop timeout. Every change of the
+ * bitrate is logged, holds only when the reason changes.
+ * ============================================================================
+ */
+static gboolean cb_ratectl (gpointer user_data)
+{
+	struct stream_branch *branch = (struct stream_branch *) user_data;
+	struct ratectl *rc = &branch->ratectl;
+	struct ratectl_report report;
+	guint before = rc->bitrate;
 
-	pipeline = construct_app_pipeline();
-	if ( !pipeline ) {
-		g_printerr("Failed to construct pipeline\n");
-		return -1;
+	branch_report(branch, &report);
+	if (ratectl_update(rc, &report)) {
+		set_bitrate(branch, rc->bitrate);
+		g_print("..%s bitrate %u -> %u kbit/s, %s (loss %.1f%%, jitter %u ms, %u receivers)\n",
+				branch->arguments.mount, before, rc->bitrate, rc->reason,
+				report.fraction_lost * 100.0 / 256, report.jitter_ms, report.receivers);
+	} else if (rc->reason != branch->ratectl_logged) {
+		g_print("..%s bitrate %u kbit/s, %s (loss %.1f%%, jitter %u ms, %u receivers)\n",
+				branch->arguments.mount, rc->bitrate, rc->reason,
+				report.fraction_lost * 100.0 / 256, report.jitter_ms, report.receivers);
 	}
-	g_print("..GSTAPP Pipeline Setup... \n");
+	branch->ratectl_logged = rc->reason;
 
-	/* we add a message handler */
-	bus = gst_pipeline_get_bus(GST_PIPELINE (pipeline));
-	gst_bus_add_watch(bus, bus_watch, loop);
-	gst_object_unref(bus);
+	return TRUE;
+}
 
-	/* create a server instance */
-  	server = gst_rtsp_server_new ();
+/* ============================================================================
+ * @Function: 	 branch_report
+ * @Description: Worst loss and jitter reported by the viewers of the branch
+ * since the last tick. All of them share one encoder, so the weakest link
+ * sets the bitrate, down to its floor. A report seen before is left out, a
+ * viewer that went quiet does not hold the bitrate down.
+ * ============================================================================
+ */
+static void branch_report (struct stream_branch *branch, struct ratectl_report *report)
+{
+	GstRTSPSessionPool *pool;
+	GList *sessions, *item, *mitem;
+	GHashTable *seen;
+	gpointer last;
+	guint i, jitter_ms;
 
-  	/* get the mapping for this server, every server has a default mapper object
-   	* that be used to map uri mount points to media factories */
-  	mapping = gst_rtsp_server_get_media_mapping (server);
+	memset(report, 0, sizeof(*report));
+	seen = g_hash_table_new(NULL, NULL);
 
-	/* make a media factory for a test stream.
-	* The default media factory can use
-   	* gst-launch syntax to create pipelines.
-   	* any launch line works as long as it contains elements
-	* named pay%d. Each element with pay%d names will be a stream */
-  	//factory = gst_rtsp_media_factory_new ();
-    	factory = GST_RTSP_MEDIA_FACTORY(gst_rtsp_media_factory_custom_new());
+	pool = gst_rtsp_server_get_session_pool(branch->stream->module->server);
+	sessions = gst_rtsp_session_pool_filter(pool, NULL, NULL);
+	g_object_unref(pool);
 
-  	// allow multiple clients to see the same video
-  	gst_rtsp_media_factory_set_shared (factory, TRUE);
-    	g_object_set(factory, "bin", pipeline, NULL);
+	for (item = sessions; item; item = item->next) {
+		GstRTSPSession *session = item->data;
 
-  	/* attach the test factory to the /test url */
-  	gst_rtsp_media_mapping_add_factory (mapping, "/bbwatch", factory);
-  	/* don't need the ref to the mapping anymore */
-  	g_object_unref (mapping);
-  	/* attach the server to the default maincontext */
-  	gst_rtsp_server_attach (server, NULL);
-	 /* add a timeout for the session cleanup */
-  	g_timeout_add_seconds (2, (GSourceFunc) cleanup_timeout, server);
-	g_print("..GST Pipeline Initialized ...\n");
-	
-	return 0;
+		for (mitem = session->medias; mitem; mitem = mitem->next) {
+			GstRTSPSessionMedia *media = mitem->data;
+
+			if ( !media->url ||
+			     g_strcmp0(media->url->abspath, branch->arguments.mount) != 0)
+				continue;
+
+			for (i = 0; media->streams && i < media->streams->len; i++) {
+				GstRTSPSessionStream *sstream;
+				struct session_rtcp rtcp;
+
+				sstream = g_array_index(media->streams, GstRTSPSessionStream *, i);
+				if (!sstream || !session_rtcp(sstream, &rtcp))
+					continue;
+
+				/* kept off by one, a highest seq of 0 is still a report */
+				g_hash_table_insert(seen, sstream, GUINT_TO_POINTER (rtcp.exthighestseq + 1));
+				last = branch->rtcp_seen ? g_hash_table_lookup(branch->rtcp_seen, sstream) : NULL;
+				if (GPOINTER_TO_UINT (last) == rtcp.exthighestseq + 1)
+					continue;
+
+				/* video RTP clock is 90 kHz */
+				jitter_ms = rtcp.jitter / 90;
+				report->receivers++;
+				if (rtcp.fraction_lost > report->fraction_lost)
+					report->fraction_lost = rtcp.fraction_lost;
+				if (jitter_ms > report->jitter_ms)
+					report->jitter_ms = jitter_ms;
+			}
+		}
+		g_object_unref(session);
+	}
+	g_list_free(sessions);
+
+	if (branch->rtcp_seen)
+		g_hash_table_destroy(branch->rtcp_seen);
+	branch->rtcp_seen = seen;
 }
 
 /* ============================================================================
- * @Function: 	 rtspmodule_start
- * @Description: Start GST Pipeline.
+ * @Function: 	 cb_sendq_scan
+ * @Description: Put the TCP clients of the branch that started playing
+ * behind a send queue and close the ones their policy gave up on. Clients
+ * whose session is gone are forgotten.
  * ============================================================================
  */
-int rtspmodule_start(void)
+static gboolean cb_sendq_scan (gpointer user_data)
 {
-	/* Set the pipeline to "playing" state*/
-	g_print("..Now streaming...\n");
-    	g_print ("stream ready at rtsp://127.0.0.1:8554/bbwatch\n");
-	g_main_loop_run(loop);
+	struct stream_branch *branch = (struct stream_branch *) user_data;
+	struct rtspmodule_arguments *arguments = &branch->stream->arguments;
+	GstRTSPSessionPool *pool;
+	GList *sessions, *item, *mitem;
+	struct send_client *sc;
+	guint i;
 
-	/* Out of the main loop, clean up nicely */
-	gst_element_set_state(pipeline, GST_STATE_NULL);
-	gst_object_unref(GST_OBJECT (pipeline));
+	pool = gst_rtsp_server_get_session_pool(branch->stream->module->server);
+	sessions = gst_rtsp_session_pool_filter(pool, NULL, NULL);
 
-	return 0;
+	for (item = sessions; item; item = item->next) {
+		GstRTSPSession *session = item->data;
+		gboolean drop_session = FALSE;
+
+		for (mitem = session->medias; mitem; mitem = mitem->next) {
+			GstRTSPSessionMedia *media = mitem->data;
+
+			if ( !media->url ||
+			     g_strcmp0(media->url->abspath, branch->arguments.mount) != 0)
+				continue;
+
+			for (i = 0; media->streams && i < media->streams->len; i++) {
+				GstRTSPSessionStream *sstream;
+				GstRTSPTransport *transport;
+
+				sstream = g_array_index(media->streams, GstRTSPSessionStream *, i);
+				if (!sstream || !sstream->trans.transport || !sstream->trans.send_rtp)
+					continue;
+				transport = sstream->trans.transport;
+				if (transport->lower_transport != GST_RTSP_LOWER_TRANS_TCP)
+					continue;
+
+				sc = send_client_of(sstream);
+				if (sc)
+					sc->seen = TRUE;
+
+				if (!sc && sstream->trans.send_rtp != cb_send_rtp) {
+					GstRTSPClient *client = sstream->trans.user_data;
+
+					sc = g_new0(struct send_client, 1);
+					sc->branch = branch;
+					sc->sstream = sstream;
+					sc->client = sstream->trans.user_data;
+					sc->channel = transport->interleaved.min;
+					sc->send_rtp = sstream->trans.send_rtp;
+					sc->seen = TRUE;
+					sendq_init(&sc->queue, arguments->send_policy, sendq_codec(branch),
+						   gst_rtsp_connection_get_writefd(client->connection),
+						   arguments->send_queue * 1024);
+
+					/* found before the first packet comes through it */
+					if (send_client_insert(sc) < 0) {
+						if (!branch->send_table_full)
+							g_printerr("$$ %s session %s over TCP, no send queue left\n",
+									branch->arguments.mount, session->sessionid);
+						branch->send_table_full = TRUE;
+						g_free(sc);
+						continue;
+					}
+					branch->send_clients = g_list_prepend(branch->send_clients, sc);
+					sstream->trans.send_rtp = cb_send_rtp;
+					g_print("..%s session %s over TCP, queue of %d kbytes\n",
+							branch->arguments.mount, session->sessionid,
+							arguments->send_queue);
+				}
+
+				if (sc && g_atomic_int_get(&sc->queue.disconnect) && !sc->closing) {
+					sc->closing = TRUE;
+					drop_session = TRUE;
+				}
+			}
+		}
+
+		/* the client closes its connection once its last session is gone */
+		if (drop_session) {
+			g_printerr("$$ %s session %s fell too far behind, closed\n",
+					branch->arguments.mount, session->sessionid);
+			gst_rtsp_session_pool_remove(pool, session);
+		}
+		g_object_unref(session);
+	}
+	g_list_free(sessions);
+	g_object_unref(pool);
+
+	forget_send_clients(branch, FALSE);
+	return TRUE;
 }
 
 /* ============================================================================
- * @Function: 	 rtspmodule_close
- * @Description: Close GST Pipeline.
+ * @Function: 	 cb_send_rtp
+ * @Description: Send function of the TCP clients, in the media's streaming
+ * thread. Packets the client's queue admits go on to the server's own send
+ * function, the others are dropped as if sent, as are the packets of a
+ * client whose queue is being forgotten.
  * ============================================================================
  */
-int rtspmodule_close(void)
+static gboolean cb_send_rtp (GstBuffer *buffer, guint8 channel, gpointer user_data)
 {
-	g_main_loop_quit(loop);
-	return 0;
+	struct send_client *sc = send_client_find(user_data, channel);
+
+	if (sc && sendq_take(&sc->queue, GST_BUFFER_DATA (buffer), GST_BUFFER_SIZE (buffer)))
+		return sc->send_rtp(buffer, channel, user_data);
+	return TRUE;
 }
 
+/* ============================================================================
+ * @Function: 	 send_slot
+ * @Description: First slot of send_table probed for a client and channel.
+ * ============================================================================
+ */
+static guint send_slot (gpointer client, guint8 channel)
+{
+	return (((guintptr) client >> 4) * 31 + channel) & (SEND_TABLE_SIZE - 1);
+}
 
 /* ============================================================================
- * @Function: 	 rtspmodule_setdata
- * @Description: Copy the input data to the buffer.
+ * @Function: 	 send_client_find
+ * @Description: Send queue of a client and channel, NULL = none. Any thread.
  * ============================================================================
  */
-int rtspmodule_setdata (char *data)
+static struct send_client *send_client_find (gpointer client, guint8 channel)
+{
+	guint slot = send_slot(client, channel);
+	guint n;
+
+	for (n = 0; n < SEND_TABLE_SIZE; n++) {
+		struct send_client *sc = g_atomic_pointer_get(&send_table[slot]);
+
+		if (!sc)
+			break;
+		if (sc->client == client && sc->channel == channel)
+			return sc;
+		slot = (slot + 1) & (SEND_TABLE_SIZE - 1);
+	}
+	return NULL;
+}
+
+/* ============================================================================
+ * @Function: 	 send_client_insert
+ * @Description: Publish a send queue, complete, to the streaming thread.
+ * Main loop only. Returns -1 when the table is full.
+ * ============================================================================
+ */
+static int send_client_insert (struct send_client *sc)
 {
-	int err = 0;
-	
-  	memcpy(inputdatabuffer, data, datasize);
+	guint slot = send_slot(sc->client, sc->channel);
+	guint n;
 
-	return err;
+	for (n = 0; n < SEND_TABLE_SIZE; n++) {
+		if (!send_table[slot] || send_table[slot] == &send_removed) {
+			g_atomic_pointer_set(&send_table[slot], sc);
+			return 0;
+		}
+		slot = (slot + 1) & (SEND_TABLE_SIZE - 1);
+	}
+	return -1;
 }
 
+/* ============================================================================
+ * @Function: 	 send_client_remove
+ * @Description: Take a send queue out of the table, main loop only. The
+ * streaming thread may still hold it, it is freed a scan later. A run of
+ * freed slots that ends the probe sequence is emptied.
+ * ============================================================================
+ */
+static void send_client_remove (struct send_client *sc)
+{
+	guint slot = send_slot(sc->client, sc->channel);
+	guint n;
+
+	for (n = 0; n < SEND_TABLE_SIZE; n++) {
+		if (!send_table[slot])
+			return;
+		if (send_table[slot] == sc)
+			break;
+		slot = (slot + 1) & (SEND_TABLE_SIZE - 1);
+	}
+	if (n == SEND_TABLE_SIZE)
+		return;
+
+	g_atomic_pointer_set(&send_table[slot], &send_removed);
+	if (send_table[(slot + 1) & (SEND_TABLE_SIZE - 1)])
+		return;
+	for (n = 0; n < SEND_TABLE_SIZE && send_table[slot] == &send_removed; n++) {
+		g_atomic_pointer_set(&send_table[slot], NULL);
+		slot = (slot - 1) & (SEND_TABLE_SIZE - 1);
+	}
+}
 
 /* ============================================================================
- * @Function: 	 cb_need_data
- * @Description: This callback function feed GST pipeline with video frame.
+ * @Function: 	 send_client_of
+ * @Description: Send queue of a session stream, NULL = not behind one.
  * ============================================================================
  */
-static void cb_need_data (GstElement *appsrc, guint unused_size, gpointer user_data)
+static struct send_client *send_client_of (GstRTSPSessionStream *sstream)
 {
-	static GstClockTime timestamp = 0;
-	GstFlowReturn ret;
+	if (sstream->trans.send_rtp != cb_send_rtp || !sstream->trans.transport)
+		return NULL;
+	return send_client_find(sstream->trans.user_data,
+				sstream->trans.transport->interleaved.min);
+}
+
+/* ============================================================================
+ * @Function: 	 unwrap_send_clients
+ * @Description: Give the TCP clients of the branch still in a session their
+ * own send function back, before their queues are forgotten.
+ * ============================================================================
+ */
+static void unwrap_send_clients (struct stream_branch *branch)
+{
+	GstRTSPSessionPool *pool;
+	GList *sessions, *item, *mitem;
+	guint i;
 
-	sem_wait(&gdata_ready);
-	gst_buffer_set_data(databuffer, inputdatabuffer, datasize);
+	pool = gst_rtsp_server_get_session_pool(branch->stream->module->server);
+	sessions = gst_rtsp_session_pool_filter(pool, NULL, NULL);
 
-	GST_BUFFER_TIMESTAMP (databuffer) = timestamp;
-	GST_BUFFER_DURATION (databuffer) = gst_util_uint64_scale_int (1, GST_SECOND, arguments.gfps);
+	for (item = sessions; item; item = item->next) {
+		GstRTSPSession *session = item->data;
+
+		for (mitem = session->medias; mitem; mitem = mitem->next) {
+			GstRTSPSessionMedia *media = mitem->data;
+
+			for (i = 0; media->streams && i < media->streams->len; i++) {
+				GstRTSPSessionStream *sstream;
+				struct send_client *sc;
+
+				sstream = g_array_index(media->streams, GstRTSPSessionStream *, i);
+				if (!sstream || !(sc = send_client_of(sstream)) || sc->branch != branch)
+					continue;
+				sstream->trans.send_rtp = sc->send_rtp;
+			}
+		}
+		g_object_unref(session);
+	}
+	g_list_free(sessions);
+	g_object_unref(pool);
+}
+
+/* ============================================================================
+ * @Function: 	 forget_send_clients
+ * @Description: Drop the queues of the branch's clients not seen by the last
+ * scan, or all of them. The streaming thread may still be in cb_send_rtp
+ * with a queue just taken out of the table: it is freed a scan later, or,
+ * for all of them, after waiting as long.
+ * ============================================================================
+ */
+static void forget_send_clients (struct stream_branch *branch, gboolean all)
+{
+	GList *item, *next;
+	gboolean retired = FALSE;
 
-	timestamp += GST_BUFFER_DURATION (databuffer);
+	for (item = branch->send_clients; item; item = next) {
+		struct send_client *sc = item->data;
 
-	g_signal_emit_by_name (appsrc, "push-buffer", databuffer, &ret);
+		next = item->next;
+		if (sc->seen && !all) {
+			sc->seen = FALSE;
+			continue;
+		}
+		if (!sc->gone) {
+			send_client_remove(sc);
+			if (sc->queue.dropped_frames)
+				g_print("..%s client gone, %u frames dropped\n",
+						branch->arguments.mount, sc->queue.dropped_frames);
+			sc->gone = TRUE;
+			retired = TRUE;
+			continue;
+		}
+		branch->send_clients = g_list_delete_link(branch->send_clients, item);
+		g_free(sc);
+	}
 
-	if (ret != GST_FLOW_OK) {
-		/* something wrong, stop pushing */
-		g_main_loop_quit (loop);
+	if (all && retired) {
+		g_usleep(SENDQ_SCAN_MS * 1000);
+		forget_send_clients(branch, TRUE);
 	}
-	sem_post(&gdata_wait);
 }
 
+/* ============================================================================
+ * @Function: 	 sendq_codec
+ * @Description: What the branch's RTP packets carry, for the send queues.
+ * ============================================================================
+ */
+static int sendq_codec (struct stream_branch *branch)
+{
+	struct rtspmodule_stream *stream = branch->stream;
+	const gchar *name;
+	gchar *lower;
+	int codec = SENDQ_CODEC_OTHER;
+
+	name = stream->passthrough ? stream->capsformat : stream->arguments.rtpencoder;
+	lower = g_ascii_strdown(name ? name : "", -1);
+	if (strstr(lower, "h264"))
+		codec = SENDQ_CODEC_H264;
+	else if (strstr(lower, "h265"))
+		codec = SENDQ_CODEC_H265;
+	g_free(lower);
+
+	return codec;
+}
+
+/* ============================================================================
+ * @Function: 	 trace_probe
+ * @Description: Stamp the buffers leaving the element, for latency tracing.
+ * ============================================================================
+ */
+static void trace_probe (GstElement *element, GCallback callback, struct stream_branch *branch)
+{
+	GstPad *pad;
+
+	pad = gst_element_get_static_pad(element, "src");
+	if ( !pad )
+		return;
+	gst_pad_add_buffer_probe(pad, callback, branch);
+	gst_object_unref(pad);
+}
+
+/* ============================================================================
+ * @Function: 	 cb_trace_encoded
+ * @Description: Encoder output pad probe.
+ * ============================================================================
+ */
+static gboolean cb_trace_encoded (GstPad *pad, GstBuffer *buffer, gpointer user_data)
+{
+	struct stream_branch *branch = (struct stream_branch *) user_data;
+
+	trace_stamp(branch, buffer, FRAMETRACE_ENCODED, &branch->trace_encoded);
+	return TRUE;
+}
+
+/* ============================================================================
+ * @Function: 	 cb_trace_payloaded
+ * @Description: Payloader output pad probe.
+ * ============================================================================
+ */
+static gboolean cb_trace_payloaded (GstPad *pad, GstBuffer *buffer, gpointer user_data)
+{
+	struct stream_branch *branch = (struct stream_branch *) user_data;
+
+	trace_stamp(branch, buffer, FRAMETRACE_PAYLOADED, &branch->trace_payloaded);
+	return TRUE;
+}
+
+/* ============================================================================
+ * @Function: 	 trace_stamp
+ * @Description: Stamp the frame the buffer belongs to, found by pts among the
+ * last frames pushed. Only the first buffer of a frame is stamped, e.g. the
+ * first of its RTP packets.
+ * ============================================================================
+ */
+static void trace_stamp (struct stream_branch *branch, GstBuffer *buffer, int stage,
+			 GstClockTime *last)
+{
+	GstClockTime pts = GST_BUFFER_TIMESTAMP (buffer);
+	guint i, next;
+
+	if (!GST_CLOCK_TIME_IS_VALID (pts) || pts == *last)
+		return;
+	*last = pts;
+
+	/* written by the need-data side, a slot being rewritten just misses */
+	next = branch->trace_next;
+	for (i = 1; i <= BRANCH_TRACE_FRAMES && i <= next; i++) {
+		struct branch_trace *trace = &branch->trace[(next - i) % BRANCH_TRACE_FRAMES];
+
+		if (trace->pts == pts) {
+			frametrace_stamp(stage, trace->key, branch->trace_track, 0);
+			return;
+		}
+	}
+}
 
 /* ============================================================================
  * @Function: 	 construct_app_pipeline
  * @Description: Pipeline construction, see the diagram drawn at top of the page.
+ * A branch smaller than the source gets a videoscale in front of the encoder.
  * ============================================================================
  */
-static GstElement* construct_app_pipeline(void)
+static GstElement* construct_app_pipeline(struct stream_branch *branch)
 {
-	GstElement *pipeline, *source, *venc, *rtpenc;
+	struct rtspmodule_arguments *arguments = &branch->stream->arguments;
+	struct rtspmodule_branch *output = &branch->arguments;
+	struct rtspmodule_stream *stream = branch->stream;
+	GstElement *pipeline, *source, *scale = NULL, *venc = NULL, *rtpenc;
 	GstCaps *caps;
+	GstPad *pad;
 	gboolean err;
 	char *rtpencoder = NULL;
+	gchar *codec;
 
 	/* Create gstreamer pipeline */
 	pipeline = gst_pipeline_new("gstapp_sender");
@@ -247,26 +2698,52 @@ static GstElement* construct_app_pipeline(void)
 	/* Video source initialization */
 	source = gst_element_factory_make ("appsrc", "video-source");
 	if ( !source ) {
-		g_printerr("Failed to create %s\n", arguments.vsrc);
+		g_printerr("Failed to create %s\n", arguments->vsrc);
 		return 0;
 	}
-  	g_signal_connect (source, "need-data", G_CALLBACK (cb_need_data), NULL);
+  	g_signal_connect (source, "need-data", G_CALLBACK (cb_need_data), branch);
+	branch->appsrc = source;
 
-	/* Create video encoder */
-	venc = gst_element_factory_make(arguments.vencoder, "video-encoder");
-	if ( !venc ) {
-		g_printerr("Failed to create %s\n", arguments.vencoder);
-		return 0;
+	/* frames are stamped with their capture time by us */
+	g_object_set(G_OBJECT (source), "is-live", TRUE, "format", GST_FORMAT_TIME,
+			"do-timestamp", FALSE, NULL);
+
+	/* Scale down to the size of the branch */
+	if (!stream->passthrough &&
+	    (output->width != arguments->width || output->height != arguments->height)) {
+		scale = gst_element_factory_make("videoscale", "video-scale");
+		if ( !scale ) {
+			g_printerr("Failed to create videoscale\n");
+			return 0;
+		}
 	}
 
-	//kbits/sec --> bits/sec for H.264 encoder
-	if (g_strcmp0(arguments.vencoder, "x264enc") != 0) {
-		arguments.gbitrate *= 1024;
+	/* Create video encoder, unless the camera did the encoding */
+	if (!stream->passthrough) {
+		venc = gst_element_factory_make(arguments->vencoder, "video-encoder");
+		if ( !venc ) {
+			g_printerr("Failed to create %s\n", arguments->vencoder);
+			return 0;
+		}
+
+		branch->venc = venc;
+		set_bitrate(branch, output->gbitrate);
+
+		/* lookahead, B-frames, threading and GOP for the profile */
+		encprofile_apply(arguments->profile, venc, output->gfps);
 	}
-	g_object_set(G_OBJECT (venc), "bitrate", arguments.gbitrate, NULL);
 
 	/* Choose RTP encoder according to video codec */
-	rtpencoder = g_strdup(arguments.rtpencoder);
+	if (stream->passthrough && !arguments->rtpencoder) {
+		if (stream->interframe) {
+			codec = g_ascii_strdown(stream->capsformat, -1);
+			rtpencoder = g_strdup_printf("rtp%spay", codec);
+			g_free(codec);
+		} else {
+			rtpencoder = g_strdup("rtpjpegpay");
+		}
+	} else
+		rtpencoder = g_strdup(arguments->rtpencoder);
 
 	/* Create RTP encoder */
 	rtpenc = gst_element_factory_make(rtpencoder, "rtp-encoder");
@@ -275,37 +2752,124 @@ static GstElement* construct_app_pipeline(void)
 		return 0;
 	}
 
-	g_object_set(G_OBJECT (rtpenc), "name", "pay0", "pt", 96, "mtu", arguments.gmtu, NULL);	
+	g_object_set(G_OBJECT (rtpenc), "name", "pay0", "pt", 96, "mtu", arguments->gmtu, NULL);	
 	//g_object_set(G_OBJECT (rtpenc), "name", "pay0", "pt", 96, "send-config", TRUE, NULL);	
-	//g_object_set(G_OBJECT (rtpenc), "name", "pay0", "pt", 96, "mtu", arguments.gmtu, "send-config", TRUE, NULL);
-	g_free(arguments.vencoder);
+	//g_object_set(G_OBJECT (rtpenc), "name", "pay0", "pt", 96, "mtu", arguments->gmtu, "send-config", TRUE, NULL);
+	g_free(rtpencoder);
 
-	/* Set up the pipeline */
-	gst_bin_add_many(GST_BIN (pipeline), source, venc, rtpenc, NULL);
+	/* Parameter sets come in-band, repeat them for late joiners */
+	if (stream->interframe &&
+	    g_object_class_find_property(G_OBJECT_GET_CLASS (rtpenc), "config-interval"))
+		g_object_set(G_OBJECT (rtpenc), "config-interval", 1, NULL);
+	encprofile_apply(arguments->profile, rtpenc, output->gfps);
 
-	gchar *capsstr;
-	capsstr = g_strdup_printf ("video/x-raw-yuv, format=(fourcc)UYVY, width=(int)%d, height=(int)%d, framerate=%d/1",
-					 arguments.width, arguments.height, arguments.gfps);
-	caps = gst_caps_from_string (capsstr);
-	g_free(capsstr);
+	/* Encoded output, as the payloader takes it in */
+	pad = gst_element_get_static_pad(rtpenc, "sink");
+	if (pad) {
+		gst_pad_add_buffer_probe(pad, G_CALLBACK (cb_count_encoded), branch);
+		gst_object_unref(pad);
+	}
+
+	/* Latency tracing at the encoder and payloader outputs */
+	if (branch->trace_track) {
+		if (venc)
+			trace_probe(venc, G_CALLBACK (cb_trace_encoded), branch);
+		trace_probe(rtpenc, G_CALLBACK (cb_trace_payloaded), branch);
+	}
+
+	/* Set up the pipeline */
+	gst_bin_add_many(GST_BIN (pipeline), source, rtpenc, NULL);
+	if (venc)
+		gst_bin_add(GST_BIN (pipeline), venc);
+	if (scale)
+		gst_bin_add(GST_BIN (pipeline), scale);
 
-	err = gst_element_link_filtered(source, venc, caps);
+	/* on appsrc rather than a capsfilter, so a reformat can change them */
+	caps = source_caps(branch);
+	g_object_set(G_OBJECT (source), "caps", caps, NULL);
 	gst_caps_unref(caps);
+
+	err = gst_element_link(source, scale ? scale : venc ? venc : rtpenc);
 	if ( err==FALSE ) {
 		g_printerr("Failed to link source and timeoverlay\n");
 		return 0;
 	}
 
-	err = gst_element_link_many(venc, rtpenc, NULL);
-	if ( err==FALSE ) {
-		g_printerr("Failed to link elements\n");
-		return 0;
+	if (scale) {
+		gchar *capsstr;
+
+		capsstr = g_strdup_printf ("video/x-raw-yuv, width=(int)%d, height=(int)%d",
+					 output->width, output->height);
+		caps = gst_caps_from_string (capsstr);
+		g_free(capsstr);
+
+		err = gst_element_link_filtered(scale, venc, caps);
+		gst_caps_unref(caps);
+		if ( err==FALSE ) {
+			g_printerr("Failed to link videoscale and encoder\n");
+			return 0;
+		}
+	}
+
+	if (venc) {
+		err = gst_element_link_many(venc, rtpenc, NULL);
+		if ( err==FALSE ) {
+			g_printerr("Failed to link elements\n");
+			return 0;
+		}
 	}
 
 	return pipeline;
 }
 
 
+/* ============================================================================
+ * @Function: 	 source_caps
+ * @Description: Caps of the frames the branch's appsrc pushes, the stream's
+ * format at the branch's rate.
+ * ============================================================================
+ */
+static GstCaps *source_caps (struct stream_branch *branch)
+{
+	struct rtspmodule_arguments *arguments = &branch->stream->arguments;
+	struct rtspmodule_stream *stream = branch->stream;
+	GstCaps *caps;
+	gchar *capsstr, *codec;
+
+	if (stream->interframe) {
+		codec = g_ascii_strdown(stream->capsformat, -1);
+		capsstr = g_strdup_printf ("video/x-%s, stream-format=(string)byte-stream, alignment=(string)au, "
+					 "width=(int)%d, height=(int)%d, framerate=%d/1",
+					 codec, arguments->width, arguments->height, branch->arguments.gfps);
+		g_free(codec);
+	}
+	else if (stream->passthrough)
+		capsstr = g_strdup_printf ("image/jpeg, width=(int)%d, height=(int)%d, framerate=%d/1",
+					 arguments->width, arguments->height, branch->arguments.gfps);
+	else
+		capsstr = g_strdup_printf ("video/x-raw-yuv, format=(fourcc)%s, width=(int)%d, height=(int)%d, framerate=%d/1",
+					 stream->capsformat,
+					 arguments->width, arguments->height, branch->arguments.gfps);
+	caps = gst_caps_from_string (capsstr);
+	g_free(capsstr);
+
+	return caps;
+}
+
+/* ============================================================================
+ * @Function: 	 force_keyframe
+ * @Description: Have the encoder start over on a keyframe with its headers.
+ * The event goes out of appsrc ahead of the next frame.
+ * ============================================================================
+ */
+static void force_keyframe (struct stream_branch *branch)
+{
+	GstStructure *s;
+
+	s = gst_structure_new("GstForceKeyUnit", "all-headers", G_TYPE_BOOLEAN, TRUE, NULL);
+	gst_element_send_event(branch->appsrc, gst_event_new_custom(GST_EVENT_CUSTOM_DOWNSTREAM, s));
+}
+
 /* ============================================================================
  * @Function: 	 cleanup_timeout
  * @Description: This timeout is periodically run to clean up the expired
@@ -326,18 +2890,20 @@ static gboolean cleanup_timeout(GstRTSPServer * server, gboolean ignored)
 
 /* ============================================================================
  * @Function: 	 bus_watch
- * @Description: This handles the message received from GST. 
+ * @Description: This handles the message received from GST. An end of
+ * stream or an error stops the branch's pipeline only, the other mount
+ * points and streams of the server go on.
  * ============================================================================
  */
 static gboolean bus_watch(GstBus *bus, GstMessage *msg, gpointer data) 
 {
-	GMainLoop *loop = (GMainLoop *) data;
+	struct stream_branch *branch = (struct stream_branch *) data;
 
 	switch (GST_MESSAGE_TYPE (msg)) 
 	{
 		case GST_MESSAGE_EOS:
-			g_print("End of stream\n");
-			g_main_loop_quit(loop);
+			g_print("..%s end of stream\n", branch->arguments.mount);
+			branch_fail(branch);
 		break;
 		case GST_MESSAGE_ERROR: {
 			gchar *debug;
@@ -346,10 +2912,10 @@ static gboolean bus_watch(GstBus *bus, GstMessage *msg, gpointer data)
 			gst_message_parse_error(msg, &error, &debug);
 			g_free(debug);
 
-			g_printerr("Error: %s\n", error->message);
+			g_printerr("$$ %s error: %s\n", branch->arguments.mount, error->message);
 			g_error_free(error);
 
-			g_main_loop_quit(loop);
+			branch_fail(branch);
 			break;
 		}
 		default:
@@ -359,3 +2925,16 @@ static gboolean bus_watch(GstBus *bus, GstMessage *msg, gpointer data)
 	return TRUE;
 }
 
+/* ============================================================================
+ * @Function: 	 branch_fail
+ * @Description: Stop the pipeline of a branch for good, in the main loop.
+ * Frames are not queued for it any more.
+ * ============================================================================
+ */
+static void branch_fail (struct stream_branch *branch)
+{
+	g_atomic_int_set(&branch->failed, 1);
+	gst_element_set_state(branch->pipeline, GST_STATE_NULL);
+	framebox_flush(&branch->framebox);
+	g_printerr("$$ %s stopped, the other mount points go on\n", branch->arguments.mount);
+}
@@ -5,16 +5,78 @@
 extern "C" {
 #endif
 
+/* Frame queue policies, see framebox.h */
+#define RTSPMODULE_QUEUE_LATEST_WINS	0
+#define RTSPMODULE_QUEUE_DROP_OLDEST	1
+
+/* What happens to a TCP client falling behind by more than send_queue */
+#define RTSPMODULE_SEND_DROP_NONREF	0	/* drop non-reference frames, far behind skip */
+#define RTSPMODULE_SEND_SKIP_TO_KEY	1	/* drop everything up to the next keyframe */
+#define RTSPMODULE_SEND_DISCONNECT	2	/* close the client's session */
+
+/* Latency profiles, set the encoder and payloader up together */
+#define RTSPMODULE_PROFILE_ULTRA_LOW_LATENCY	"ultra-low-latency"	/* no lookahead/B-frames, 1 s GOP */
+#define RTSPMODULE_PROFILE_BALANCED		"balanced"
+#define RTSPMODULE_PROFILE_QUALITY		"quality"	/* lookahead, B-frames, long GOP */
+
 struct rtspmodule_arguments 
 {
 	int 	width;
 	int 	height;
 	int 	gfps;
 	int 	gbitrate;
+	int 	min_bitrate;	/* kbits/s, adapted to RTCP loss down to this, 0 = fixed gbitrate */
+	int 	max_bitrate;	/* kbits/s ceiling when adapted, 0 = gbitrate */
 	int 	gmtu;
+	int 	queue_depth;	/* frames waiting for the encoder, 0 = default */
+	int 	queue_policy;
+	int 	pool_count;	/* frame buffers copied or converted into, 0 = from queue_depth */
 	char 	*vsrc;
 	char 	*vencoder;
 	char 	*rtpencoder;
+	char 	*profile;	/* RTSPMODULE_PROFILE_*, NULL = element defaults */
+	char 	*informat;	/* captured pixel format, "UYVY" (NULL), "YUYV", "NV12", "I420",
+				 * or "MJPG"/"H264"/"H265" sent as is, without vencoder */
+	int 	stride;		/* bytes per line of the captured frames, 0 = packed */
+	char 	*vformat;	/* fed to the encoder, "I420", "NV12" or NULL = as captured */
+	char 	*metrics_service;	/* HTTP port of the Prometheus /metrics page, NULL = none */
+	int 	motion_fps;	/* encode rate while the scene is static, 0 = always full rate */
+	int 	motion_threshold;	/* mean luma change of a moving block, 0 = default */
+	char 	*multicast;	/* group range "239.255.42.1-239.255.42.254" the mount points
+				 * are also sent to, NULL = unicast only */
+	int 	multicast_port_min;	/* even RTP ports of the groups */
+	int 	multicast_port_max;
+	int 	multicast_ttl;	/* 0 = default */
+	int 	send_queue;	/* kbytes a TCP client may fall behind before its frames
+				 * are dropped, 0 = unbounded */
+	int 	send_policy;	/* RTSPMODULE_SEND_* */
+	int 	send_batch;	/* RTP of a frame sent to the UDP clients in one sendmmsg(),
+				 * with UDP GSO where the kernel has it, 0 = by udpsink */
+};
+
+/* One encoding of a simulcast stream, served on its own mount point */
+struct rtspmodule_branch
+{
+	char 	*mount;
+	int 	width;		/* at most the source size, scaled down if smaller */
+	int 	height;
+	int 	gfps;		/* at most the source rate, frames are skipped if lower */
+	int 	gbitrate;
+	int 	min_bitrate;	/* adaptive bitrate bounds, as in rtspmodule_arguments */
+	int 	max_bitrate;
+};
+
+struct rtspmodule_stats
+{
+	unsigned int 	producer_drops;	/* dropped by the data interface, queue full */
+	unsigned int 	consumer_drops;	/* skipped by need-data, newer frame waiting */
+	unsigned int 	underruns;	/* need-data found no frame */
+	unsigned int 	keyframe_waits;	/* compressed frames skipped until a keyframe */
+	unsigned int 	pool_buffers;	/* frame buffers allocated */
+	unsigned int 	pool_high_water;	/* most of them in use at once */
+	unsigned int 	pool_starvations;	/* frames dropped, no free buffer */
+	unsigned long long udp_packets;	/* RTP packets sent, once per UDP client */
+	unsigned long long udp_calls;	/* system calls they took */
 };
 
 /* These functions return ERROR value as an integer */
@@ -23,9 +85,84 @@ int rtspmodule_start	(void);
 int rtspmodule_close 	(void);
 int rtspmodule_setdata	(char *data);
 
-/* Data Interface Handling */
-sem_t gdata_ready;
-sem_t gdata_wait;
+/* Zero-copy data interface: the frame memory is handed to the pipeline as is
+ * and release(user_data) is called once the pipeline drops its last reference */
+typedef void (*rtspmodule_release_func) (void *user_data);
+
+struct rtspmodule_frame
+{
+	char 	*data;
+	int 	size;
+	unsigned long long timestamp;	/* capture time, CLOCK_MONOTONIC in ns, 0 = now */
+	unsigned int 	sequence;	/* capture frame counter, gaps mark discontinuities */
+	int 	keyframe;	/* compressed input: decodable on its own; 1 for raw frames */
+	rtspmodule_release_func release;
+	void 	*user_data;
+};
+
+int rtspmodule_setframe	(struct rtspmodule_frame *frame);
+
+/* Pre-encoded input, for streams whose informat is "H264" or "H265": one
+ * Annex B (start code) access unit per call, handed over without a copy */
+struct rtspmodule_encoded
+{
+	char 	*data;
+	int 	size;
+	unsigned long long pts;		/* presentation time, CLOCK_MONOTONIC in ns, 0 = dts */
+	unsigned long long dts;		/* decode time, CLOCK_MONOTONIC in ns, 0 = now */
+	int 	keyframe;		/* IDR/IRAP access unit */
+	rtspmodule_release_func release;
+	void 	*user_data;
+};
+
+int rtspmodule_setencoded	(struct rtspmodule_encoded *au);
+int rtspmodule_getstats	(struct rtspmodule_stats *stats);
+
+/* Live format switch: same pixel format, another size, line pitch (0 =
+ * packed) or rate (0 = keep). Sessions stay connected and the encoder starts
+ * over on a keyframe. Called from the thread handing the frames in. Flush
+ * first, so the capture buffers waiting in the queues go back to the camera
+ * before it is reformatted */
+int rtspmodule_flush	(void);
+int rtspmodule_reformat	(int width, int height, int stride, int gfps);
+
+/* Static scene detection, see motion.h: called from the thread handing the
+ * frames in whenever the scene starts (moving = 1) or stops moving, with the
+ * number of blocks that changed in the frame */
+typedef void (*rtspmodule_motion_func) (int moving, unsigned int blocks, void *user_data);
+
+int rtspmodule_set_motion_callback	(rtspmodule_motion_func callback, void *user_data);
+
+/* Instance interface: one server (port, main loop) serving any number of
+ * streams, each on its own mount point. The calls above work on a default
+ * instance serving a single stream on /bbwatch. */
+#define RTSPMODULE_DEFAULT_SERVICE	"8554"
+
+struct rtspmodule;
+struct rtspmodule_stream;
+
+struct rtspmodule *rtspmodule_create	(const char *service);
+struct rtspmodule_stream *rtspmodule_add_stream	(struct rtspmodule *rtsp,
+				const char *mount, struct rtspmodule_arguments *arg);
+struct rtspmodule_stream *rtspmodule_add_simulcast	(struct rtspmodule *rtsp,
+				struct rtspmodule_arguments *arg,
+				struct rtspmodule_branch *branches, int count);
+int rtspmodule_serve_metrics		(struct rtspmodule *rtsp, const char *service);
+int rtspmodule_set_multicast		(struct rtspmodule *rtsp, const char *range,
+					 int port_min, int port_max, int ttl);
+int rtspmodule_run			(struct rtspmodule *rtsp);
+int rtspmodule_quit			(struct rtspmodule *rtsp);
+void rtspmodule_destroy			(struct rtspmodule *rtsp);
+
+int rtspmodule_stream_setdata	(struct rtspmodule_stream *stream, char *data);
+int rtspmodule_stream_setframe	(struct rtspmodule_stream *stream, struct rtspmodule_frame *frame);
+int rtspmodule_stream_setencoded	(struct rtspmodule_stream *stream, struct rtspmodule_encoded *au);
+int rtspmodule_stream_getstats	(struct rtspmodule_stream *stream, struct rtspmodule_stats *stats);
+int rtspmodule_stream_flush	(struct rtspmodule_stream *stream);
+int rtspmodule_stream_reformat	(struct rtspmodule_stream *stream, int width, int height,
+				 int stride, int gfps);
+int rtspmodule_stream_set_motion_callback	(struct rtspmodule_stream *stream,
+				 rtspmodule_motion_func callback, void *user_data);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,238 @@
+/* ============================================================================
+ * @File: 	 sendq.c
+ * @Author: 	 Ozgur Eralp [ozgur.eralp@outlook.com]
+ * @Description: Per Client Send Queue Admission
+ *
+ * ============================================================================
+ *
+ * Copyright 2014 Ozgur Eralp.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * ============================================================================
+ */
+
+
+
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/sockios.h>
+#include "sendq.h"
+
+#define RTP_HEADER	12
+
+/* Kinds of packet, by the NAL unit they carry */
+#define KIND_NEUTRAL	0	/* no say in the frame's fate (AUD, SEI, FU continuation) */
+#define KIND_KEY	1	/* parameter sets, IDR/IRAP slice */
+#define KIND_REF	2	/* slice other frames refer to */
+#define KIND_NONREF	3	/* slice nothing refers to */
+
+static int classify (int codec, const unsigned char *payload, unsigned int size);
+static int classify_h264 (const unsigned char *p, unsigned int size);
+static int classify_h265 (const unsigned char *p, unsigned int size);
+static unsigned int backlog (struct sendq *q);
+static void decide (struct sendq *q, int kind);
+
+/* ============================================================================
+ * @Function: 	 sendq_init
+ * @Description: Start a client off with an empty queue, limit in bytes.
+ * ============================================================================
+ */
+void sendq_init (struct sendq *q, int policy, int codec, int fd, unsigned int limit)
+{
+	memset(q, 0, sizeof(*q));
+	q->policy = policy;
+	q->codec = codec;
+	q->fd = fd;
+	q->limit = limit;
+	q->effective = limit;
+}
+
+/* ============================================================================
+ * @Function: 	 sendq_take
+ * @Description: Whether the RTP packet goes to the client, 1, or is dropped,
+ * 0. Packets of a frame up to the first one that tells its kind follow the
+ * frame before.
+ * ============================================================================
+ */
+int sendq_take (struct sendq *q, const unsigned char *packet, unsigned int size)
+{
+	unsigned int timestamp, offset;
+	int kind;
+
+	if (size < RTP_HEADER || (packet[0] >> 6) != 2)
+		return !q->skipping && !q->disconnect;
+
+	/* past CSRCs and the header extension */
+	offset = RTP_HEADER + 4 * (packet[0] & 0x0f);
+	if ((packet[0] & 0x10) && offset + 4 <= size)
+		offset += 4 + 4 * ((packet[offset + 2] << 8) | packet[offset + 3]);
+
+	timestamp = ((unsigned int) packet[4] << 24) | (packet[5] << 16) |
+		    (packet[6] << 8) | packet[7];
+	if (!q->have_frame || timestamp != q->timestamp) {
+		q->have_frame = 1;
+		q->timestamp = timestamp;
+		q->decided = 0;
+		q->sending = !q->skipping && !q->disconnect;
+		q->backlog = backlog(q);
+	}
+
+	if (!q->decided) {
+		kind = offset < size ? classify(q->codec, packet + offset, size - offset)
+				     : KIND_NEUTRAL;
+		if (kind != KIND_NEUTRAL)
+			decide(q, kind);
+	}
+
+	if (!q->sending) {
+		q->dropped_packets++;
+		q->dropped_bytes += size;
+	}
+	return q->sending;
+}
+
+/* ============================================================================
+ * @Function: 	 decide
+ * @Description: Send or drop the frame, by the client's backlog when it
+ * began and the policy.
+ * ============================================================================
+ */
+static void decide (struct sendq *q, int kind)
+{
+	q->decided = 1;
+
+	if (q->disconnect) {
+		q->sending = 0;
+	} else if (q->skipping) {
+		q->skipping = !(kind == KIND_KEY && q->backlog <= q->effective);
+		q->sending = !q->skipping;
+	} else if (q->backlog <= q->effective) {
+		q->sending = 1;
+	} else if (q->policy == SENDQ_DROP_NONREF) {
+		q->skipping = (kind != KIND_NONREF && q->backlog > 2 * q->effective);
+		q->sending = (kind != KIND_NONREF && !q->skipping);
+	} else if (q->policy == SENDQ_SKIP_TO_KEY) {
+		q->skipping = 1;
+		q->sending = 0;
+	} else {
+		q->disconnect = 1;
+		q->sending = 0;
+	}
+
+	if (!q->sending)
+		q->dropped_frames++;
+}
+
+/* ============================================================================
+ * @Function: 	 backlog
+ * @Description: Bytes the client has not acknowledged yet. The limit is kept
+ * under the socket's buffer, beyond it the writes would queue up unbounded
+ * outside the socket.
+ * ============================================================================
+ */
+static unsigned int backlog (struct sendq *q)
+{
+	int queued = 0, sndbuf = 0;
+	socklen_t len = sizeof(sndbuf);
+
+	if (q->fd < 0 || ioctl(q->fd, SIOCOUTQ, &queued) < 0 || queued < 0)
+		return 0;
+
+	/* the kernel grows the buffer as the connection warms up */
+	q->effective = q->limit;
+	if (getsockopt(q->fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, &len) == 0 &&
+	    sndbuf > 0 && q->effective > (unsigned int) sndbuf / 2)
+		q->effective = sndbuf / 2;
+
+	return queued;
+}
+
+/* ============================================================================
+ * @Function: 	 classify
+ * @Description: Kind of the NAL unit the RTP payload starts or carries.
+ * ============================================================================
+ */
+static int classify (int codec, const unsigned char *payload, unsigned int size)
+{
+	switch (codec) {
+	case SENDQ_CODEC_H264:
+		return classify_h264(payload, size);
+	case SENDQ_CODEC_H265:
+		return classify_h265(payload, size);
+	default:
+		return KIND_KEY;
+	}
+}
+
+static int classify_h264 (const unsigned char *p, unsigned int size)
+{
+	int type = p[0] & 0x1f, nri = p[0] & 0x60;
+
+	if (type == 24) {
+		/* STAP-A, by its first unit */
+		if (size < 4)
+			return KIND_NEUTRAL;
+		return classify_h264(p + 3, size - 3);
+	}
+	if (type == 28) {
+		/* FU-A, only its first fragment tells */
+		if (size < 2 || !(p[1] & 0x80))
+			return KIND_NEUTRAL;
+		type = p[1] & 0x1f;
+	}
+
+	if (type == 5 || type == 7 || type == 8)
+		return KIND_KEY;
+	if (type >= 1 && type <= 4)
+		return nri ? KIND_REF : KIND_NONREF;
+	return KIND_NEUTRAL;
+}
+
+static int classify_h265 (const unsigned char *p, unsigned int size)
+{
+	int type;
+
+	if (size < 3)
+		return KIND_NEUTRAL;
+	type = (p[0] >> 1) & 0x3f;
+
+	if (type == 48) {
+		/* aggregation packet, by its first unit */
+		if (size < 7)
+			return KIND_NEUTRAL;
+		return classify_h265(p + 4, size - 4);
+	}
+	if (type == 49) {
+		/* fragmentation unit */
+		if (!(p[2] & 0x80))
+			return KIND_NEUTRAL;
+		type = p[2] & 0x3f;
+	}
+
+	if ((type >= 16 && type <= 23) || (type >= 32 && type <= 34))
+		return KIND_KEY;
+	if (type <= 14)
+		return (type & 1) ? KIND_REF : KIND_NONREF;
+	return KIND_NEUTRAL;
+}
@@ -0,0 +1,49 @@
+#ifndef SENDQ_H_
+#define SENDQ_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* What happens to a client that falls behind by more than its limit */
+#define SENDQ_DROP_NONREF	0	/* drop frames nothing refers to; twice the limit
+					 * behind, skip to the next keyframe */
+#define SENDQ_SKIP_TO_KEY	1	/* drop everything up to the next keyframe */
+#define SENDQ_DISCONNECT	2	/* drop everything and have the client closed */
+
+/* RTP payload, for telling keyframes and non-reference frames apart */
+#define SENDQ_CODEC_OTHER	0	/* every frame is taken as a keyframe (JPEG) */
+#define SENDQ_CODEC_H264	1
+#define SENDQ_CODEC_H265	2
+
+/* Admission of the RTP packets of one client into its socket, whose send
+ * queue is the client's queue: a frame is sent whole or dropped whole,
+ * decided on its first packet by how many bytes the client has not taken
+ * yet. Used by the one thread sending to the client. */
+struct sendq
+{
+	int 		policy;
+	int 		codec;
+	int 		fd;		/* client's stream socket */
+	unsigned int 	limit;		/* bytes queued before frames are dropped */
+	unsigned int 	effective;	/* limit, kept under the socket's buffer */
+	unsigned int 	timestamp;	/* RTP time of the current frame */
+	int 		have_frame;
+	int 		decided;	/* current frame is sent or dropped, from now on */
+	int 		sending;
+	int 		skipping;	/* dropping up to the next keyframe */
+	int 		disconnect;	/* SENDQ_DISCONNECT hit, close the client */
+	unsigned int 	backlog;	/* at the start of the current frame */
+	unsigned int 	dropped_packets;
+	unsigned int 	dropped_frames;
+	unsigned long long dropped_bytes;
+};
+
+void sendq_init		(struct sendq *q, int policy, int codec, int fd, unsigned int limit);
+int sendq_take		(struct sendq *q, const unsigned char *packet, unsigned int size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SENDQ_H_ */
@@ -38,9 +38,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
 #include <sys/mman.h>
 #include <sys/ioctl.h>
 #include <asm/types.h>
+#include "pixfmt.h"
 #include "v4l2cam.h"
 
 /* Macro for clearing structures */
@@ -48,6 +52,23 @@
 
 static int alloc_buffers(unsigned int buf_cnt, enum v4l2_buf_type type,
                  struct capture_info *info);
+static int export_buffer(struct capture_info *info, unsigned int index);
+static int negotiate_format(struct capture_info *cinfo);
+static int set_frame_rate(struct capture_info *cinfo, int fps);
+static void free_buffers(struct capture_info *cinfo);
+
+/* Tried in this order when no format is asked for, all handled downstream.
+ * With prefer_compressed the camera's own encoder comes first */
+static const unsigned int compressed_formats[] = {
+	V4L2_PIX_FMT_H264,
+	V4L2_PIX_FMT_MJPEG,
+};
+static const unsigned int preferred_formats[] = {
+	V4L2_PIX_FMT_UYVY,
+	V4L2_PIX_FMT_YUYV,
+	V4L2_PIX_FMT_NV12,
+	V4L2_PIX_FMT_YUV420,
+};
 
 
 /* ============================================================================
@@ -58,21 +79,35 @@ static int alloc_buffers(unsigned int buf_cnt, enum v4l2_buf_type type,
 int init_camera(struct capture_info *cinfo)
 {
 	int 				err = 0;
+	int 				i, p;
     	//v4l2_std_id			std_id = V4L2_STD_525_60;
     	struct v4l2_capability      	cap;
-    	struct v4l2_format          	fmt;
     	struct v4l2_input          	input;
+    	unsigned int 			caps;
     	//struct v4l2_control 		control;
     	//struct v4l2_requestbuffers  	req;
     	//enum v4l2_buf_type          	type;
 
+    	for (i = 0; i < V4L2_MAX_BUFFER_COUNT; i++)
+    		for (p = 0; p < V4L2_MAX_PLANES; p++)
+    			cinfo->dmabuf_fd[i][p] = -1;
+
     	printf(".openning capture device %s\n", cinfo->device_name);
-    	cinfo->fd = open(cinfo->device_name, O_RDWR, 0);
+    	cinfo->fd = open(cinfo->device_name, O_RDWR | O_NONBLOCK, 0);
     	if (cinfo->fd == -1) {
         	printf("$$ Cannot open capture device %s\n", cinfo->device_name);
         	return -ENODEV;
     	}
 
+    	cinfo->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    	if (cinfo->event_fd == -1) {
+        	printf("$$ Cannot create wakeup event (%s)\n", strerror(errno));
+        	close(cinfo->fd);
+        	return -ENOMEM;
+    	}
+    	if (cinfo->timeout_ms <= 0)
+    		cinfo->timeout_ms = V4L2_DEFAULT_TIMEOUT_MS;
+
     	printf(".detecting camera on the capture input \n");
     	memset (&input, 0, sizeof (input));
     	if (-1 == ioctl (cinfo->fd, VIDIOC_ENUMINPUT, &input)) {
@@ -103,43 +138,47 @@ int init_camera(struct capture_info *cinfo)
         	goto cleanup_devnode;
     	}
 
-    	if (!(cap.capabilities & V4L2_CAP_VIDEO_CAPTURE)) {
+    	caps = cap.capabilities;
+#ifdef V4L2_CAP_DEVICE_CAPS
+    	if (caps & V4L2_CAP_DEVICE_CAPS)
+    		caps = cap.device_caps;
+#endif
+    	if (caps & V4L2_CAP_VIDEO_CAPTURE) {
+    		cinfo->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    	} else if (caps & V4L2_CAP_VIDEO_CAPTURE_MPLANE) {
+    		printf(".device uses the multi-planar capture API\n");
+    		cinfo->type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    	} else {
         	printf("$$ Device does not support capturing\n");
         	err = EINVAL;
         	goto cleanup_devnode;
     	}
 
-    	if (!(cap.capabilities & V4L2_CAP_STREAMING)) {
+    	if (!(caps & V4L2_CAP_STREAMING)) {
         	printf("$$ Device does not support streaming\n");
         	err = EINVAL;
         	goto cleanup_devnode;
     	}
 
-
-    	printf(".setting format V4L2_PIX_FMT_UYVY\n");
-    	fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    	fmt.fmt.pix.width = cinfo->width;
-    	fmt.fmt.pix.height = cinfo->height;
-    	fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_UYVY;
-    	fmt.fmt.pix.field = V4L2_FIELD_NONE;
-
-	if (ioctl(cinfo->fd, VIDIOC_S_FMT, &fmt) == -1) {
-		printf("$$ failed to set format on capture device \n");
-		err = EINVAL;
+    	err = negotiate_format(cinfo);
+    	if (err < 0) {
+    		err = -err;
         	goto cleanup_devnode;
-	}
+    	}
 
-	if (ioctl(cinfo->fd, VIDIOC_G_FMT, &fmt) == -1) {
-		printf("$$ failed to get format from capture device \n");
+	if (cinfo->active_count == 0)
+		cinfo->active_count = V4L2_DEFAULT_BUFFER_COUNT;
+	if (cinfo->buf_count < cinfo->active_count)
+		cinfo->buf_count = cinfo->active_count;
+	if (cinfo->buf_count > V4L2_MAX_BUFFER_COUNT) {
+		printf("$$ at most %d capture buffers are supported\n", V4L2_MAX_BUFFER_COUNT);
 		err = EINVAL;
         	goto cleanup_devnode;
-	} else {
-		printf(".capture pitch: bytesperline:%d\n", fmt.fmt.pix.bytesperline);
-		printf(".capture pitch: width:%d height:%d\n", fmt.fmt.pix.width, fmt.fmt.pix.height);
 	}
 
-	printf(".allocating capture driver buffers\n");
-    	if (alloc_buffers(2, V4L2_BUF_TYPE_VIDEO_CAPTURE, cinfo) < 0) {
+	printf(".allocating %u capture driver buffers (%u queued)\n",
+				cinfo->buf_count, cinfo->active_count);
+    	if (alloc_buffers(cinfo->buf_count, cinfo->type, cinfo) < 0) {
         	printf("$$ Unable to allocate capture driver buffers\n");
         	err = ENOMEM;
         	goto cleanup_devnode;
@@ -148,10 +187,136 @@ int init_camera(struct capture_info *cinfo)
 	return 0;
 
 cleanup_devnode:
+	close(cinfo->event_fd);
 	close(cinfo->fd);
 	return -err;
 }
 
+/* ============================================================================
+ * @Function: 	 negotiate_format
+ * @Description: Enumerate the formats the camera offers and set the one asked
+ * for, or the first preferred one it has. What the driver settles on (size,
+ * planes, bytesperline, sizeimage) is kept in cinfo for sizing the buffers.
+ * ============================================================================
+ */
+static int negotiate_format(struct capture_info *cinfo)
+{
+    	struct v4l2_fmtdesc 	fdesc;
+    	struct v4l2_format 	fmt;
+    	struct pixfmt 		layout;
+    	unsigned int 		native[32];
+    	unsigned int 		count = 0, chosen = 0, i, j, p;
+    	char 			name[5];
+    	int 			mplane = (cinfo->type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE);
+
+    	printf(".enumerating camera formats\n");
+    	CLEAR(fdesc);
+    	fdesc.type = cinfo->type;
+    	while (count < sizeof(native) / sizeof(native[0]) &&
+    	       ioctl(cinfo->fd, VIDIOC_ENUM_FMT, &fdesc) == 0) {
+    		printf(".  %s %s%s\n", pixfmt_name(fdesc.pixelformat, name), fdesc.description,
+    			(fdesc.flags & V4L2_FMT_FLAG_COMPRESSED) ? " (compressed)" : "");
+    		native[count++] = fdesc.pixelformat;
+    		fdesc.index++;
+    	}
+
+    	if (cinfo->pixelformat) {
+    		for (i = 0; i < count; i++)
+    			if (native[i] == cinfo->pixelformat)
+    				chosen = native[i];
+    		/* drivers not enumerating anything still get a try */
+    		if (!chosen && count) {
+    			printf("$$ camera does not offer %s\n", pixfmt_name(cinfo->pixelformat, name));
+    			return -EINVAL;
+    		}
+    		chosen = cinfo->pixelformat;
+    	} else {
+    		for (j = 0; cinfo->prefer_compressed && !chosen &&
+    			    j < sizeof(compressed_formats) / sizeof(compressed_formats[0]); j++)
+    			for (i = 0; i < count; i++)
+    				if (native[i] == compressed_formats[j])
+    					chosen = native[i];
+    		for (j = 0; !chosen && j < sizeof(preferred_formats) / sizeof(preferred_formats[0]); j++)
+    			for (i = 0; i < count; i++)
+    				if (native[i] == preferred_formats[j])
+    					chosen = native[i];
+    		if (!chosen)
+    			chosen = count ? native[0] : V4L2_PIX_FMT_UYVY;
+    	}
+
+    	printf(".setting format %s\n", pixfmt_name(chosen, name));
+    	CLEAR(fmt);
+    	fmt.type = cinfo->type;
+    	if (mplane) {
+    		fmt.fmt.pix_mp.width = cinfo->width;
+    		fmt.fmt.pix_mp.height = cinfo->height;
+    		fmt.fmt.pix_mp.pixelformat = chosen;
+    		fmt.fmt.pix_mp.field = V4L2_FIELD_NONE;
+    	} else {
+    		fmt.fmt.pix.width = cinfo->width;
+    		fmt.fmt.pix.height = cinfo->height;
+    		fmt.fmt.pix.pixelformat = chosen;
+    		fmt.fmt.pix.field = V4L2_FIELD_NONE;
+    	}
+
+	if (ioctl(cinfo->fd, VIDIOC_S_FMT, &fmt) == -1) {
+		printf("$$ failed to set format on capture device \n");
+		return -EINVAL;
+	}
+
+	if (ioctl(cinfo->fd, VIDIOC_G_FMT, &fmt) == -1) {
+		printf("$$ failed to get format from capture device \n");
+		return -EINVAL;
+	}
+
+	if (mplane) {
+		cinfo->width = fmt.fmt.pix_mp.width;
+		cinfo->height = fmt.fmt.pix_mp.height;
+		cinfo->pixelformat = fmt.fmt.pix_mp.pixelformat;
+		cinfo->num_planes = fmt.fmt.pix_mp.num_planes;
+		if (cinfo->num_planes == 0 || cinfo->num_planes > V4L2_MAX_PLANES) {
+			printf("$$ %u planes per frame are not supported\n", cinfo->num_planes);
+			return -EINVAL;
+		}
+		for (p = 0; p < cinfo->num_planes; p++) {
+			cinfo->bytesperline[p] = fmt.fmt.pix_mp.plane_fmt[p].bytesperline;
+			cinfo->sizeimage[p] = fmt.fmt.pix_mp.plane_fmt[p].sizeimage;
+		}
+	} else {
+		cinfo->width = fmt.fmt.pix.width;
+		cinfo->height = fmt.fmt.pix.height;
+		cinfo->pixelformat = fmt.fmt.pix.pixelformat;
+		cinfo->num_planes = 1;
+		cinfo->bytesperline[0] = fmt.fmt.pix.bytesperline;
+		cinfo->sizeimage[0] = fmt.fmt.pix.sizeimage;
+	}
+
+	if (cinfo->pixelformat != chosen)
+		printf(".driver chose format %s instead\n", pixfmt_name(cinfo->pixelformat, name));
+
+	/* Fill in what the driver left out, for the formats we know */
+	if (pixfmt_fill(&layout, cinfo->pixelformat, cinfo->width, cinfo->height,
+			cinfo->bytesperline[0]) == 0 && layout.size) {
+		for (p = 0; p < cinfo->num_planes; p++) {
+			if (!cinfo->bytesperline[p])
+				cinfo->bytesperline[p] = layout.stride[p];
+			if (!cinfo->sizeimage[p])
+				cinfo->sizeimage[p] = (cinfo->num_planes == 1) ? layout.size
+									 : layout.plane_size[p];
+		}
+	}
+	if (!cinfo->sizeimage[0]) {
+		printf("$$ driver did not report the frame size\n");
+		return -EINVAL;
+	}
+
+	printf(".capture pitch: bytesperline:%u sizeimage:%u planes:%u\n",
+			cinfo->bytesperline[0], cinfo->sizeimage[0], cinfo->num_planes);
+	printf(".capture pitch: width:%d height:%d\n", cinfo->width, cinfo->height);
+
+	return 0;
+}
+
 /* ============================================================================
  * @Function: 	 start_camera
  * @Description: Start Kernel camera driver streaming.
@@ -164,7 +329,7 @@ int start_camera(struct capture_info *cinfo)
 
 	printf(".starting streaming\n");
 
-    	type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    	type = cinfo->type;
 	if (ioctl(cinfo->fd, VIDIOC_STREAMON, &type) == -1) {
         	printf("$$ VIDIOC_STREAMON failed on device\n");
 		err = EPERM;
@@ -174,6 +339,7 @@ int start_camera(struct capture_info *cinfo)
 	return 0;
 
 cleanup_devnode:
+	close(cinfo->event_fd);
 	close(cinfo->fd);
 	return -err;
 }
@@ -185,23 +351,125 @@ cleanup_devnode:
  */
 int close_camera(struct capture_info *cinfo)
 {
-	enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	int i;
+	enum v4l2_buf_type type = cinfo->type;
 
 	/* Stop the video streaming */
     if (ioctl(cinfo->fd, VIDIOC_STREAMOFF, &type) == -1) {
         printf("$$ VIDIOC_STREAMOFF failed on device\n");
     }
 
-    for (i = 0; i < V4L2_MAX_BUFFER_COUNT; i++)
-        munmap(cinfo->userptr[i], cinfo->v4l2buf[i].length);
+    if (cinfo->lost_frames)
+	printf(".%u frames lost by the driver, queue ran dry %u times\n",
+				cinfo->lost_frames, cinfo->starvations);
+
+    free_buffers(cinfo);
 
+	close(cinfo->event_fd);
+	cinfo->event_fd = -1;
 	close(cinfo->fd);
 	cinfo->fd = -1;
 	return 0;
 }
 
 
+/* ============================================================================
+ * @Function: 	 reformat_camera
+ * @Description: Switch the running capture to another size, pixel format
+ * (0 = keep) or frame rate (0 = keep) without closing the device: stream
+ * off, free the buffers, set the format, allocate and stream on again. No
+ * frame may be held outside the driver. When the new format is refused the
+ * old one is set up again.
+ * ============================================================================
+ */
+int reformat_camera(struct capture_info *cinfo, int width, int height,
+		    unsigned int pixelformat, int fps)
+{
+	enum v4l2_buf_type 		type = cinfo->type;
+	struct v4l2_requestbuffers 	req;
+	int 				old_width = cinfo->width;
+	int 				old_height = cinfo->height;
+	unsigned int 			old_format = cinfo->pixelformat;
+	int 				err;
+
+	printf(".reformatting capture to %dx%d\n", width, height);
+	if (ioctl(cinfo->fd, VIDIOC_STREAMOFF, &type) == -1) {
+		printf("$$ VIDIOC_STREAMOFF failed on device\n");
+		return -EIO;
+	}
+
+	/* the format is locked while the driver has buffers */
+	free_buffers(cinfo);
+	CLEAR(req);
+	req.type = type;
+	req.memory = cinfo->memory;
+	if (ioctl(cinfo->fd, VIDIOC_REQBUFS, &req) == -1)
+		printf("$$ failed to free the capture driver buffers\n");
+
+	cinfo->width = width;
+	cinfo->height = height;
+	if (pixelformat)
+		cinfo->pixelformat = pixelformat;
+	err = negotiate_format(cinfo);
+	if (err == 0)
+		err = alloc_buffers(cinfo->buf_count, type, cinfo);
+
+	if (err < 0) {
+		printf("$$ capture format refused, going back to %dx%d\n", old_width, old_height);
+		free_buffers(cinfo);
+		ioctl(cinfo->fd, VIDIOC_REQBUFS, &req);
+		cinfo->width = old_width;
+		cinfo->height = old_height;
+		cinfo->pixelformat = old_format;
+		if (negotiate_format(cinfo) < 0 ||
+		    alloc_buffers(cinfo->buf_count, type, cinfo) < 0) {
+			printf("$$ Unable to restore the capture format\n");
+			return -EIO;
+		}
+	} else if (fps > 0) {
+		set_frame_rate(cinfo, fps);
+	}
+
+	/* the driver counts frames from 0 again */
+	cinfo->have_sequence = 0;
+
+	if (ioctl(cinfo->fd, VIDIOC_STREAMON, &type) == -1) {
+		printf("$$ VIDIOC_STREAMON failed on device\n");
+		return -EIO;
+	}
+
+	return err;
+}
+
+/* ============================================================================
+ * @Function: 	 set_frame_rate
+ * @Description: Ask the driver for fps frames per second, for drivers with a
+ * frame interval control. Others keep their rate.
+ * ============================================================================
+ */
+static int set_frame_rate(struct capture_info *cinfo, int fps)
+{
+	struct v4l2_streamparm parm;
+
+	CLEAR(parm);
+	parm.type = cinfo->type;
+	if (ioctl(cinfo->fd, VIDIOC_G_PARM, &parm) == -1 ||
+	    !(parm.parm.capture.capability & V4L2_CAP_TIMEPERFRAME)) {
+		printf(".driver has no frame rate control\n");
+		return -ENOTTY;
+	}
+
+	parm.parm.capture.timeperframe.numerator = 1;
+	parm.parm.capture.timeperframe.denominator = fps;
+	if (ioctl(cinfo->fd, VIDIOC_S_PARM, &parm) == -1) {
+		printf("$$ failed to set %d fps on capture device\n", fps);
+		return -EINVAL;
+	}
+
+	printf(".capture rate: %u/%u s per frame\n", parm.parm.capture.timeperframe.numerator,
+			parm.parm.capture.timeperframe.denominator);
+	return 0;
+}
+
 /* ============================================================================
  * @Function:	 get_camera_frame
  * @Description: Receives a frame from the camera driver using V4L2 API.
@@ -210,20 +478,130 @@ int close_camera(struct capture_info *cinfo)
 int get_camera_frame(struct capture_info *cinfo)
 {
     	struct v4l2_buffer v4l2buf;
+    	struct v4l2_plane planes[V4L2_MAX_PLANES];
+    	int err;
+
+    	CLEAR(v4l2buf);
+    	v4l2buf.type = cinfo->type;
+    	v4l2buf.memory = cinfo->memory;
+    	if (cinfo->type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+    		CLEAR(planes);
+    		v4l2buf.m.planes = planes;
+    		v4l2buf.length = cinfo->num_planes;
+    	}
 
-    	v4l2buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    	v4l2buf.memory = V4L2_MEMORY_MMAP;
-
-    	/* Get a frame buffer with captured data */
-    	if (ioctl(cinfo->fd, VIDIOC_DQBUF, &v4l2buf) < 0) {
+    	/* Get a frame buffer with captured data, the device is non-blocking
+    	 * so wait for the driver to complete one if none is ready yet */
+    	while (ioctl(cinfo->fd, VIDIOC_DQBUF, &v4l2buf) < 0) {
+    		if (errno == EAGAIN) {
+    			err = wait_camera_frame(cinfo, -1);
+    			if (err < 0)
+    				return err;
+    			continue;
+    		}
         	printf("$$ VIDIOC_DQBUF failed\n");
         	return -EIO;
     	}
 
+    	/* Keep what the driver reported (bytesused etc.) for this slot */
+    	if (cinfo->type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+    		memcpy(cinfo->planes[v4l2buf.index], planes,
+    				cinfo->num_planes * sizeof(planes[0]));
+    		v4l2buf.m.planes = cinfo->planes[v4l2buf.index];
+    	}
+    	cinfo->v4l2buf[v4l2buf.index] = v4l2buf;
+
+    	/* Gaps in the driver sequence are frames dropped for lack of buffers */
+    	if (cinfo->have_sequence && v4l2buf.sequence != cinfo->last_sequence + 1)
+    		cinfo->lost_frames += v4l2buf.sequence - cinfo->last_sequence - 1;
+    	cinfo->last_sequence = v4l2buf.sequence;
+    	cinfo->have_sequence = 1;
+
+    	/* Nothing left for the driver to capture into */
+    	if (__atomic_sub_fetch(&cinfo->queued, 1, __ATOMIC_SEQ_CST) == 0)
+    		cinfo->starvations++;
+
     	return v4l2buf.index;
 }
 
 
+/* ============================================================================
+ * @Function:	 wait_camera_frame
+ * @Description: Waits until the driver has a completed frame. Returns 1 when
+ * a frame is ready, 0 on timeout and -EINTR when woken up by wakeup_camera.
+ * While every buffer is held outside the driver (zero-copy frames still in
+ * the pipeline) vb2 answers poll with POLLERR: only the wakeup is waited for
+ * then, a slice at a time, until put_camera_frame queues one again.
+ * ============================================================================
+ */
+int wait_camera_frame(struct capture_info *cinfo, int timeout_ms)
+{
+    	struct pollfd fds[2];
+    	uint64_t event;
+    	int ret, held, slice, waited = 0;
+
+    	fds[0].fd = cinfo->fd;
+    	fds[0].events = POLLIN;
+    	fds[1].fd = cinfo->event_fd;
+    	fds[1].events = POLLIN;
+
+    	for (;;) {
+    		/* only this thread dequeues, none can go between here and poll */
+    		held = __atomic_load_n(&cinfo->queued, __ATOMIC_SEQ_CST) == 0;
+    		slice = timeout_ms;
+    		if (held && (timeout_ms < 0 || timeout_ms - waited > V4L2_REQUEUE_WAIT_MS))
+    			slice = V4L2_REQUEUE_WAIT_MS;
+    		else if (held)
+    			slice = timeout_ms - waited;
+
+    		do {
+    			ret = held ? poll(&fds[1], 1, slice) : poll(fds, 2, slice);
+    		} while (ret == -1 && errno == EINTR);
+
+    		if (ret == -1) {
+        		printf("$$ poll on capture device failed (%s)\n", strerror(errno));
+        		return -EIO;
+    		}
+    		if (ret == 0) {
+    			waited += slice;
+    			if (!held || (timeout_ms >= 0 && waited >= timeout_ms))
+    				return 0;
+    			continue;
+    		}
+
+    		if (fds[1].revents & POLLIN) {
+    			if (read(cinfo->event_fd, &event, sizeof(event)) < 0)
+    				printf("$$ failed to clear wakeup event\n");
+    			return -EINTR;
+    		}
+    		if (held)
+    			continue;
+    		if (fds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+        		printf("$$ capture device error while waiting\n");
+        		return -EIO;
+    		}
+
+    		return 1;
+    	}
+}
+
+
+/* ============================================================================
+ * @Function:	 wakeup_camera
+ * @Description: Interrupts wait_camera_frame, safe from any thread.
+ * ============================================================================
+ */
+int wakeup_camera(struct capture_info *cinfo)
+{
+    	uint64_t event = 1;
+
+    	if (write(cinfo->event_fd, &event, sizeof(event)) != sizeof(event))
+    		return -EIO;
+
+    	return 0;
+}
+
+
 /* ============================================================================
  * @Function:	 put_camera_frame
  * @Description: Gives received camera buffer back to V4L2 kernel driver.
@@ -231,13 +609,91 @@ int get_camera_frame(struct capture_info *cinfo)
  */
 int put_camera_frame(struct capture_info *cinfo, int buf_no)
 {
-    	cinfo->v4l2buf[buf_no].type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    	cinfo->v4l2buf[buf_no].type = cinfo->type;
 
     	/* Issue captured frame buffer back to device driver */
     	if (ioctl(cinfo->fd, VIDIOC_QBUF, &cinfo->v4l2buf[buf_no]) == -1) {
        	 	printf("$$ VIDIOC_QBUF failed (%s)\n", strerror(errno));
         	return -EIO;
     	}
+    	__atomic_add_fetch(&cinfo->queued, 1, __ATOMIC_SEQ_CST);
+
+    	return 0;
+}
+
+
+/* ============================================================================
+ * @Function:	 camera_plane_length
+ * @Description: Allocated size of one plane of a capture buffer.
+ * ============================================================================
+ */
+unsigned int camera_plane_length(struct capture_info *cinfo, int buf_no, unsigned int plane)
+{
+    	if (cinfo->type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE)
+    		return cinfo->planes[buf_no][plane].length;
+
+    	return cinfo->v4l2buf[buf_no].length;
+}
+
+
+/* ============================================================================
+ * @Function:	 camera_plane_data
+ * @Description: Start of the frame data in one plane of a dequeued buffer.
+ * ============================================================================
+ */
+char *camera_plane_data(struct capture_info *cinfo, int buf_no, unsigned int plane)
+{
+    	unsigned int offset = 0;
+
+    	if (cinfo->type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE &&
+    	    cinfo->planes[buf_no][plane].data_offset < cinfo->planes[buf_no][plane].bytesused)
+    		offset = cinfo->planes[buf_no][plane].data_offset;
+
+    	return cinfo->userptr[buf_no][plane] + offset;
+}
+
+
+/* ============================================================================
+ * @Function:	 camera_plane_used
+ * @Description: Bytes of frame data in one plane of a dequeued buffer. Falls
+ * back on sizeimage for drivers not setting bytesused.
+ * ============================================================================
+ */
+unsigned int camera_plane_used(struct capture_info *cinfo, int buf_no, unsigned int plane)
+{
+    	unsigned int used;
+
+    	if (cinfo->type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE)
+    		used = cinfo->planes[buf_no][plane].bytesused -
+    				(camera_plane_data(cinfo, buf_no, plane) - cinfo->userptr[buf_no][plane]);
+    	else
+    		used = cinfo->v4l2buf[buf_no].bytesused;
+
+    	if (used == 0 || used > cinfo->sizeimage[plane])
+    		used = cinfo->sizeimage[plane];
+
+    	return used;
+}
+
+
+/* ============================================================================
+ * @Function:	 grow_camera_queue
+ * @Description: Hands one of the spare buffers allocated at init over to the
+ * driver, used when the queue is seen running dry.
+ * ============================================================================
+ */
+int grow_camera_queue(struct capture_info *cinfo)
+{
+    	unsigned int buf_no = cinfo->active_count;
+
+    	if (buf_no >= cinfo->buf_count)
+    		return -ENOMEM;
+
+    	if (put_camera_frame(cinfo, buf_no) < 0)
+    		return -EIO;
+
+    	cinfo->active_count++;
+    	printf(".capture queue grown to %u buffers\n", cinfo->active_count);
 
     	return 0;
 }
@@ -246,28 +702,27 @@ int put_camera_frame(struct capture_info *cinfo, int buf_no)
 /* ============================================================================
  * @Function:	 alloc_buffers
  * @Description: Allocates capture buffers from the kernel driver. Since
- * kernel drivers are contiguous.
+ * kernel drivers are contiguous. In V4L2_MEMORY_USERPTR mode the buffers are
+ * allocated here instead, page aligned, and the driver captures into them.
  * ============================================================================
  */
 static int alloc_buffers(unsigned int buf_cnt, enum v4l2_buf_type type,
                           struct capture_info *info)
 {
     	struct v4l2_requestbuffers  req;
-    	struct v4l2_format          fmt;
-
-    	fmt.type = type;
     	int fd = info->fd;
-    	unsigned int i;
-    	//int buf_size = (HEIGHT*WIDTH*4);
-
-    	if (ioctl(fd, VIDIOC_G_FMT, &fmt) == -1) {
-    		printf("$$ error in alloc_buffers 1\n");
-        	return -EINVAL;
-    	}
+    	int mplane = (type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE);
+    	unsigned int i, p;
 
+    	CLEAR(req);
     	req.count  = buf_cnt;
     	req.type   = type;
-    	req.memory = V4L2_MEMORY_MMAP;
+    	req.memory = info->memory;
+
+    	if (info->export_dmabuf && info->memory != V4L2_MEMORY_MMAP) {
+    		printf("$$ dmabuf export needs driver (mmap) buffers\n");
+    		return -EINVAL;
+    	}
 
     	/* Allocate buffers in the capture device driver */
     	if (ioctl(fd, VIDIOC_REQBUFS, &req) == -1) {
@@ -275,43 +730,150 @@ static int alloc_buffers(unsigned int buf_cnt, enum v4l2_buf_type type,
         	return -ENOMEM;
     	}
 
-    	if (req.count < buf_cnt || !req.count) {
+    	if (req.count < info->active_count || !req.count) {
     		printf("$$ error in alloc_buffers 3\n");
         	return -ENOMEM;
     	}
 
+    	/* The driver may grant fewer buffers, give up on some spares then */
+    	if (req.count < buf_cnt) {
+    		printf(".driver granted %u of %u capture buffers\n", req.count, buf_cnt);
+    		buf_cnt = req.count;
+    	}
+    	info->buf_count = buf_cnt;
+    	info->queued = 0;
+
     	for (i = 0; i < buf_cnt; i++)
     	{
+        	CLEAR(info->v4l2buf[i]);
         	info->v4l2buf[i].type   = type;
-        	info->v4l2buf[i].memory = V4L2_MEMORY_MMAP;
+        	info->v4l2buf[i].memory = info->memory;
         	info->v4l2buf[i].index  = i;
-        	//info->v4l2buf[i].length = buf_size;
-
-        	if (ioctl(fd, VIDIOC_QUERYBUF, &info->v4l2buf[i]) == -1) {
-            		printf("$$ error in alloc_buffers 4\n");
-            		return -ENOMEM;
+        	if (mplane) {
+        		CLEAR(info->planes[i]);
+        		info->v4l2buf[i].m.planes = info->planes[i];
+        		info->v4l2buf[i].length = info->num_planes;
         	}
 
-        	/* Map the driver buffer to user space */
-        	info->userptr[i] = mmap(NULL,
-                   	info->v4l2buf[i].length,
-                   	PROT_READ | PROT_WRITE,
-                   	MAP_SHARED,
-                   	fd,
-                   	info->v4l2buf[i].m.offset);
-
-        	if (info->userptr[i] == MAP_FAILED) {
-            		printf("$$ error in alloc_buffers 5\n");
-            		return -ENOMEM;
+        	if (info->memory == V4L2_MEMORY_USERPTR) {
+        		/* Driver writes straight into our (page aligned) memory,
+        		 * sized from what it reported for the format */
+        		for (p = 0; p < info->num_planes; p++) {
+        			if (posix_memalign((void **)&info->userptr[i][p],
+        					sysconf(_SC_PAGESIZE), info->sizeimage[p]) != 0) {
+            				printf("$$ error in alloc_buffers 5\n");
+            				info->userptr[i][p] = NULL;
+            				return -ENOMEM;
+        			}
+        			if (mplane) {
+        				info->planes[i][p].m.userptr = (unsigned long)info->userptr[i][p];
+        				info->planes[i][p].length = info->sizeimage[p];
+        			} else {
+        				info->v4l2buf[i].m.userptr = (unsigned long)info->userptr[i][p];
+        				info->v4l2buf[i].length = info->sizeimage[p];
+        			}
+        		}
+        	} else {
+        		if (ioctl(fd, VIDIOC_QUERYBUF, &info->v4l2buf[i]) == -1) {
+            			printf("$$ error in alloc_buffers 4\n");
+            			return -ENOMEM;
+        		}
+
+        		/* Map the driver buffer (each plane of it) to user space */
+        		for (p = 0; p < info->num_planes; p++) {
+        			info->userptr[i][p] = mmap(NULL,
+                   			camera_plane_length(info, i, p),
+                   			PROT_READ | PROT_WRITE,
+                   			MAP_SHARED,
+                   			fd,
+                   			mplane ? info->planes[i][p].m.mem_offset
+                   			       : info->v4l2buf[i].m.offset);
+
+        			if (info->userptr[i][p] == MAP_FAILED) {
+            				printf("$$ error in alloc_buffers 5\n");
+            				info->userptr[i][p] = NULL;
+            				return -ENOMEM;
+        			}
+        		}
+
+        		if (info->export_dmabuf && export_buffer(info, i) < 0) {
+            			printf("$$ error in alloc_buffers 7\n");
+            			return -ENOMEM;
+        		}
         	}
 
-        	/* Queue buffer in device driver */
+        	/* Queue buffer in device driver, spares are kept for later */
+        	if (i >= info->active_count)
+        		continue;
         	if (ioctl(fd, VIDIOC_QBUF, &info->v4l2buf[i]) == -1) {
             		printf("$$ error in alloc_buffers 6\n");
             		return -ENOMEM;
        	 	}
+        	info->queued++;
     	}
 
    	return 0;
 }
 
+
+/* ============================================================================
+ * @Function:	 free_buffers
+ * @Description: Unmaps (or frees, USERPTR) the capture buffers and closes
+ * their dmabuf exports.
+ * ============================================================================
+ */
+static void free_buffers(struct capture_info *cinfo)
+{
+    	unsigned int i, p;
+
+    	for (i = 0; i < cinfo->buf_count; i++) {
+    		for (p = 0; p < cinfo->num_planes; p++) {
+    			if (cinfo->dmabuf_fd[i][p] >= 0)
+    				close(cinfo->dmabuf_fd[i][p]);
+    			cinfo->dmabuf_fd[i][p] = -1;
+
+    			if (!cinfo->userptr[i][p])
+    				continue;
+    			if (cinfo->memory == V4L2_MEMORY_USERPTR)
+    				free(cinfo->userptr[i][p]);
+    			else
+    				munmap(cinfo->userptr[i][p], camera_plane_length(cinfo, i, p));
+    			cinfo->userptr[i][p] = NULL;
+    		}
+    	}
+    	cinfo->queued = 0;
+}
+
+
+/* ============================================================================
+ * @Function:	 export_buffer
+ * @Description: Exports a driver buffer as dmabuf file descriptors, one per
+ * plane of multi-planar formats, so the frame can be imported by other
+ * devices or processes without a CPU copy.
+ * ============================================================================
+ */
+static int export_buffer(struct capture_info *info, unsigned int index)
+{
+#ifdef VIDIOC_EXPBUF
+    	struct v4l2_exportbuffer expbuf;
+    	unsigned int p;
+
+    	for (p = 0; p < info->num_planes; p++) {
+    		CLEAR(expbuf);
+    		expbuf.type  = info->v4l2buf[index].type;
+    		expbuf.index = index;
+    		expbuf.plane = p;
+    		expbuf.flags = O_RDWR | O_CLOEXEC;
+
+    		if (ioctl(info->fd, VIDIOC_EXPBUF, &expbuf) == -1) {
+    			printf("$$ VIDIOC_EXPBUF of plane %u failed (%s)\n", p, strerror(errno));
+        		return -errno;
+    		}
+    		info->dmabuf_fd[index][p] = expbuf.fd;
+    	}
+    	return 0;
+#else
+    	printf("$$ VIDIOC_EXPBUF is not supported by the kernel headers\n");
+    	return -ENOSYS;
+#endif
+}
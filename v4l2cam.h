@@ -6,16 +6,39 @@ extern "C" {
 #endif
 
 #include 	<linux/videodev2.h>
-#define 	V4L2_MAX_BUFFER_COUNT 4
+#define 	V4L2_MAX_BUFFER_COUNT 16
+#define 	V4L2_DEFAULT_BUFFER_COUNT 4
+#define 	V4L2_DEFAULT_TIMEOUT_MS 2000
+#define 	V4L2_REQUEUE_WAIT_MS 5	/* poll slice while no buffer is queued */
+#define 	V4L2_MAX_PLANES 3
 
 struct capture_info 
 {
 	int 	width;
 	int 	height;
+	unsigned int 	pixelformat;	/* fourcc asked for (0 = negotiate), then in use */
+	int 	prefer_compressed;	/* negotiate H.264/MJPEG first when offered */
 	int 	fd;
+	int 	event_fd;	/* wakes up wait_camera_frame() */
+	int 	timeout_ms;
 	char 	*device_name;
-	char 	*userptr[V4L2_MAX_BUFFER_COUNT];
+	enum v4l2_memory memory;
+	enum v4l2_buf_type type;	/* single or multi-planar capture */
+	unsigned int 	num_planes;	/* buffers making up one frame */
+	unsigned int 	bytesperline[V4L2_MAX_PLANES];
+	unsigned int 	sizeimage[V4L2_MAX_PLANES];
+	int 	export_dmabuf;
+	unsigned int 	buf_count;	/* buffers allocated (and mapped) */
+	unsigned int 	active_count;	/* buffers cycling through the driver */
+	unsigned int 	queued;		/* buffers currently owned by the driver */
+	unsigned int 	starvations;	/* times the driver queue ran dry */
+	unsigned int 	lost_frames;	/* frames missing from the sequence */
+	unsigned int 	last_sequence;
+	int 	have_sequence;
+	char 	*userptr[V4L2_MAX_BUFFER_COUNT][V4L2_MAX_PLANES];
+	int 	dmabuf_fd[V4L2_MAX_BUFFER_COUNT][V4L2_MAX_PLANES];
 	struct v4l2_buffer v4l2buf[V4L2_MAX_BUFFER_COUNT];
+	struct v4l2_plane planes[V4L2_MAX_BUFFER_COUNT][V4L2_MAX_PLANES];
 };
 
 int init_camera		(struct capture_info *cinfo);
@@ -23,6 +46,14 @@ int start_camera	(struct capture_info *cinfo);
 int close_camera	(struct capture_info *cinfo);
 int get_camera_frame	(struct capture_info *cinfo);
 int put_camera_frame	(struct capture_info *cinfo, int buf_no);
+int grow_camera_queue	(struct capture_info *cinfo);
+int wait_camera_frame	(struct capture_info *cinfo, int timeout_ms);
+int wakeup_camera	(struct capture_info *cinfo);
+int reformat_camera	(struct capture_info *cinfo, int width, int height,
+			 unsigned int pixelformat, int fps);
+unsigned int camera_plane_length (struct capture_info *cinfo, int buf_no, unsigned int plane);
+char *camera_plane_data		(struct capture_info *cinfo, int buf_no, unsigned int plane);
+unsigned int camera_plane_used	(struct capture_info *cinfo, int buf_no, unsigned int plane);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,258 @@
+/* ============================================================================
+ * @File: 	 yuvconv.c
+ * @Author: 	 Ozgur Eralp [ozgur.eralp@outlook.com]
+ * @Description: Packed 4:2:2 to 4:2:0 Pixel Format Conversion
+ *
+ * ============================================================================
+ *
+ * Copyright 2014 Ozgur Eralp.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * ============================================================================
+ */
+
+
+#include <stddef.h>
+#include <asm/errno.h>
+#if defined(__arm__) || defined(__aarch64__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#include "yuvconv.h"
+
+static void uyvy_i420_c (const unsigned char *s0, const unsigned char *s1,
+			unsigned char *y0, unsigned char *y1,
+			unsigned char *u, unsigned char *v, int width);
+static void uyvy_nv12_c (const unsigned char *s0, const unsigned char *s1,
+			unsigned char *y0, unsigned char *y1,
+			unsigned char *u, unsigned char *v, int width);
+static void yuyv_i420_c (const unsigned char *s0, const unsigned char *s1,
+			unsigned char *y0, unsigned char *y1,
+			unsigned char *u, unsigned char *v, int width);
+static void yuyv_nv12_c (const unsigned char *s0, const unsigned char *s1,
+			unsigned char *y0, unsigned char *y1,
+			unsigned char *u, unsigned char *v, int width);
+
+static const struct yuvconv_kernels c_kernels = {
+	"c", uyvy_i420_c, uyvy_nv12_c, yuyv_i420_c, yuyv_nv12_c
+};
+
+static const struct yuvconv_kernels *kernels;
+
+/* ============================================================================
+ * @Function: 	 yuvconv_select
+ * @Description: Choose the kernel implementation. AUTO takes NEON or SSE2
+ * when the CPU has it, the portable C version otherwise.
+ * ============================================================================
+ */
+int yuvconv_select (int impl)
+{
+	const struct yuvconv_kernels *simd = NULL;
+
+	switch (impl)
+	{
+		case YUVCONV_IMPL_C:
+			kernels = &c_kernels;
+			return 0;
+		case YUVCONV_IMPL_SSE2:
+			simd = yuvconv_sse2_kernels();
+			break;
+		case YUVCONV_IMPL_NEON:
+			simd = yuvconv_neon_kernels();
+			break;
+		case YUVCONV_IMPL_AUTO:
+#if defined(__x86_64__) || defined(__i386__)
+			if (__builtin_cpu_supports("sse2"))
+				simd = yuvconv_sse2_kernels();
+#elif defined(__aarch64__)
+			simd = yuvconv_neon_kernels();
+#elif defined(__arm__) && defined(HWCAP_NEON)
+			if (getauxval(AT_HWCAP) & HWCAP_NEON)
+				simd = yuvconv_neon_kernels();
+#endif
+			kernels = simd ? simd : &c_kernels;
+			return 0;
+		default:
+			return -EINVAL;
+	}
+
+	if (!simd)
+		return -ENOSYS;
+
+	kernels = simd;
+	return 0;
+}
+
+/* ============================================================================
+ * @Function: 	 yuvconv_name
+ * @Description: Name of the kernel implementation in use.
+ * ============================================================================
+ */
+const char *yuvconv_name (void)
+{
+	if (!kernels)
+		yuvconv_select(YUVCONV_IMPL_AUTO);
+
+	return kernels->name;
+}
+
+/* ============================================================================
+ * @Function: 	 yuvconv_size
+ * @Description: Bytes needed for a width x height frame in dst_fourcc.
+ * ============================================================================
+ */
+unsigned int yuvconv_size (unsigned int dst_fourcc, int width, int height)
+{
+	if (dst_fourcc != YUVCONV_I420 && dst_fourcc != YUVCONV_NV12)
+		return 0;
+
+	return width * height + 2 * (((width + 1) / 2) * ((height + 1) / 2));
+}
+
+/* ============================================================================
+ * @Function: 	 yuvconv_frame
+ * @Description: Convert a packed 4:2:2 frame into a contiguous 4:2:0 frame
+ * (I420: Y, U, V planes; NV12: Y plane, interleaved UV plane). The width
+ * must be even.
+ * ============================================================================
+ */
+int yuvconv_frame (unsigned int src_fourcc, const unsigned char *src, int src_stride,
+		   unsigned int dst_fourcc, unsigned char *dst, int width, int height)
+{
+	yuvconv_row_func row;
+	unsigned char *y, *u, *v;
+	int uv_stride, i;
+
+	if (!kernels)
+		yuvconv_select(YUVCONV_IMPL_AUTO);
+
+	if (src_fourcc == YUVCONV_UYVY && dst_fourcc == YUVCONV_I420)
+		row = kernels->uyvy_i420;
+	else if (src_fourcc == YUVCONV_UYVY && dst_fourcc == YUVCONV_NV12)
+		row = kernels->uyvy_nv12;
+	else if (src_fourcc == YUVCONV_YUYV && dst_fourcc == YUVCONV_I420)
+		row = kernels->yuyv_i420;
+	else if (src_fourcc == YUVCONV_YUYV && dst_fourcc == YUVCONV_NV12)
+		row = kernels->yuyv_nv12;
+	else
+		return -EINVAL;
+
+	if (width & 1)
+		return -EINVAL;
+
+	y = dst;
+	u = dst + width * height;
+	if (dst_fourcc == YUVCONV_I420) {
+		uv_stride = width / 2;
+		v = u + uv_stride * ((height + 1) / 2);
+	} else {
+		uv_stride = width;
+		v = NULL;
+	}
+
+	for (i = 0; i + 1 < height; i += 2) {
+		row(src, src + src_stride, y, y + width, u, v, width);
+		src += 2 * src_stride;
+		y += 2 * width;
+		u += uv_stride;
+		if (v)
+			v += uv_stride;
+	}
+
+	/* odd height, the last row keeps its own chroma */
+	if (height & 1)
+		row(src, src, y, y, u, v, width);
+
+	return 0;
+}
+
+/* ============================================================================
+ * Portable kernels, also the reference the SIMD ones must match bit by bit.
+ * Chroma of the row pair is the rounded average (a + b + 1) >> 1.
+ * ============================================================================
+ */
+#define AVG(a, b) ((unsigned char)(((a) + (b) + 1) >> 1))
+
+static void uyvy_i420_c (const unsigned char *s0, const unsigned char *s1,
+			unsigned char *y0, unsigned char *y1,
+			unsigned char *u, unsigned char *v, int width)
+{
+	int x;
+
+	for (x = 0; x < width; x += 2, s0 += 4, s1 += 4) {
+		y0[x] = s0[1];
+		y0[x + 1] = s0[3];
+		y1[x] = s1[1];
+		y1[x + 1] = s1[3];
+		*u++ = AVG(s0[0], s1[0]);
+		*v++ = AVG(s0[2], s1[2]);
+	}
+}
+
+static void uyvy_nv12_c (const unsigned char *s0, const unsigned char *s1,
+			unsigned char *y0, unsigned char *y1,
+			unsigned char *u, unsigned char *v, int width)
+{
+	int x;
+
+	for (x = 0; x < width; x += 2, s0 += 4, s1 += 4) {
+		y0[x] = s0[1];
+		y0[x + 1] = s0[3];
+		y1[x] = s1[1];
+		y1[x + 1] = s1[3];
+		*u++ = AVG(s0[0], s1[0]);
+		*u++ = AVG(s0[2], s1[2]);
+	}
+}
+
+static void yuyv_i420_c (const unsigned char *s0, const unsigned char *s1,
+			unsigned char *y0, unsigned char *y1,
+			unsigned char *u, unsigned char *v, int width)
+{
+	int x;
+
+	for (x = 0; x < width; x += 2, s0 += 4, s1 += 4) {
+		y0[x] = s0[0];
+		y0[x + 1] = s0[2];
+		y1[x] = s1[0];
+		y1[x + 1] = s1[2];
+		*u++ = AVG(s0[1], s1[1]);
+		*v++ = AVG(s0[3], s1[3]);
+	}
+}
+
+static void yuyv_nv12_c (const unsigned char *s0, const unsigned char *s1,
+			unsigned char *y0, unsigned char *y1,
+			unsigned char *u, unsigned char *v, int width)
+{
+	int x;
+
+	for (x = 0; x < width; x += 2, s0 += 4, s1 += 4) {
+		y0[x] = s0[0];
+		y0[x + 1] = s0[2];
+		y1[x] = s1[0];
+		y1[x + 1] = s1[2];
+		*u++ = AVG(s0[1], s1[1]);
+		*u++ = AVG(s0[3], s1[3]);
+	}
+}
@@ -0,0 +1,56 @@
+#ifndef YUVCONV_H_
+#define YUVCONV_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define YUVCONV_FOURCC(a, b, c, d) \
+	((unsigned int)(a) | ((unsigned int)(b) << 8) | \
+	 ((unsigned int)(c) << 16) | ((unsigned int)(d) << 24))
+
+/* Formats by their V4L2 fourcc */
+/* Packed 4:2:2 sources */
+#define YUVCONV_UYVY	YUVCONV_FOURCC('U', 'Y', 'V', 'Y')
+#define YUVCONV_YUYV	YUVCONV_FOURCC('Y', 'U', 'Y', 'V')
+/* Planar and semi-planar 4:2:0 destinations */
+#define YUVCONV_I420	YUVCONV_FOURCC('Y', 'U', '1', '2')
+#define YUVCONV_NV12	YUVCONV_FOURCC('N', 'V', '1', '2')
+
+/* Kernel implementations */
+#define YUVCONV_IMPL_AUTO	0	/* best one the CPU supports */
+#define YUVCONV_IMPL_C		1
+#define YUVCONV_IMPL_SSE2	2
+#define YUVCONV_IMPL_NEON	3
+
+/* Converts one row pair: luma of both rows, chroma of the two rows averaged.
+ * For NV12 u receives the interleaved UV row and v is unused. */
+typedef void (*yuvconv_row_func) (const unsigned char *s0, const unsigned char *s1,
+			unsigned char *y0, unsigned char *y1,
+			unsigned char *u, unsigned char *v, int width);
+
+struct yuvconv_kernels
+{
+	const char 	*name;
+	yuvconv_row_func uyvy_i420;
+	yuvconv_row_func uyvy_nv12;
+	yuvconv_row_func yuyv_i420;
+	yuvconv_row_func yuyv_nv12;
+};
+
+/* These functions return ERROR value as an integer */
+int yuvconv_select	(int impl);
+const char *yuvconv_name	(void);
+unsigned int yuvconv_size	(unsigned int dst_fourcc, int width, int height);
+int yuvconv_frame	(unsigned int src_fourcc, const unsigned char *src, int src_stride,
+			 unsigned int dst_fourcc, unsigned char *dst, int width, int height);
+
+/* SIMD kernel sets, NULL when not built for this CPU */
+const struct yuvconv_kernels *yuvconv_sse2_kernels (void);
+const struct yuvconv_kernels *yuvconv_neon_kernels (void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* YUVCONV_H_ */
@@ -0,0 +1,144 @@
+/* ============================================================================
+ * @File: 	 yuvconv_neon.c
+ * @Author: 	 Ozgur Eralp [ozgur.eralp@outlook.com]
+ * @Description: NEON Pixel Format Conversion Kernels
+ *
+ * ============================================================================
+ *
+ * Copyright 2014 Ozgur Eralp.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * ============================================================================
+ */
+
+
+#include <stddef.h>
+#include "yuvconv.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+#include <arm_neon.h>
+
+#define AVG(a, b) ((unsigned char)(((a) + (b) + 1) >> 1))
+
+/* ============================================================================
+ * vld4 splits 16 pixels (32 source bytes) into four lanes of 8 bytes, so a
+ * UYVY row comes out as U, Y0, V, Y1 and a YUYV row as Y0, U, Y1, V. vst2
+ * interleaves the two luma lanes back into pixel order. vrhadd rounds like
+ * (a + b + 1) >> 1, the same as the C kernels.
+ * ============================================================================
+ */
+static inline void convert_rows (const unsigned char *s0, const unsigned char *s1,
+				 unsigned char *y0, unsigned char *y1,
+				 unsigned char *u, unsigned char *v,
+				 int width, int luma_odd)
+{
+	const int yl = luma_odd ? 1 : 0, ul = luma_odd ? 0 : 1;
+	uint8x8x4_t a, b;
+	uint8x8x2_t ya, yb, c;
+	int x;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		a = vld4_u8(s0 + 2 * x);
+		b = vld4_u8(s1 + 2 * x);
+
+		ya.val[0] = a.val[yl];
+		ya.val[1] = a.val[yl + 2];
+		yb.val[0] = b.val[yl];
+		yb.val[1] = b.val[yl + 2];
+		vst2_u8(y0 + x, ya);
+		vst2_u8(y1 + x, yb);
+
+		c.val[0] = vrhadd_u8(a.val[ul], b.val[ul]);
+		c.val[1] = vrhadd_u8(a.val[ul + 2], b.val[ul + 2]);
+		if (v) {
+			vst1_u8(u + x / 2, c.val[0]);
+			vst1_u8(v + x / 2, c.val[1]);
+		} else {
+			vst2_u8(u + x, c);
+		}
+	}
+
+	/* tail, two pixels at a time */
+	for (; x < width; x += 2) {
+		const unsigned char *p0 = s0 + 2 * x, *p1 = s1 + 2 * x;
+
+		y0[x] = p0[yl];
+		y0[x + 1] = p0[yl + 2];
+		y1[x] = p1[yl];
+		y1[x + 1] = p1[yl + 2];
+		if (v) {
+			u[x / 2] = AVG(p0[ul], p1[ul]);
+			v[x / 2] = AVG(p0[ul + 2], p1[ul + 2]);
+		} else {
+			u[x] = AVG(p0[ul], p1[ul]);
+			u[x + 1] = AVG(p0[ul + 2], p1[ul + 2]);
+		}
+	}
+}
+
+static void uyvy_i420_neon (const unsigned char *s0, const unsigned char *s1,
+			unsigned char *y0, unsigned char *y1,
+			unsigned char *u, unsigned char *v, int width)
+{
+	convert_rows(s0, s1, y0, y1, u, v, width, 1);
+}
+
+static void uyvy_nv12_neon (const unsigned char *s0, const unsigned char *s1,
+			unsigned char *y0, unsigned char *y1,
+			unsigned char *u, unsigned char *v, int width)
+{
+	convert_rows(s0, s1, y0, y1, u, NULL, width, 1);
+}
+
+static void yuyv_i420_neon (const unsigned char *s0, const unsigned char *s1,
+			unsigned char *y0, unsigned char *y1,
+			unsigned char *u, unsigned char *v, int width)
+{
+	convert_rows(s0, s1, y0, y1, u, v, width, 0);
+}
+
+static void yuyv_nv12_neon (const unsigned char *s0, const unsigned char *s1,
+			unsigned char *y0, unsigned char *y1,
+			unsigned char *u, unsigned char *v, int width)
+{
+	convert_rows(s0, s1, y0, y1, u, NULL, width, 0);
+}
+
+static const struct yuvconv_kernels neon_kernels = {
+	"neon", uyvy_i420_neon, uyvy_nv12_neon, yuyv_i420_neon, yuyv_nv12_neon
+};
+
+const struct yuvconv_kernels *yuvconv_neon_kernels (void)
+{
+	return &neon_kernels;
+}
+
+#else
+
+const struct yuvconv_kernels *yuvconv_neon_kernels (void)
+{
+	return NULL;
+}
+
+#endif /* __ARM_NEON */
@@ -0,0 +1,158 @@
+/* ============================================================================
+ * @File: 	 yuvconv_sse2.c
+ * @Author: 	 Ozgur Eralp [ozgur.eralp@outlook.com]
+ * @Description: SSE2 Pixel Format Conversion Kernels
+ *
+ * ============================================================================
+ *
+ * Copyright 2014 Ozgur Eralp.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * ============================================================================
+ */
+
+
+#include <stddef.h>
+#include "yuvconv.h"
+
+#ifdef __SSE2__
+
+#include <emmintrin.h>
+
+#define AVG(a, b) ((unsigned char)(((a) + (b) + 1) >> 1))
+
+/* ============================================================================
+ * Each iteration takes 16 pixels (32 source bytes) from both rows. Luma and
+ * chroma bytes are split with a mask or a shift on 16 bit lanes and packed
+ * back with unsigned saturation, which is exact since the lanes hold bytes.
+ * _mm_avg_epu8 rounds like (a + b + 1) >> 1, the same as the C kernels.
+ * ============================================================================
+ */
+static inline void split_row (const unsigned char *s, int luma_odd,
+			      __m128i *y, __m128i *c)
+{
+	const __m128i mask = _mm_set1_epi16(0x00ff);
+	__m128i a = _mm_loadu_si128((const __m128i *)s);
+	__m128i b = _mm_loadu_si128((const __m128i *)(s + 16));
+
+	if (luma_odd) {
+		*y = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+		*c = _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask));
+	} else {
+		*y = _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask));
+		*c = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+	}
+}
+
+static inline void convert_rows (const unsigned char *s0, const unsigned char *s1,
+				 unsigned char *y0, unsigned char *y1,
+				 unsigned char *u, unsigned char *v,
+				 int width, int luma_odd)
+{
+	const __m128i mask = _mm_set1_epi16(0x00ff);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i ya, yb, ca, cb, c;
+	int x;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		split_row(s0 + 2 * x, luma_odd, &ya, &ca);
+		split_row(s1 + 2 * x, luma_odd, &yb, &cb);
+		_mm_storeu_si128((__m128i *)(y0 + x), ya);
+		_mm_storeu_si128((__m128i *)(y1 + x), yb);
+
+		/* c holds U V U V ... for 16 pixels */
+		c = _mm_avg_epu8(ca, cb);
+		if (v) {
+			_mm_storel_epi64((__m128i *)(u + x / 2),
+				_mm_packus_epi16(_mm_and_si128(c, mask), zero));
+			_mm_storel_epi64((__m128i *)(v + x / 2),
+				_mm_packus_epi16(_mm_srli_epi16(c, 8), zero));
+		} else {
+			_mm_storeu_si128((__m128i *)(u + x), c);
+		}
+	}
+
+	/* tail, two pixels at a time */
+	for (; x < width; x += 2) {
+		const unsigned char *p0 = s0 + 2 * x, *p1 = s1 + 2 * x;
+		int yo = luma_odd ? 1 : 0, co = luma_odd ? 0 : 1;
+
+		y0[x] = p0[yo];
+		y0[x + 1] = p0[yo + 2];
+		y1[x] = p1[yo];
+		y1[x + 1] = p1[yo + 2];
+		if (v) {
+			u[x / 2] = AVG(p0[co], p1[co]);
+			v[x / 2] = AVG(p0[co + 2], p1[co + 2]);
+		} else {
+			u[x] = AVG(p0[co], p1[co]);
+			u[x + 1] = AVG(p0[co + 2], p1[co + 2]);
+		}
+	}
+}
+
+static void uyvy_i420_sse2 (const unsigned char *s0, const unsigned char *s1,
+			unsigned char *y0, unsigned char *y1,
+			unsigned char *u, unsigned char *v, int width)
+{
+	convert_rows(s0, s1, y0, y1, u, v, width, 1);
+}
+
+static void uyvy_nv12_sse2 (const unsigned char *s0, const unsigned char *s1,
+			unsigned char *y0, unsigned char *y1,
+			unsigned char *u, unsigned char *v, int width)
+{
+	convert_rows(s0, s1, y0, y1, u, NULL, width, 1);
+}
+
+static void yuyv_i420_sse2 (const unsigned char *s0, const unsigned char *s1,
+			unsigned char *y0, unsigned char *y1,
+			unsigned char *u, unsigned char *v, int width)
+{
+	convert_rows(s0, s1, y0, y1, u, v, width, 0);
+}
+
+static void yuyv_nv12_sse2 (const unsigned char *s0, const unsigned char *s1,
+			unsigned char *y0, unsigned char *y1,
+			unsigned char *u, unsigned char *v, int width)
+{
+	convert_rows(s0, s1, y0, y1, u, NULL, width, 0);
+}
+
+static const struct yuvconv_kernels sse2_kernels = {
+	"sse2", uyvy_i420_sse2, uyvy_nv12_sse2, yuyv_i420_sse2, yuyv_nv12_sse2
+};
+
+const struct yuvconv_kernels *yuvconv_sse2_kernels (void)
+{
+	return &sse2_kernels;
+}
+
+#else
+
+const struct yuvconv_kernels *yuvconv_sse2_kernels (void)
+{
+	return NULL;
+}
+
+#endif /* __SSE2__ */
@@ -0,0 +1,157 @@
+/* ============================================================================
+ * @File: 	 yuvconv_test.c
+ * @Author: 	 Ozgur Eralp [ozgur.eralp@outlook.com]
+ * @Description: YUVCONV SIMD Kernel Test
+ *
+ * ============================================================================
+ *
+ * Copyright 2014 Ozgur Eralp.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * ============================================================================
+ */
+
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "yuvconv.h"
+
+#define GUARD		64	/* bytes past the frame that must stay untouched */
+#define GUARD_BYTE	0xa5
+
+static const int widths[] = {
+	2, 4, 6, 8, 10, 14, 16, 18, 30, 32, 34, 46, 48, 50, 62, 64, 66, 94, 98,
+	176, 322, 350, 640, 642, 654, 1282
+};
+static const int heights[] = { 1, 2, 3, 4, 5, 7, 16, 17 };
+static const int pads[] = { 0, 2, 6, 64 };	/* source bytes past each line */
+
+static const unsigned int sources[] = { YUVCONV_UYVY, YUVCONV_YUYV };
+static const unsigned int dests[] = { YUVCONV_I420, YUVCONV_NV12 };
+
+static int check_kernels (int impl, const char *name);
+static int convert (int impl, unsigned int src_fourcc, const unsigned char *src, int stride,
+		    unsigned int dst_fourcc, unsigned char *dst, int width, int height);
+static const char *fourcc_name (unsigned int fourcc, char name[5]);
+
+int main (void)
+{
+	int failed = 0;
+
+	if (yuvconv_sse2_kernels())
+		failed += check_kernels(YUVCONV_IMPL_SSE2, "sse2");
+	else
+		printf("..sse2 kernels not built, skipped\n");
+
+	if (yuvconv_neon_kernels())
+		failed += check_kernels(YUVCONV_IMPL_NEON, "neon");
+	else
+		printf("..neon kernels not built, skipped\n");
+
+	return failed ? 1 : 0;
+}
+
+/* ============================================================================
+ * @Function: 	 check_kernels
+ * @Description: Convert random frames with the C kernels and with impl, for
+ * every format pair, size and line pitch, and compare them byte by byte,
+ * the guard bytes past the end included. Returns the number of mismatches.
+ * ============================================================================
+ */
+static int check_kernels (int impl, const char *name)
+{
+	unsigned int s, d, w, h, p, i;
+	unsigned char *src, *ref, *out;
+	unsigned int size, cases = 0, failed = 0;
+	char sname[5], dname[5];
+	int width, height, stride;
+
+	for (s = 0; s < sizeof(sources) / sizeof(sources[0]); s++)
+	for (d = 0; d < sizeof(dests) / sizeof(dests[0]); d++)
+	for (w = 0; w < sizeof(widths) / sizeof(widths[0]); w++)
+	for (h = 0; h < sizeof(heights) / sizeof(heights[0]); h++)
+	for (p = 0; p < sizeof(pads) / sizeof(pads[0]); p++) {
+		width = widths[w];
+		height = heights[h];
+		stride = 2 * width + pads[p];
+		size = yuvconv_size(dests[d], width, height);
+
+		/* the source starts off alignment, one byte into its buffer */
+		src = malloc(stride * height + 1);
+		ref = malloc(size + GUARD);
+		out = malloc(size + GUARD);
+		if (!src || !ref || !out) {
+			printf("$$ No memory\n");
+			exit(1);
+		}
+		for (i = 0; i < (unsigned int) (stride * height + 1); i++)
+			src[i] = rand() & 0xff;
+		memset(ref, GUARD_BYTE, size + GUARD);
+		memset(out, GUARD_BYTE, size + GUARD);
+
+		if (convert(YUVCONV_IMPL_C, sources[s], src + 1, stride, dests[d], ref,
+			    width, height) != 0 ||
+		    convert(impl, sources[s], src + 1, stride, dests[d], out,
+			    width, height) != 0 ||
+		    memcmp(ref, out, size + GUARD) != 0) {
+			for (i = 0; i < size + GUARD && ref[i] == out[i]; i++)
+				;
+			printf("$$ %s %s to %s %dx%d stride %d differs from c at byte %u of %u\n",
+			       name, fourcc_name(sources[s], sname), fourcc_name(dests[d], dname),
+			       width, height, stride, i, size);
+			failed++;
+		}
+		cases++;
+
+		free(src);
+		free(ref);
+		free(out);
+	}
+
+	printf("..%s: %u of %u conversions identical to c\n", name, cases - failed, cases);
+	return failed;
+}
+
+/* ============================================================================
+ * @Function: 	 convert
+ * @Description: One frame with the kernels of impl.
+ * ============================================================================
+ */
+static int convert (int impl, unsigned int src_fourcc, const unsigned char *src, int stride,
+		    unsigned int dst_fourcc, unsigned char *dst, int width, int height)
+{
+	if (yuvconv_select(impl) != 0)
+		return -1;
+
+	return yuvconv_frame(src_fourcc, src, stride, dst_fourcc, dst, width, height);
+}
+
+static const char *fourcc_name (unsigned int fourcc, char name[5])
+{
+	memcpy(name, &fourcc, 4);
+	name[4] = 0;
+	return name;
+}